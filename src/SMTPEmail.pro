@@ -18,6 +18,7 @@ SOURCES += \
     mimehtml.cpp \
     mimeinlinefile.cpp \
     mimemessage.cpp \
+    mimetemplate.cpp \
     mimepart.cpp \
     mimetext.cpp \
     smtpclient.cpp \
@@ -28,7 +29,27 @@ SOURCES += \
     mimeqpencoder.cpp \
     mimeqpformatter.cpp \
     mimebase64formatter.cpp \
-    mimecontentformatter.cpp
+    mimecontentformatter.cpp \
+    smtpcapabilities.cpp \
+    mimesegmentbuffer.cpp \
+    smtpwriter.cpp \
+    smtpbodystreamer.cpp \
+    smtptlssessioncache.cpp \
+    smtptlsprofile.cpp \
+    smtpresolver.cpp \
+    smtpconnector.cpp \
+    smtprecipientstatus.cpp \
+    smtpenvelope.cpp \
+    smtpspool.cpp \
+    smtpretryscheduler.cpp \
+    smtpratelimiter.cpp \
+    smtpconcurrencycontroller.cpp \
+    smtpmxdelivery.cpp \
+    smtpdotstuffer.cpp \
+    smtpconnectionpool.cpp \
+    smtpdispatcher.cpp \
+    smtpresult.cpp \
+    smtpreplyparser.cpp
 
 HEADERS  += \
     emailaddress.h \
@@ -37,6 +58,7 @@ HEADERS  += \
     mimehtml.h \
     mimeinlinefile.h \
     mimemessage.h \
+    mimetemplate.h \
     mimepart.h \
     mimetext.h \
     smtpclient.h \
@@ -49,7 +71,28 @@ HEADERS  += \
     mimeqpencoder.h \
     mimeqpformatter.h \
     mimebase64formatter.h \
-    mimecontentformatter.h
+    mimecontentformatter.h \
+    smtpcapabilities.h \
+    mimesegmentbuffer.h \
+    smtpwriter.h \
+    smtpbodystreamer.h \
+    smtptlssessioncache.h \
+    smtptlsprofile.h \
+    smtpresolver.h \
+    smtpconnector.h \
+    smtprecipientstatus.h \
+    smtpenvelope.h \
+    smtpspool.h \
+    smtpretryscheduler.h \
+    smtpratelimiter.h \
+    smtpconcurrencycontroller.h \
+    smtpmxdelivery.h \
+    smtpdotstuffer.h \
+    smtpconnectionpool.h \
+    smtpmpscqueue.h \
+    smtpdispatcher.h \
+    smtpresult.h \
+    smtpreplyparser.h
 
 OTHER_FILES += \
     LICENSE \
@@ -17,6 +17,7 @@
 */
 
 #include "mimefile.h"
+#include "mimesegmentbuffer.h"
 #include <QFileInfo>
 
 /* [1] Constructors and Destructors */
@@ -63,14 +64,61 @@ MimeFile::~MimeFile()
 
 
 void MimeFile::writeContent(QIODevice &device) {
+    // Parts created from a byte array already hold their content
+    if (!file) {
+        MimePart::writeContent(device);
+        return;
+    }
+
+    // Raw file data is left to the sender, it does not have to be loaded
+    MimeSegmentBuffer *segments = qobject_cast<MimeSegmentBuffer*>(&device);
+    if (segments && cEncoding == Binary && !file->isSequential()) {
+        segments->appendFile(file, file->size());
+        device.write("\r\n");
+        return;
+    }
+
+    // Base64 is then encoded while the body is streamed
+    if (segments && cEncoding == Base64 && !file->isSequential()
+            && segments->isDeferredEncodingEnabled()) {
+        segments->appendFile(file, file->size(), MimeSegmentBuffer::Base64Segment);
+        device.write("\r\n");
+        return;
+    }
+
+    // Files are read again on every write, their encoding is not cached
     file->open(QIODevice::ReadOnly);
     this->content = file->readAll();
     file->close();
 
-    MimePart::writeContent(device);
+    encodeContent(device);
 
     this->content.clear();
 }
 
+qint64 MimeFile::contentSize() {
+    if (!file)
+        return MimePart::contentSize();
+
+    if (file->isSequential())
+        return -1;
+
+    switch (cEncoding)
+    {
+    case Base64:
+        return MimeSegmentBuffer::base64Size(file->size()) + 2;
+    case QuotedPrintable:
+    {
+        // Has to be measured, the encoded length depends on the data
+        file->open(QIODevice::ReadOnly);
+        QByteArray data = file->readAll();
+        file->close();
+        return quotedPrintableSize(data) + 2;
+    }
+    default:
+        return file->size() + 2;
+    }
+}
+
 /* [3] --- */
 
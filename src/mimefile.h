@@ -56,6 +56,7 @@ protected:
     /* [4] Protected methods */
 
     void writeContent(QIODevice &device);
+    qint64 contentSize();
 
 
     /* [4] --- */
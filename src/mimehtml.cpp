@@ -35,6 +35,7 @@ MimeHtml::~MimeHtml() {}
 void MimeHtml::setHtml(const QString & html)
 {
     this->text = html;
+    invalidate();
 }
 
 QString MimeHtml::getHtml() const
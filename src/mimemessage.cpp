@@ -115,6 +115,11 @@ void MimeMessage::setHeaderEncoding(MimePart::Encoding hEnc)
     this->hEncoding = hEnc;
 }
 
+MimePart::Encoding MimeMessage::getHeaderEncoding() const
+{
+    return hEncoding;
+}
+
 EmailAddress MimeMessage::getSender() const
 {
     return sender;
@@ -163,10 +168,28 @@ const QList<MimePart*> & MimeMessage::getParts() const
 
 QString MimeMessage::toString()
 {
-    QBuffer out;
+    QByteArray data;
+    qint64 size = getSize();
+    if (size > 0)
+        data.reserve(int(size));
+
+    QBuffer out(&data);
     out.open(QIODevice::WriteOnly);
     writeToDevice(out);
-    return QString(out.buffer());
+    return QString(data);
+}
+
+/**
+ * @brief Returns the exact size of the serialized message without encoding
+ * it, or -1 if a part reads from a sequential device.
+ */
+qint64 MimeMessage::getSize()
+{
+    qint64 size = content->getSize();
+    if (size < 0)
+        return -1;
+
+    return formatHeader().size() + size;
 }
 
 QByteArray MimeMessage::formatAddress(const EmailAddress &address, MimePart::Encoding encoding) {
@@ -190,13 +213,19 @@ QByteArray MimeMessage::format(const QString &text, MimePart::Encoding encoding)
             result.append(" =?utf-8?Q?" + QuotedPrintable::encode(text.toUtf8()).toLocal8Bit().replace(' ', "_").replace(':',"=3A") + "?=");
             break;
         default:
-            result.append(" ").append(text.toLocal8Bit());
+            // Unencoded headers are UTF-8 (RFC 6532)
+            result.append(" ").append(text.toUtf8());
         }
     }
     return result;
 }
 
 void MimeMessage::writeToDevice(QIODevice &out) {
+    out.write(formatHeader());
+    content->writeToDevice(out);
+}
+
+QByteArray MimeMessage::formatHeader() const {
     /* =========== MIME HEADER ============ */
 
     /* ---------- Sender / From ----------- */
@@ -235,14 +264,13 @@ void MimeMessage::writeToDevice(QIODevice &out) {
     /* ---------------------------------- */
 
     foreach (QString hdr, customHeaders) {
-        header.append(hdr.toLocal8Bit());
+        header.append(hdr.toUtf8());
         header.append("\r\n");
     }
 
     header.append("MIME-Version: 1.0\r\n");
 
-    out.write(header);
-    content->writeToDevice(out);
+    return header;
 }
 
 /* [3] --- */
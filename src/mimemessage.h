@@ -58,6 +58,8 @@ public:
 
     void setHeaderEncoding(MimePart::Encoding);
 
+    MimePart::Encoding getHeaderEncoding() const;
+
     EmailAddress getSender() const;
     const QList<EmailAddress> &getRecipients(RecipientType type = To) const;
     QString getSubject() const;
@@ -72,6 +74,7 @@ public:
     /* [3] Public methods */
 
     virtual QString toString();
+    qint64 getSize();
     void writeToDevice(QIODevice &device);
 
     /* [3] --- */
@@ -89,12 +92,14 @@ protected:
     
     MimePart::Encoding hEncoding;
 
+    QByteArray formatHeader() const;
+
     static QByteArray format(const QString &text, MimePart::Encoding encoding);
     static QByteArray formatAddress(const EmailAddress &address, MimePart::Encoding encoding);
 
     /* [4] --- */
 
-
+    friend class MimeTemplate;
 };
 
 #endif // MIMEMESSAGE_H
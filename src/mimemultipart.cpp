@@ -71,10 +71,24 @@ void MimeMultiPart::writeContent(QIODevice &device) {
     device.write("--\r\n");
 }
 
+qint64 MimeMultiPart::contentSize() {
+    // "--boundary\r\n" before every part, "--boundary--\r\n" at the end
+    qint64 size = cBoundary.size() + 6;
+
+    foreach (MimePart *part, parts) {
+        qint64 partSize = part->getSize();
+        if (partSize < 0)
+            return -1;
+        size += cBoundary.size() + 4 + partSize;
+    }
+    return size;
+}
+
 
 void MimeMultiPart::setMimeType(const MultiPartType type) {
     this->type = type;
     this->cType = MULTI_PART_NAMES[type];
+    invalidate();
 }
 
 MimeMultiPart::MultiPartType MimeMultiPart::getMimeType() const {
@@ -61,6 +61,7 @@ public:
     void addPart(MimePart *part);
 
     void writeContent(QIODevice &device);
+    qint64 contentSize();
 
     /* [3] --- */
 
@@ -23,6 +23,7 @@
 #include "mimeqpformatter.h"
 #include "mimebase64encoder.h"
 #include "mimeqpencoder.h"
+#include "mimesegmentbuffer.h"
 
 /* [1] Constructors and Destructors */
 
@@ -30,6 +31,7 @@ MimePart::MimePart()
 {
     cEncoding = _7Bit;
     prepared = false;
+    previousEncoding = _7Bit;
     cBoundary = "";
 }
 
@@ -46,16 +48,19 @@ MimePart::~MimePart()
 void MimePart::setContent(const QByteArray & content)
 {
     this->content = content;
+    invalidate();
 }
 
 void MimePart::setHeader(const QString & header)
 {
     this->headerLines = header;
+    invalidate();
 }
 
 void MimePart::addHeaderLine(const QString & line)
 {
     this->headerLines += line + "\r\n";
+    invalidate();
 }
 
 QString MimePart::getHeader() const
@@ -71,6 +76,7 @@ QByteArray MimePart::getContent() const
 void MimePart::setContentId(const QString & cId)
 {
     this->cId = cId;
+    invalidate();
 }
 
 QString MimePart::getContentId() const
@@ -81,6 +87,7 @@ QString MimePart::getContentId() const
 void MimePart::setContentName(const QString & cName)
 {
     this->cName = cName;
+    invalidate();
 }
 
 QString MimePart::getContentName() const
@@ -91,6 +98,7 @@ QString MimePart::getContentName() const
 void MimePart::setContentType(const QString & cType)
 {
     this->cType = cType;
+    invalidate();
 }
 
 QString MimePart::getContentType() const
@@ -101,6 +109,7 @@ QString MimePart::getContentType() const
 void MimePart::setCharset(const QString & charset)
 {
     this->cCharset = charset;
+    invalidate();
 }
 
 QString MimePart::getCharset() const
@@ -110,6 +119,23 @@ QString MimePart::getCharset() const
 
 void MimePart::setEncoding(Encoding enc)
 {
+    if (enc == cEncoding)
+        return;
+
+    // The serialization in the previous encoding is kept: SmtpClient
+    // switches parts to the negotiated encoding and back for every message
+    QByteArray header = prepared ? mimeString : QByteArray();
+    QByteArray encoded = encodedContent;
+    bool restore = (previousEncoding == enc);
+
+    prepared = restore && !previousMimeString.isNull();
+    mimeString = restore ? previousMimeString : QByteArray();
+    encodedContent = restore ? previousContent : QByteArray();
+
+    previousEncoding = this->cEncoding;
+    previousMimeString = header;
+    previousContent = encoded;
+
     this->cEncoding = enc;
 }
 
@@ -120,6 +146,7 @@ MimePart::Encoding MimePart::getEncoding() const
 
 void MimePart::setMaxLineLength(const int length) {
     maxLineLength = length;
+    invalidate();
 }
 
 int MimePart::getMaxLineLength() const {
@@ -133,13 +160,52 @@ int MimePart::getMaxLineLength() const {
 
 QString MimePart::toString()
 {
-    QBuffer out;
+    QByteArray data;
+    qint64 size = getSize();
+    if (size > 0)
+        data.reserve(int(size));
+
+    QBuffer out(&data);
     out.open(QIODevice::WriteOnly);
     writeToDevice(out);
-    return QString(out.buffer());
+    return QString(data);
 }
 
+/**
+ * @brief Returns the number of bytes writeToDevice() writes, without encoding
+ * the content, or -1 if it cannot be known in advance (sequential devices).
+ */
+qint64 MimePart::getSize()
+{
+    qint64 size = contentSize();
+    if (size < 0)
+        return -1;
+
+    prepare();
+    return mimeString.size() + size;
+}
+
+/**
+ * @brief Writes the part. The header block and the encoded content are kept
+ * after the first call, writing the part again only copies them until a
+ * setter changes the part.
+ */
 void MimePart::writeToDevice(QIODevice &device) {
+    prepare();
+    device.write(mimeString);
+
+    writeContent(device);
+}
+
+
+
+/* [3] --- */
+
+
+/* [4] Protected methods */
+
+QByteArray MimePart::formatHeader() const
+{
     QString header;
 
     /* === Header Prepare === */
@@ -175,6 +241,9 @@ void MimePart::writeToDevice(QIODevice &device) {
     case QuotedPrintable:
         header.append("quoted-printable\r\n");
         break;
+    case Binary:
+        header.append("binary\r\n");
+        break;
     }
     /* ------------------------ */
 
@@ -191,25 +260,57 @@ void MimePart::writeToDevice(QIODevice &device) {
 
     /* === End of Header Prepare === */
 
-    device.write(header.toLatin1());
-
-    writeContent(device);
+    return header.toLatin1();
 }
 
+/**
+ * Builds the header block, unless it is still valid.
+ */
+void MimePart::prepare()
+{
+    if (prepared)
+        return;
 
+    mimeString = formatHeader();
+    prepared = true;
+}
 
-/* [3] --- */
+/**
+ * Drops the serialized header block and content, called by the setters.
+ */
+void MimePart::invalidate()
+{
+    prepared = false;
+    mimeString.clear();
+    encodedContent.clear();
+    previousMimeString.clear();
+    previousContent.clear();
+}
 
+void MimePart::writeContent(QIODevice &device) {
+    if (encodedContent.isNull()) {
+        QBuffer buffer(&encodedContent);
+        buffer.open(QIODevice::WriteOnly);
+        encodeContent(buffer);
+    }
 
-/* [4] Protected methods */
+    // Segment buffers share the cached bytes instead of copying them
+    MimeSegmentBuffer *segments = qobject_cast<MimeSegmentBuffer*>(&device);
+    if (segments)
+        segments->appendData(encodedContent);
+    else
+        device.write(encodedContent);
+}
 
-void MimePart::writeContent(QIODevice &device) {
+/**
+ * Encodes the content and writes it, without caching it.
+ */
+void MimePart::encodeContent(QIODevice &device) {
     switch (cEncoding)
     {
     case _7Bit:
-        mimeString.append(QString(content).toLatin1());
-        break;
     case _8Bit:
+    case Binary:
         device.write(content);
         break;
     case Base64:
@@ -222,4 +323,51 @@ void MimePart::writeContent(QIODevice &device) {
     device.write("\r\n");
 }
 
+/**
+ * Returns the length of what writeContent() writes.
+ */
+qint64 MimePart::contentSize()
+{
+    if (!encodedContent.isNull())
+        return encodedContent.size();
+
+    switch (cEncoding)
+    {
+    case Base64:
+        return MimeSegmentBuffer::base64Size(content.size()) + 2;
+    case QuotedPrintable:
+        return quotedPrintableSize(content) + 2;
+    default:
+        return content.size() + 2;
+    }
+}
+
+/**
+ * Returns the length of data after MimeQpEncoder and MimeQPFormatter. Line
+ * breaks are encoded as well, so every line of the output is broken by the
+ * formatter at lineLength - 1 characters, or earlier before an '='.
+ */
+qint64 MimePart::quotedPrintableSize(const QByteArray &data, int lineLength)
+{
+    qint64 size = 0;
+    int chars = 0;
+
+    for (int i = 0; i < data.size(); ++i) {
+        unsigned char byte = data.at(i);
+        bool plain = (byte == 0x20) || (byte >= 33 && byte <= 126 && byte != 61);
+
+        for (int j = 0; j < (plain ? 1 : 3); ++j) {
+            char c = plain ? byte : (j == 0 ? '=' : '0');
+            size++;
+            chars++;
+            if ((chars > lineLength - 3 && c == '=') || chars == lineLength - 1) {
+                // Soft line break
+                size += 3;
+                chars = 0;
+            }
+        }
+    }
+    return size;
+}
+
 /* [4] --- */
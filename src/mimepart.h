@@ -34,7 +34,8 @@ public:
         _7Bit,
         _8Bit,
         Base64,
-        QuotedPrintable
+        QuotedPrintable,
+        Binary              // RFC 3030, needs BINARYMIME
     };
 
 
@@ -83,6 +84,7 @@ public:
     /* [3] Public methods */
 
     virtual QString toString();
+    qint64 getSize();
     void writeToDevice(QIODevice &device);
 
     /* [3] --- */
@@ -103,12 +105,27 @@ protected:
 
     int maxLineLength;
 
-    QString mimeString;
+    QByteArray mimeString;
+    QByteArray encodedContent;
     bool prepared;
 
+    Encoding previousEncoding;
+    QByteArray previousMimeString;
+    QByteArray previousContent;
+
     /* [4] --- */
 
+    QByteArray formatHeader() const;
+    void prepare();
+    void invalidate();
+
     virtual void writeContent(QIODevice &device);
+    virtual qint64 contentSize();
+    void encodeContent(QIODevice &device);
+
+    static qint64 quotedPrintableSize(const QByteArray &data, int lineLength = 76);
+
+    friend class MimeTemplate;
 };
 
 #endif // MIMEPART_H
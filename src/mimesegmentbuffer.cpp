@@ -0,0 +1,130 @@
+#include "mimesegmentbuffer.h"
+
+/* [1] Constructors and Destructors */
+
+MimeSegmentBuffer::MimeSegmentBuffer(QObject *parent) :
+    QIODevice(parent),
+    totalSize(0),
+    deferredEncoding(false),
+    sealed(false)
+{
+    QIODevice::open(WriteOnly);
+}
+
+MimeSegmentBuffer::~MimeSegmentBuffer()
+{
+}
+
+/* [1] --- */
+
+
+/* [2] Getters and Setters */
+
+const QList<MimeSegmentBuffer::Segment> &MimeSegmentBuffer::getSegments() const
+{
+    return segments;
+}
+
+qint64 MimeSegmentBuffer::getTotalSize() const
+{
+    return totalSize;
+}
+
+/**
+ * @brief Sets if base64 file parts may be registered instead of encoded.
+ * Only senders that encode Base64Segment ranges themselves enable it.
+ */
+void MimeSegmentBuffer::setDeferredEncodingEnabled(bool enabled)
+{
+    this->deferredEncoding = enabled;
+}
+
+bool MimeSegmentBuffer::isDeferredEncodingEnabled() const
+{
+    return deferredEncoding;
+}
+
+/* [2] --- */
+
+
+/* [3] Public methods */
+
+/**
+ * @brief Adds already serialized bytes as a separate segment. The array is
+ * shared, not copied.
+ */
+void MimeSegmentBuffer::appendData(const QByteArray &data)
+{
+    Segment segment;
+    segment.data = data;
+    segment.fileSize = 0;
+    segment.encoding = RawSegment;
+    segment.size = data.size();
+    segments.append(segment);
+    totalSize += segment.size;
+    sealed = true;
+}
+
+/**
+ * @brief Adds the next size bytes of the file as a separate segment. The
+ * device is not read here and must stay alive until the body is sent.
+ */
+void MimeSegmentBuffer::appendFile(QIODevice *file, qint64 size, SegmentEncoding encoding)
+{
+    Segment segment;
+    segment.file = file;
+    segment.fileSize = size;
+    segment.encoding = encoding;
+    segment.size = (encoding == Base64Segment) ? base64Size(size) : size;
+    segments.append(segment);
+    totalSize += segment.size;
+}
+
+void MimeSegmentBuffer::clear()
+{
+    segments.clear();
+    totalSize = 0;
+    sealed = false;
+}
+
+/**
+ * @brief Returns the length of size bytes in base64, split into CRLF
+ * terminated lines of 76 characters as written by MimeBase64Formatter.
+ */
+qint64 MimeSegmentBuffer::base64Size(qint64 size)
+{
+    qint64 encoded = (size + 2) / 3 * 4;
+    qint64 lines = (encoded == 0) ? 1 : (encoded + 75) / 76;
+    return encoded + 2 * lines;
+}
+
+/* [3] --- */
+
+
+/* [4] Protected methods */
+
+qint64 MimeSegmentBuffer::readData(char*, qint64)
+{
+    return -1;
+}
+
+qint64 MimeSegmentBuffer::writeData(const char *data, qint64 len)
+{
+    // Shared data added with appendData() is not extended, that would copy it
+    if (segments.isEmpty() || segments.last().file || sealed) {
+        sealed = false;
+        Segment segment;
+        segment.fileSize = 0;
+        segment.encoding = RawSegment;
+        segment.size = 0;
+        segments.append(segment);
+    }
+
+    Segment &segment = segments.last();
+    segment.data.append(data, len);
+    segment.size += len;
+    totalSize += len;
+    return len;
+}
+
+/* [4] --- */
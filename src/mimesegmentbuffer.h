@@ -0,0 +1,90 @@
+#ifndef MIMESEGMENTBUFFER_H
+#define MIMESEGMENTBUFFER_H
+
+#include <QIODevice>
+#include <QList>
+#include <QPointer>
+#include "smtpmime_global.h"
+
+/**
+ * @brief Output device for serializing a MIME message without loading the
+ * raw file contents.
+ *
+ * Bytes written to the device are collected in memory, while file parts may
+ * register their file with appendFile(). The file is then read (or sent with
+ * zero-copy) only when the body goes out on the wire.
+ *
+ * When deferred encoding is enabled, base64 file parts are registered too and
+ * encoded block by block while they are sent. Segment::size is always the
+ * number of bytes on the wire.
+ */
+class SMTP_MIME_EXPORT MimeSegmentBuffer : public QIODevice
+{
+    Q_OBJECT
+public:
+
+    enum SegmentEncoding
+    {
+        RawSegment,
+        Base64Segment
+    };
+
+    struct Segment
+    {
+        QByteArray data;
+        QPointer<QIODevice> file;
+        qint64 fileSize;
+        SegmentEncoding encoding;
+        qint64 size;
+    };
+
+    /* [1] Constructors and Destructors */
+
+    MimeSegmentBuffer(QObject *parent = 0);
+    ~MimeSegmentBuffer();
+
+    /* [1] --- */
+
+
+    /* [2] Getters and Setters */
+
+    const QList<Segment> &getSegments() const;
+    qint64 getTotalSize() const;
+
+    void setDeferredEncodingEnabled(bool enabled);
+    bool isDeferredEncodingEnabled() const;
+
+    /* [2] --- */
+
+
+    /* [3] Public methods */
+
+    void appendData(const QByteArray &data);
+    void appendFile(QIODevice *file, qint64 size, SegmentEncoding encoding = RawSegment);
+    void clear();
+
+    static qint64 base64Size(qint64 size);
+
+    /* [3] --- */
+
+protected:
+
+    /* [4] Protected members */
+
+    QList<Segment> segments;
+    qint64 totalSize;
+    bool deferredEncoding;
+    bool sealed;
+
+    /* [4] --- */
+
+
+    /* [5] Protected methods */
+
+    qint64 readData(char *data, qint64 maxlen);
+    qint64 writeData(const char *data, qint64 len);
+
+    /* [5] --- */
+};
+
+#endif // MIMESEGMENTBUFFER_H
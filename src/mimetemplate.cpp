@@ -0,0 +1,432 @@
+#include "mimetemplate.h"
+
+#include <QBuffer>
+#include "mimemultipart.h"
+#include "mimetext.h"
+#include "mimefile.h"
+#include "mimebase64formatter.h"
+#include "mimeqpformatter.h"
+#include "mimebase64encoder.h"
+#include "mimeqpencoder.h"
+
+// Bare CR and LF become CRLF, the only line break SMTP allows (RFC 5321, 2.3.8)
+static QByteArray toCrLf(const QByteArray &data)
+{
+    if (!data.contains('\r') && !data.contains('\n'))
+        return data;
+
+    QByteArray result;
+    result.reserve(data.size() + 16);
+    for (int i = 0; i < data.size(); ++i) {
+        char c = data.at(i);
+        if (c == '\r' || c == '\n') {
+            result.append("\r\n", 2);
+            if (c == '\r' && i + 1 < data.size() && data.at(i + 1) == '\n')
+                ++i;
+        } else
+            result.append(c);
+    }
+    return result;
+}
+
+/* [1] Constructors and Destructors */
+
+MimeTemplate::MimeTemplate(const QString &openDelimiter, const QString &closeDelimiter) :
+    openDelimiter(openDelimiter),
+    closeDelimiter(closeDelimiter),
+    compiled(false),
+    literalSize(0)
+{
+    header.encoding = MimePart::_8Bit;
+}
+
+MimeTemplate::~MimeTemplate()
+{
+}
+
+/* [1] --- */
+
+
+/* [2] Getters and Setters */
+
+QString MimeTemplate::getOpenDelimiter() const
+{
+    return openDelimiter;
+}
+
+QString MimeTemplate::getCloseDelimiter() const
+{
+    return closeDelimiter;
+}
+
+/**
+ * @brief Sets the delimiters of the placeholders. They apply to the next
+ * compile().
+ */
+void MimeTemplate::setDelimiters(const QString &openDelimiter, const QString &closeDelimiter)
+{
+    this->openDelimiter = openDelimiter;
+    this->closeDelimiter = closeDelimiter;
+}
+
+bool MimeTemplate::isCompiled() const
+{
+    return compiled;
+}
+
+/**
+ * @brief Returns the names of the placeholders found by compile(), in the
+ * order they first appear.
+ */
+const QStringList &MimeTemplate::getFields() const
+{
+    return fields;
+}
+
+/* [2] --- */
+
+
+/* [3] Public methods */
+
+/**
+ * @brief Compiles the message. The message is not referenced afterwards,
+ * it may be changed or deleted.
+ */
+void MimeTemplate::compile(MimeMessage &message)
+{
+    clear();
+
+    header.sender = message.sender;
+    header.recipientsTo = message.recipientsTo;
+    header.recipientsCc = message.recipientsCc;
+    header.recipientsBcc = message.recipientsBcc;
+    header.subject = message.subject;
+    header.customHeaders = message.customHeaders;
+    header.encoding = message.hEncoding;
+
+    // Every field is checked, so that all of them are listed in getFields()
+    bool personalHeader = hasPlaceholder(header.subject);
+    personalHeader |= hasPlaceholder(header.sender.getName()) | hasPlaceholder(header.sender.getAddress());
+    foreach (const EmailAddress &address, header.recipientsTo + header.recipientsCc + header.recipientsBcc)
+        personalHeader |= hasPlaceholder(address.getName()) | hasPlaceholder(address.getAddress());
+    foreach (const QString &line, header.customHeaders)
+        personalHeader |= hasPlaceholder(line);
+
+    // The header is small, it is formatted again when it is personalized so
+    // that encoded words stay valid
+    if (personalHeader) {
+        Span span;
+        span.type = HeaderSpan;
+        span.part = -1;
+        spans << span;
+    } else
+        appendLiteral(spans, message.formatHeader());
+
+    compilePart(message.content, spans);
+
+    foreach (const Span &span, spans)
+        literalSize += span.data.size();
+
+    compiled = true;
+}
+
+void MimeTemplate::clear()
+{
+    spans.clear();
+    parts.clear();
+    fields.clear();
+    header = Header();
+    header.encoding = MimePart::_8Bit;
+    literalSize = 0;
+    compiled = false;
+}
+
+QByteArray MimeTemplate::render(const QHash<QString, QString> &values) const
+{
+    QByteArray data;
+    data.reserve(literalSize + 4096);
+
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    render(buffer, values);
+
+    return data;
+}
+
+/**
+ * @brief Writes the message of one recipient to the device.
+ */
+void MimeTemplate::render(QIODevice &device, const QHash<QString, QString> &values) const
+{
+    writeSpans(device, spans, values);
+}
+
+/**
+ * @brief Returns the envelope of one recipient: the sender and the To, Cc
+ * and Bcc recipients of the template, with their placeholders filled.
+ */
+SmtpEnvelope MimeTemplate::envelope(const QHash<QString, QString> &values) const
+{
+    SmtpEnvelope envelope(substituteAddress(header.sender, values));
+
+    foreach (const EmailAddress &rcpt, header.recipientsTo)
+        envelope.addRecipient(substituteAddress(rcpt, values), MimeMessage::To);
+    foreach (const EmailAddress &rcpt, header.recipientsCc)
+        envelope.addRecipient(substituteAddress(rcpt, values), MimeMessage::Cc);
+    foreach (const EmailAddress &rcpt, header.recipientsBcc)
+        envelope.addRecipient(substituteAddress(rcpt, values), MimeMessage::Bcc);
+
+    return envelope;
+}
+
+/**
+ * @brief Fills the placeholders of a text with the values.
+ */
+QString MimeTemplate::substitute(const QString &text, const QHash<QString, QString> &values) const
+{
+    QString result;
+    int pos = 0;
+
+    forever {
+        int start = text.indexOf(openDelimiter, pos);
+        if (start < 0)
+            break;
+        int end = text.indexOf(closeDelimiter, start + openDelimiter.size());
+        if (end < 0)
+            break;
+
+        result += text.midRef(pos, start - pos);
+        result += values.value(text.mid(start + openDelimiter.size(), end - start - openDelimiter.size()).trimmed());
+        pos = end + closeDelimiter.size();
+    }
+
+    result += text.midRef(pos);
+    return result;
+}
+
+/* [3] --- */
+
+
+/* [4] Protected methods */
+
+void MimeTemplate::compilePart(MimePart *part, QList<Span> &out)
+{
+    if (!part)
+        return;
+
+    MimeMultiPart *multiPart = dynamic_cast<MimeMultiPart*>(part);
+    if (multiPart) {
+        compileText(part->formatHeader(), out, HeaderFieldSpan);
+        QByteArray boundary = part->cBoundary.toLatin1();
+        foreach (MimePart *child, multiPart->getParts()) {
+            appendLiteral(out, "--" + boundary + "\r\n");
+            compilePart(child, out);
+        }
+        appendLiteral(out, "--" + boundary + "--\r\n");
+        return;
+    }
+
+    // Files are never searched for placeholders
+    QByteArray raw;
+    MimeText *text = dynamic_cast<MimeText*>(part);
+    if (text)
+        raw = text->getText().toUtf8();
+    else if (!dynamic_cast<MimeFile*>(part))
+        raw = part->getContent();
+
+    if (!raw.contains(openDelimiter.toUtf8())) {
+        compileText(part->formatHeader(), out, HeaderFieldSpan);
+
+        QBuffer buffer;
+        buffer.open(QIODevice::WriteOnly);
+        part->writeContent(buffer);
+        appendLiteral(out, buffer.data());
+        return;
+    }
+
+    // A value may bring 8-bit characters or long lines into a 7bit part,
+    // the header announces quoted-printable instead
+    MimePart::Encoding encoding = part->getEncoding();
+    if (encoding == MimePart::_7Bit) {
+        encoding = MimePart::QuotedPrintable;
+        part->setEncoding(encoding);
+        compileText(part->formatHeader(), out, HeaderFieldSpan);
+        part->setEncoding(MimePart::_7Bit);
+    } else
+        compileText(part->formatHeader(), out, HeaderFieldSpan);
+
+    switch (encoding)
+    {
+    case MimePart::Base64:
+    case MimePart::QuotedPrintable:
+    {
+        // Encoded content has to be encoded again for every recipient
+        Part personal;
+        personal.encoding = encoding;
+        compileText(raw, personal.content);
+
+        Span span;
+        span.type = PartSpan;
+        span.part = parts.size();
+        parts << personal;
+        out << span;
+        break;
+    }
+    case MimePart::_8Bit:
+        compileText(raw, out, TextFieldSpan);
+        break;
+    default:
+        compileText(raw, out);
+    }
+
+    appendLiteral(out, "\r\n");
+}
+
+/**
+ * Splits the data into literal spans and placeholders. fieldType tells how
+ * the values are written.
+ */
+void MimeTemplate::compileText(const QByteArray &data, QList<Span> &out, SpanType fieldType)
+{
+    QByteArray open = openDelimiter.toUtf8();
+    QByteArray close = closeDelimiter.toUtf8();
+    int pos = 0;
+
+    forever {
+        int start = data.indexOf(open, pos);
+        if (start < 0)
+            break;
+        int end = data.indexOf(close, start + open.size());
+        if (end < 0)
+            break;
+
+        appendLiteral(out, data.mid(pos, start - pos));
+
+        Span span;
+        span.type = fieldType;
+        span.field = QString::fromUtf8(data.mid(start + open.size(), end - start - open.size())).trimmed();
+        span.part = -1;
+        out << span;
+
+        if (!fields.contains(span.field))
+            fields << span.field;
+
+        pos = end + close.size();
+    }
+
+    appendLiteral(out, data.mid(pos));
+}
+
+/**
+ * Appends literal bytes, joined with the previous literal span.
+ */
+void MimeTemplate::appendLiteral(QList<Span> &out, const QByteArray &data)
+{
+    if (data.isEmpty())
+        return;
+
+    if (!out.isEmpty() && out.last().type == LiteralSpan) {
+        out.last().data.append(data);
+        return;
+    }
+
+    Span span;
+    span.type = LiteralSpan;
+    span.data = data;
+    span.part = -1;
+    out << span;
+}
+
+bool MimeTemplate::hasPlaceholder(const QString &text)
+{
+    QList<Span> scanned;
+    compileText(text.toUtf8(), scanned);
+
+    foreach (const Span &span, scanned) {
+        if (span.type == FieldSpan)
+            return true;
+    }
+    return false;
+}
+
+QByteArray MimeTemplate::formatHeader(const QHash<QString, QString> &values) const
+{
+    MimeMessage message(false);
+
+    message.sender = substituteAddress(header.sender, values);
+    foreach (const EmailAddress &rcpt, header.recipientsTo)
+        message.recipientsTo << substituteAddress(rcpt, values);
+    foreach (const EmailAddress &rcpt, header.recipientsCc)
+        message.recipientsCc << substituteAddress(rcpt, values);
+    message.subject = substituteHeader(header.subject, values);
+    foreach (const QString &line, header.customHeaders)
+        message.customHeaders << substituteHeader(line, values);
+    message.hEncoding = header.encoding;
+
+    return message.formatHeader();
+}
+
+EmailAddress MimeTemplate::substituteAddress(const EmailAddress &address, const QHash<QString, QString> &values) const
+{
+    return EmailAddress(substituteHeader(address.getAddress(), values).trimmed(),
+                        substituteHeader(address.getName(), values));
+}
+
+/**
+ * Fills the placeholders of a header field. Line breaks in the values
+ * would start new header lines, they are replaced by spaces.
+ */
+QString MimeTemplate::substituteHeader(const QString &text, const QHash<QString, QString> &values) const
+{
+    if (!text.contains(openDelimiter))
+        return text;
+
+    QString result = substitute(text, values);
+    result.replace('\r', ' ').replace('\n', ' ');
+    return result;
+}
+
+void MimeTemplate::writeSpans(QIODevice &device, const QList<Span> &spans, const QHash<QString, QString> &values) const
+{
+    foreach (const Span &span, spans) {
+        switch (span.type)
+        {
+        case LiteralSpan:
+            device.write(span.data);
+            break;
+        case FieldSpan:
+            device.write(values.value(span.field).toUtf8());
+            break;
+        case HeaderFieldSpan:
+        {
+            QString value = values.value(span.field);
+            device.write(value.replace('\r', ' ').replace('\n', ' ').toUtf8());
+            break;
+        }
+        case TextFieldSpan:
+            device.write(toCrLf(values.value(span.field).toUtf8()));
+            break;
+        case HeaderSpan:
+            device.write(formatHeader(values));
+            break;
+        case PartSpan:
+            writePart(device, parts.at(span.part), values);
+            break;
+        }
+    }
+}
+
+void MimeTemplate::writePart(QIODevice &device, const Part &part, const QHash<QString, QString> &values) const
+{
+    QByteArray content;
+    QBuffer buffer(&content);
+    buffer.open(QIODevice::WriteOnly);
+    writeSpans(buffer, part.content, values);
+
+    if (part.encoding == MimePart::Base64)
+        MimeBase64Formatter(&device).write(MimeBase64Encoder().encode(content));
+    else
+        MimeQPFormatter(&device).write(MimeQpEncoder().encode(content));
+}
+
+/* [4] --- */
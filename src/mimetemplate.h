@@ -0,0 +1,137 @@
+#ifndef MIMETEMPLATE_H
+#define MIMETEMPLATE_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QList>
+#include <QString>
+#include <QStringList>
+#include "smtpmime_global.h"
+#include "mimemessage.h"
+#include "smtpenvelope.h"
+
+class QIODevice;
+
+/**
+ * @brief A message with placeholders (e.g. "{{name}}"), compiled once and
+ * rendered for every recipient of a mail merge.
+ *
+ * compile() serializes the message into a sequence of literal byte spans
+ * and substitution slots. Parts without placeholders, attachments included,
+ * are encoded once at this point. Placeholders in 8bit and binary parts
+ * are filled by splicing the value between the literal spans; only base64
+ * and quoted-printable parts that contain placeholders, and the message
+ * header if it does, are encoded again by render(). A 7bit part with
+ * placeholders is sent quoted-printable, a value could make it 8-bit.
+ *
+ * Values are inserted as UTF-8. Line breaks are removed from values going
+ * into a header and written as CRLF in 8bit parts. Placeholders without a
+ * value are left empty.
+ *
+ * render() and envelope() do not modify the template and may be called from
+ * several threads at once.
+ */
+class SMTP_MIME_EXPORT MimeTemplate
+{
+public:
+
+    /* [1] Constructors and Destructors */
+
+    MimeTemplate(const QString &openDelimiter = "{{", const QString &closeDelimiter = "}}");
+    ~MimeTemplate();
+
+    /* [1] --- */
+
+
+    /* [2] Getters and Setters */
+
+    QString getOpenDelimiter() const;
+    QString getCloseDelimiter() const;
+    void setDelimiters(const QString &openDelimiter, const QString &closeDelimiter);
+
+    bool isCompiled() const;
+    const QStringList &getFields() const;
+
+    /* [2] --- */
+
+
+    /* [3] Public methods */
+
+    void compile(MimeMessage &message);
+    void clear();
+
+    QByteArray render(const QHash<QString, QString> &values) const;
+    void render(QIODevice &device, const QHash<QString, QString> &values) const;
+    SmtpEnvelope envelope(const QHash<QString, QString> &values) const;
+
+    QString substitute(const QString &text, const QHash<QString, QString> &values) const;
+
+    /* [3] --- */
+
+protected:
+
+    enum SpanType
+    {
+        LiteralSpan,
+        FieldSpan,
+        HeaderFieldSpan,
+        TextFieldSpan,
+        HeaderSpan,
+        PartSpan
+    };
+
+    struct Span
+    {
+        SpanType type;
+        QByteArray data;
+        QString field;
+        int part;
+    };
+
+    struct Part
+    {
+        MimePart::Encoding encoding;
+        QList<Span> content;
+    };
+
+    struct Header
+    {
+        EmailAddress sender;
+        QList<EmailAddress> recipientsTo, recipientsCc, recipientsBcc;
+        QString subject;
+        QStringList customHeaders;
+        MimePart::Encoding encoding;
+    };
+
+    /* [4] Protected members */
+
+    QString openDelimiter;
+    QString closeDelimiter;
+    bool compiled;
+
+    QList<Span> spans;
+    QList<Part> parts;
+    Header header;
+    QStringList fields;
+    int literalSize;
+
+    /* [4] --- */
+
+
+    /* [5] Protected methods */
+
+    void compilePart(MimePart *part, QList<Span> &out);
+    void compileText(const QByteArray &data, QList<Span> &out, SpanType fieldType = FieldSpan);
+    void appendLiteral(QList<Span> &out, const QByteArray &data);
+    bool hasPlaceholder(const QString &text);
+
+    QByteArray formatHeader(const QHash<QString, QString> &values) const;
+    EmailAddress substituteAddress(const EmailAddress &address, const QHash<QString, QString> &values) const;
+    QString substituteHeader(const QString &text, const QHash<QString, QString> &values) const;
+    void writeSpans(QIODevice &device, const QList<Span> &spans, const QHash<QString, QString> &values) const;
+    void writePart(QIODevice &device, const Part &part, const QHash<QString, QString> &values) const;
+
+    /* [5] --- */
+};
+
+#endif // MIMETEMPLATE_H
@@ -38,6 +38,7 @@ MimeText::~MimeText() { }
 void MimeText::setText(const QString & text)
 {
     this->text = text;
+    invalidate();
 }
 
 const QString & MimeText::getText() const
@@ -51,8 +52,16 @@ const QString & MimeText::getText() const
 /* [3] Protected Methods */
 
 void MimeText::writeContent(QIODevice &device) {
-    this->content = text.toLocal8Bit();
+    // The text is only converted again when the part changed
+    if (encodedContent.isNull())
+        this->content = text.toUtf8();
     MimePart::writeContent(device);
 }
 
+qint64 MimeText::contentSize() {
+    if (encodedContent.isNull())
+        this->content = text.toUtf8();
+    return MimePart::contentSize();
+}
+
 /* [3] --- */
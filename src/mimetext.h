@@ -53,6 +53,7 @@ protected:
     /* [4] Protected methods */
 
     void writeContent(QIODevice &device);
+    qint64 contentSize();
 
     /* [4] --- */
 
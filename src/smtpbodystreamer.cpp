@@ -0,0 +1,227 @@
+#include "smtpbodystreamer.h"
+
+#include <QtNetwork/QTcpSocket>
+
+// Multiple of 57, every block encodes to whole base64 lines
+static const qint64 BASE64_BLOCK_SIZE = 57 * 1024;
+static const qint64 RAW_BLOCK_SIZE = 64 * 1024;
+
+/* [1] Constructors and Destructors */
+
+SmtpBodyStreamer::SmtpBodyStreamer(QTcpSocket *socket, const QList<MimeSegmentBuffer::Segment> &segments,
+                                   QObject *parent) :
+    QObject(parent),
+    socket(socket),
+    stuffer(socket),
+    segments(segments),
+    segment(0),
+    offset(0),
+    fileReady(false),
+    fileOpened(false),
+    windowSize(256 * 1024),
+    running(false),
+    pumping(false)
+{
+}
+
+SmtpBodyStreamer::~SmtpBodyStreamer()
+{
+    stop();
+}
+
+/* [1] --- */
+
+
+/* [2] Getters and Setters */
+
+/**
+ * @brief Sets how many bytes may wait in the socket's write buffer before
+ * the streamer stops producing more of the body.
+ */
+void SmtpBodyStreamer::setWindowSize(qint64 size)
+{
+    this->windowSize = size;
+}
+
+qint64 SmtpBodyStreamer::getWindowSize() const
+{
+    return windowSize;
+}
+
+/**
+ * @brief Returns true if the whole body has been handed over to the socket.
+ */
+bool SmtpBodyStreamer::isFinished() const
+{
+    return segment == segments.size();
+}
+
+/**
+ * @brief Returns true if the body ended with CRLF, see
+ * SmtpDotStuffer::isAtLineStart().
+ */
+bool SmtpBodyStreamer::isAtLineStart() const
+{
+    return stuffer.isAtLineStart();
+}
+
+/* [2] --- */
+
+
+/* [3] Public methods */
+
+void SmtpBodyStreamer::start()
+{
+    if (running)
+        return;
+
+    running = true;
+    connect(socket, SIGNAL(bytesWritten(qint64)), this, SLOT(pump()));
+    pump();
+}
+
+/**
+ * @brief Stops sending, the rest of the body is dropped.
+ */
+void SmtpBodyStreamer::stop()
+{
+    running = false;
+
+    if (socket)
+        disconnect(socket, 0, this, 0);
+
+    if (fileOpened && segment < segments.size() && segments.at(segment).file)
+        segments.at(segment).file->close();
+    fileOpened = false;
+    fileReady = false;
+}
+
+/* [3] --- */
+
+
+/* [4] Protected slots */
+
+void SmtpBodyStreamer::pump()
+{
+    if (!running || pumping)
+        return;
+
+    if (!socket) {
+        abort("Connection closed while sending the message");
+        return;
+    }
+
+    pumping = true;
+
+    while (running && segment < segments.size()) {
+        qint64 room = windowSize - socket->bytesToWrite();
+        if (room <= 0)
+            break;
+
+        const MimeSegmentBuffer::Segment &current = segments.at(segment);
+        if (!writeSegment(current, room))
+            break;
+
+        if (offset == (current.file ? current.fileSize : current.size)) {
+            if (fileOpened)
+                current.file->close();
+            fileOpened = false;
+            fileReady = false;
+            segment++;
+            offset = 0;
+        }
+    }
+
+    pumping = false;
+
+    if (running && isFinished())
+        finish();
+}
+
+/* [4] --- */
+
+
+/* [5] Protected methods */
+
+/**
+ * Writes up to about room bytes of the current segment. Returns false if the
+ * streamer was aborted.
+ */
+bool SmtpBodyStreamer::writeSegment(const MimeSegmentBuffer::Segment &current, qint64 room)
+{
+    if (!current.file) {
+        if (current.data.size() != current.size) {
+            abort("File deleted before it was sent");
+            return false;
+        }
+        qint64 n = qMin(room, current.size - offset);
+        stuffer.write(current.data.constData() + offset, n);
+        offset += n;
+        return true;
+    }
+
+    if (!fileReady) {
+        if (!current.file->isOpen()) {
+            if (!current.file->open(QIODevice::ReadOnly)) {
+                abort("Cannot open file");
+                return false;
+            }
+            fileOpened = true;
+        } else if (!current.file->seek(0)) {
+            abort("Cannot seek in file");
+            return false;
+        }
+        fileReady = true;
+
+        // An empty base64 part is still one (empty) line
+        if (current.encoding == MimeSegmentBuffer::Base64Segment && current.fileSize == 0)
+            stuffer.write("\r\n", 2);
+    }
+
+    qint64 n;
+    if (current.encoding == MimeSegmentBuffer::Base64Segment)
+        n = qMin(current.fileSize - offset, qBound<qint64>(57, room / 78 * 57, BASE64_BLOCK_SIZE));
+    else
+        n = qMin(current.fileSize - offset, qMin(room, RAW_BLOCK_SIZE));
+
+    if (n == 0)
+        return true;
+
+    block.resize(n);
+    if (current.file->read(block.data(), n) != n) {
+        abort("Unexpected end of file");
+        return false;
+    }
+    offset += n;
+
+    if (current.encoding == MimeSegmentBuffer::RawSegment) {
+        stuffer.write(block);
+        return true;
+    }
+
+    // Same line layout as MimeBase64Formatter
+    QByteArray encoded = block.toBase64();
+    lines.resize(0);
+    for (int i = 0; i < encoded.size(); i += 76) {
+        lines.append(encoded.constData() + i, qMin(76, encoded.size() - i));
+        lines.append("\r\n", 2);
+    }
+    stuffer.write(lines);
+    return true;
+}
+
+void SmtpBodyStreamer::finish()
+{
+    running = false;
+    if (socket)
+        disconnect(socket, 0, this, 0);
+    emit finished();
+}
+
+void SmtpBodyStreamer::abort(const char *reason)
+{
+    stop();
+    emit error(QString(reason));
+}
+
+/* [5] --- */
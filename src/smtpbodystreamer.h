@@ -0,0 +1,88 @@
+#ifndef SMTPBODYSTREAMER_H
+#define SMTPBODYSTREAMER_H
+
+#include <QObject>
+#include <QPointer>
+#include "smtpmime_global.h"
+#include "mimesegmentbuffer.h"
+#include "smtpdotstuffer.h"
+
+class QTcpSocket;
+
+/**
+ * @brief Sends a serialized message body as the payload of DATA.
+ *
+ * The body is pulled from its segments only while the socket has less than
+ * the window size waiting to be written, and resumed every time the socket
+ * reports written bytes. Base64 file segments are read and encoded block by
+ * block, so the memory used per connection does not grow with the message.
+ */
+class SMTP_MIME_EXPORT SmtpBodyStreamer : public QObject
+{
+    Q_OBJECT
+public:
+
+    /* [1] Constructors and Destructors */
+
+    SmtpBodyStreamer(QTcpSocket *socket, const QList<MimeSegmentBuffer::Segment> &segments,
+                     QObject *parent = 0);
+    ~SmtpBodyStreamer();
+
+    /* [1] --- */
+
+
+    /* [2] Getters and Setters */
+
+    void setWindowSize(qint64 size);
+    qint64 getWindowSize() const;
+
+    bool isFinished() const;
+    bool isAtLineStart() const;
+
+    /* [2] --- */
+
+
+    /* [3] Public methods */
+
+    void start();
+    void stop();
+
+    /* [3] --- */
+
+signals:
+    void finished();
+    void error(const QString &text);
+
+protected slots:
+    void pump();
+
+protected:
+
+    /* [4] Protected members */
+
+    QPointer<QTcpSocket> socket;
+    SmtpDotStuffer stuffer;
+    QList<MimeSegmentBuffer::Segment> segments;
+    int segment;
+    qint64 offset;
+    bool fileReady;
+    bool fileOpened;
+    qint64 windowSize;
+    bool running;
+    bool pumping;
+    QByteArray block;
+    QByteArray lines;
+
+    /* [4] --- */
+
+
+    /* [5] Protected methods */
+
+    bool writeSegment(const MimeSegmentBuffer::Segment &current, qint64 length);
+    void finish();
+    void abort(const char *reason);
+
+    /* [5] --- */
+};
+
+#endif // SMTPBODYSTREAMER_H
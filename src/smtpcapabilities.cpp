@@ -0,0 +1,323 @@
+#include "smtpcapabilities.h"
+
+#include <QDateTime>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSettings>
+
+/* [1] Constructors and Destructors */
+
+SmtpCapabilities::SmtpCapabilities() :
+    valid(false),
+    sizeLimit(0),
+    recipientLimit(0),
+    pipelining(false),
+    chunking(false),
+    eightBitMime(false),
+    smtpUtf8(false),
+    binaryMime(false),
+    enhancedStatusCodes(false),
+    startTls(false)
+{
+}
+
+/**
+ * @brief Builds the capabilities from EHLO keyword lines, without the
+ * reply code (e.g. "SIZE 35882577", "AUTH LOGIN PLAIN").
+ */
+SmtpCapabilities::SmtpCapabilities(const QStringList &keywordLines) :
+    valid(true),
+    lines(keywordLines),
+    sizeLimit(0),
+    recipientLimit(0),
+    pipelining(false),
+    chunking(false),
+    eightBitMime(false),
+    smtpUtf8(false),
+    binaryMime(false),
+    enhancedStatusCodes(false),
+    startTls(false)
+{
+    foreach (const QString &line, lines) {
+        QString keyword = line.section(' ', 0, 0).toUpper();
+        QString params = line.section(' ', 1).trimmed();
+
+        // Some older servers announce AUTH as "AUTH=LOGIN PLAIN"
+        if (keyword.startsWith("AUTH=")) {
+            params = (keyword.mid(5) + " " + params).trimmed();
+            keyword = "AUTH";
+        }
+
+        if (keyword == "AUTH" && keywords.contains(keyword))
+            params = keywords.value(keyword) + " " + params;
+
+        keywords.insert(keyword, params);
+    }
+
+    sizeLimit = keywords.value("SIZE").toLongLong();
+
+    // LIMITS (RFC 9422) carries name=value pairs, e.g. "RCPTMAX=100 MAILMAX=50"
+    foreach (const QString &limit, keywords.value("LIMITS").split(' ', QString::SkipEmptyParts)) {
+        if (limit.section('=', 0, 0).toUpper() == "RCPTMAX")
+            recipientLimit = limit.section('=', 1).toInt();
+    }
+    pipelining = keywords.contains("PIPELINING");
+    chunking = keywords.contains("CHUNKING");
+    eightBitMime = keywords.contains("8BITMIME");
+    smtpUtf8 = keywords.contains("SMTPUTF8");
+    binaryMime = keywords.contains("BINARYMIME");
+    enhancedStatusCodes = keywords.contains("ENHANCEDSTATUSCODES");
+    startTls = keywords.contains("STARTTLS");
+
+    foreach (const QString &mechanism, keywords.value("AUTH").split(' ', QString::SkipEmptyParts)) {
+        if (!authMechanisms.contains(mechanism.toUpper()))
+            authMechanisms << mechanism.toUpper();
+    }
+}
+
+SmtpCapabilities::~SmtpCapabilities()
+{
+}
+
+/**
+ * @brief Parses a complete (multi-line) reply to EHLO. The first line is
+ * the server's greeting, every following line carries one extension.
+ */
+SmtpCapabilities SmtpCapabilities::fromEhloResponse(const QString &response)
+{
+    QStringList lines = response.split("\r\n", QString::SkipEmptyParts);
+    QStringList keywordLines;
+
+    for (int i = 1; i < lines.size(); ++i)
+        keywordLines << lines.at(i).mid(4).trimmed();
+
+    return SmtpCapabilities(keywordLines);
+}
+
+/* [1] --- */
+
+
+/* [2] Getters */
+
+/**
+ * @brief Returns true if the capabilities come from an EHLO reply.
+ */
+bool SmtpCapabilities::isValid() const
+{
+    return valid;
+}
+
+QStringList SmtpCapabilities::getKeywordLines() const
+{
+    return lines;
+}
+
+bool SmtpCapabilities::hasExtension(const QString &keyword) const
+{
+    return keywords.contains(keyword.toUpper());
+}
+
+QString SmtpCapabilities::getParameters(const QString &keyword) const
+{
+    return keywords.value(keyword.toUpper());
+}
+
+/**
+ * @brief Returns the maximum message size accepted by the server (SIZE
+ * extension). Zero means that no limit was announced.
+ */
+qint64 SmtpCapabilities::getSizeLimit() const
+{
+    return sizeLimit;
+}
+
+/**
+ * @brief Returns the maximum number of recipients per transaction announced
+ * with the LIMITS extension (RCPTMAX). Zero means that no limit was announced.
+ */
+int SmtpCapabilities::getRecipientLimit() const
+{
+    return recipientLimit;
+}
+
+bool SmtpCapabilities::hasPipelining() const
+{
+    return pipelining;
+}
+
+bool SmtpCapabilities::hasChunking() const
+{
+    return chunking;
+}
+
+bool SmtpCapabilities::has8BitMime() const
+{
+    return eightBitMime;
+}
+
+bool SmtpCapabilities::hasSmtpUtf8() const
+{
+    return smtpUtf8;
+}
+
+bool SmtpCapabilities::hasBinaryMime() const
+{
+    return binaryMime;
+}
+
+bool SmtpCapabilities::hasEnhancedStatusCodes() const
+{
+    return enhancedStatusCodes;
+}
+
+bool SmtpCapabilities::hasStartTls() const
+{
+    return startTls;
+}
+
+QStringList SmtpCapabilities::getAuthMechanisms() const
+{
+    return authMechanisms;
+}
+
+bool SmtpCapabilities::supportsAuth(const QString &mechanism) const
+{
+    return authMechanisms.contains(mechanism.toUpper());
+}
+
+/* [2] --- */
+
+
+/* [3] Capability cache */
+
+namespace {
+
+struct CacheEntry
+{
+    QStringList keywordLines;
+    QDateTime updated;
+};
+
+QMutex cacheMutex;
+QHash<QString, CacheEntry> cacheEntries;
+QString cacheStorageFile;
+int cacheMaxAge = 24 * 60 * 60;
+
+QString cacheKey(const QString &host, int port)
+{
+    return host.toLower() + ":" + QString::number(port);
+}
+
+}
+
+/**
+ * @brief Returns the cached capabilities of the server, or invalid
+ * capabilities if the server is unknown or the entry is too old.
+ */
+SmtpCapabilities SmtpCapabilityCache::lookup(const QString &host, int port)
+{
+    QMutexLocker locker(&cacheMutex);
+
+    QHash<QString, CacheEntry>::const_iterator it = cacheEntries.constFind(cacheKey(host, port));
+    if (it == cacheEntries.constEnd())
+        return SmtpCapabilities();
+
+    if (cacheMaxAge > 0 && it->updated.secsTo(QDateTime::currentDateTimeUtc()) > cacheMaxAge)
+        return SmtpCapabilities();
+
+    return SmtpCapabilities(it->keywordLines);
+}
+
+void SmtpCapabilityCache::insert(const QString &host, int port, const SmtpCapabilities &capabilities)
+{
+    if (!capabilities.isValid())
+        return;
+
+    QMutexLocker locker(&cacheMutex);
+
+    CacheEntry entry;
+    entry.keywordLines = capabilities.getKeywordLines();
+    entry.updated = QDateTime::currentDateTimeUtc();
+
+    QString key = cacheKey(host, port);
+    cacheEntries.insert(key, entry);
+
+    if (!cacheStorageFile.isEmpty()) {
+        QSettings settings(cacheStorageFile, QSettings::IniFormat);
+        settings.beginGroup(key);
+        settings.setValue("keywords", entry.keywordLines);
+        settings.setValue("updated", entry.updated);
+        settings.endGroup();
+    }
+}
+
+void SmtpCapabilityCache::remove(const QString &host, int port)
+{
+    QMutexLocker locker(&cacheMutex);
+
+    QString key = cacheKey(host, port);
+    cacheEntries.remove(key);
+
+    if (!cacheStorageFile.isEmpty())
+        QSettings(cacheStorageFile, QSettings::IniFormat).remove(key);
+}
+
+void SmtpCapabilityCache::clear()
+{
+    QMutexLocker locker(&cacheMutex);
+
+    cacheEntries.clear();
+
+    if (!cacheStorageFile.isEmpty())
+        QSettings(cacheStorageFile, QSettings::IniFormat).clear();
+}
+
+/**
+ * @brief Sets the file the cache is persisted to and loads its entries.
+ * An empty name keeps the cache in memory only.
+ */
+void SmtpCapabilityCache::setStorageFile(const QString &fileName)
+{
+    QMutexLocker locker(&cacheMutex);
+
+    cacheStorageFile = fileName;
+    if (fileName.isEmpty())
+        return;
+
+    QSettings settings(fileName, QSettings::IniFormat);
+    foreach (const QString &key, settings.childGroups()) {
+        settings.beginGroup(key);
+        CacheEntry entry;
+        entry.keywordLines = settings.value("keywords").toStringList();
+        entry.updated = settings.value("updated").toDateTime();
+        settings.endGroup();
+
+        if (!cacheEntries.contains(key))
+            cacheEntries.insert(key, entry);
+    }
+}
+
+QString SmtpCapabilityCache::getStorageFile()
+{
+    QMutexLocker locker(&cacheMutex);
+    return cacheStorageFile;
+}
+
+/**
+ * @brief Sets how long (in seconds) a cached entry stays valid. Zero
+ * disables expiration.
+ */
+void SmtpCapabilityCache::setMaxAge(int secs)
+{
+    QMutexLocker locker(&cacheMutex);
+    cacheMaxAge = secs;
+}
+
+int SmtpCapabilityCache::getMaxAge()
+{
+    QMutexLocker locker(&cacheMutex);
+    return cacheMaxAge;
+}
+
+/* [3] --- */
@@ -0,0 +1,98 @@
+#ifndef SMTPCAPABILITIES_H
+#define SMTPCAPABILITIES_H
+
+#include <QString>
+#include <QStringList>
+#include <QMap>
+#include "smtpmime_global.h"
+
+/**
+ * @brief The ESMTP extensions a server advertised in its EHLO reply.
+ */
+class SMTP_MIME_EXPORT SmtpCapabilities
+{
+public:
+
+    /* [1] Constructors and Destructors */
+
+    SmtpCapabilities();
+    SmtpCapabilities(const QStringList &keywordLines);
+    ~SmtpCapabilities();
+
+    static SmtpCapabilities fromEhloResponse(const QString &response);
+
+    /* [1] --- */
+
+
+    /* [2] Getters */
+
+    bool isValid() const;
+    QStringList getKeywordLines() const;
+
+    bool hasExtension(const QString &keyword) const;
+    QString getParameters(const QString &keyword) const;
+
+    qint64 getSizeLimit() const;
+    int getRecipientLimit() const;
+    bool hasPipelining() const;
+    bool hasChunking() const;
+    bool has8BitMime() const;
+    bool hasSmtpUtf8() const;
+    bool hasBinaryMime() const;
+    bool hasEnhancedStatusCodes() const;
+    bool hasStartTls() const;
+
+    QStringList getAuthMechanisms() const;
+    bool supportsAuth(const QString &mechanism) const;
+
+    /* [2] --- */
+
+private:
+
+    /* [3] Private members */
+
+    bool valid;
+    QStringList lines;
+    QMap<QString, QString> keywords;
+
+    qint64 sizeLimit;
+    int recipientLimit;
+    bool pipelining;
+    bool chunking;
+    bool eightBitMime;
+    bool smtpUtf8;
+    bool binaryMime;
+    bool enhancedStatusCodes;
+    bool startTls;
+    QStringList authMechanisms;
+
+    /* [3] --- */
+};
+
+
+/**
+ * @brief Process-wide cache of server capabilities, keyed by host and port.
+ *
+ * When a storage file is set the cache is loaded from it and every update is
+ * written back, so the capabilities survive between processes.
+ */
+class SMTP_MIME_EXPORT SmtpCapabilityCache
+{
+public:
+
+    static SmtpCapabilities lookup(const QString &host, int port);
+    static void insert(const QString &host, int port, const SmtpCapabilities &capabilities);
+    static void remove(const QString &host, int port);
+    static void clear();
+
+    static void setStorageFile(const QString &fileName);
+    static QString getStorageFile();
+
+    static void setMaxAge(int secs);
+    static int getMaxAge();
+
+private:
+    SmtpCapabilityCache();
+};
+
+#endif // SMTPCAPABILITIES_H
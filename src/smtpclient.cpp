@@ -17,6 +17,13 @@
 */
 
 #include "smtpclient.h"
+#include "smtpwriter.h"
+#include "smtpbodystreamer.h"
+#include "smtptlssessioncache.h"
+#include "smtptlsprofile.h"
+#include "smtpconnector.h"
+#include "smtpratelimiter.h"
+#include "mimefile.h"
 
 #include <QFileInfo>
 #include <QByteArray>
@@ -24,33 +31,156 @@
 #include <QEventLoop>
 #include <QMetaEnum>
 
+// Chunks sent ahead of their replies with PIPELINING
+static const int BDAT_WINDOW = 2;
+
+static void findParts(MimePart *part, QList<MimePart*> &parts)
+{
+    parts << part;
+
+    MimeMultiPart *multiPart = dynamic_cast<MimeMultiPart*>(part);
+    if (multiPart) {
+        foreach (MimePart *child, multiPart->getParts())
+            findParts(child, parts);
+    }
+}
+
+static bool isAscii(const QString &text)
+{
+    const QChar *chars = text.constData();
+    for (int i = 0; i < text.size(); ++i) {
+        if (chars[i].unicode() >= 0x80)
+            return false;
+    }
+    return true;
+}
+
+static bool hasAsciiHeaders(const MimeMessage &email)
+{
+    if (!isAscii(email.getSender().getName()) || !isAscii(email.getSubject()))
+        return false;
+
+    const MimeMessage::RecipientType types[] = { MimeMessage::To, MimeMessage::Cc };
+    for (int i = 0; i < 2; ++i) {
+        foreach (const EmailAddress &rcpt, email.getRecipients(types[i])) {
+            if (!isAscii(rcpt.getName()))
+                return false;
+        }
+    }
+
+    foreach (const QString &header, email.getCustomHeaders()) {
+        if (!isAscii(header))
+            return false;
+    }
+    return true;
+}
+
+static bool hasAsciiAddresses(const SmtpEnvelope &envelope)
+{
+    if (!isAscii(envelope.getSender().getAddress()))
+        return false;
+
+    foreach (const EmailAddress &rcpt, envelope.getRecipients()) {
+        if (!isAscii(rcpt.getAddress()))
+            return false;
+    }
+    return true;
+}
+
+static bool hasHighBytes(const QByteArray &data)
+{
+    const char *bytes = data.constData();
+    for (int i = 0; i < data.size(); ++i) {
+        if (bytes[i] & 0x80)
+            return true;
+    }
+    return false;
+}
+
 /* [1] Constructors and destructors */
 
 SmtpClient::SmtpClient(const QString & host, int port, ConnectionType connectionType) :
+    socket(NULL),
     state(UnconnectedState),
     name("localhost"),
     authMethod(AuthPlain),
+    verifyPeer(true),
+    tlsProfile(SmtpTlsProfile::defaultProfile()),
+    rateLimiter(0),
+    pacedState(UnconnectedState),
+    paced(false),
+    responseCode(0),
     isReadyConnected(false),
     isAuthenticated(false),
     isMailSent(false),
     isReset(false),
-    verifyPeer(true),
-    socket(NULL)
+    email(0),
+    rcptSent(0),
+    batchFull(false),
+    batchOpen(false),
+    maxRecipients(100),
+    rcptReplies(0),
+    operationRunning(false),
+    chunkSize(1024 * 1024),
+    binaryMimeEnabled(true),
+    useBinaryMime(false),
+    use8BitMime(false),
+    useSmtpUtf8(false),
+    messageSize(-1),
+    savedHeaderEncoding(MimePart::_8Bit),
+    bodySize(0),
+    bdatRemaining(0),
+    bdatInFlight(0),
+    committing(false),
+    replyLatency(-1),
+    bodyStreamer(0)
 {
+    writer = new SmtpWriter(this);
+    connect(writer, SIGNAL(error(QString)),
+            this, SLOT(writerError(QString)));
+    // Queued, the writer may drain while a chunk is still being composed
+    connect(writer, SIGNAL(drained()), this, SLOT(sendBdatChunks()), Qt::QueuedConnection);
+
+    // Asynchronous operations complete on the same signals the wait methods use
+    operationTimer = new QTimer(this);
+    operationTimer->setSingleShot(true);
+    connect(operationTimer, SIGNAL(timeout()), this, SLOT(operationTimeout()));
+
+    paceTimer = new QTimer(this);
+    paceTimer->setSingleShot(true);
+    connect(paceTimer, SIGNAL(timeout()), this, SLOT(paceTimeout()));
+
+    // A step waiting for the rate limiter must not resume after a failure,
+    // the caller may already have retried the message elsewhere
+    connect(this, SIGNAL(error(SmtpClient::SmtpError,QString)), this, SLOT(cancelPace()));
+    connect(this, SIGNAL(error(SmtpClient::SmtpError,QString)), this, SLOT(transactionFailed()));
+
+    connect(this, SIGNAL(readyConnected()), this, SLOT(operationSucceeded()));
+    connect(this, SIGNAL(authenticated()), this, SLOT(operationSucceeded()));
+    connect(this, SIGNAL(mailSent()), this, SLOT(operationSucceeded()));
+    connect(this, SIGNAL(mailReset()), this, SLOT(operationSucceeded()));
+    connect(this, SIGNAL(error(SmtpClient::SmtpError,QString)),
+            this, SLOT(operationFailed(SmtpClient::SmtpError,QString)));
+
+    connector = new SmtpConnector(this);
+    connect(connector, SIGNAL(connected(QTcpSocket*)),
+            this, SLOT(hostConnected(QTcpSocket*)));
+    connect(connector, SIGNAL(failed(QString)),
+            this, SLOT(hostConnectFailed(QString)));
+
     setConnectionType(connectionType);
 
     this->host = host;
     this->port = port;
-
-    connect(socket, SIGNAL(stateChanged(QAbstractSocket::SocketState)),
-            this, SLOT(socketStateChanged(QAbstractSocket::SocketState)));
-    connect(socket, SIGNAL(error(QAbstractSocket::SocketError)),
-            this, SLOT(socketError(QAbstractSocket::SocketError)));
-    connect(socket, SIGNAL(readyRead()),
-            this, SLOT(socketReadyRead()));
 }
 
 SmtpClient::~SmtpClient() {
+    // Nobody may wait forever on an operation that never runs
+    while (!operations.isEmpty()) {
+        operationRunning = true;
+        finishOperation(false, SocketError, "Client deleted");
+    }
+
     if (socket)
         delete socket;
 }
@@ -85,13 +215,62 @@ void SmtpClient::setAuthMethod(AuthMethod method)
 }
 
 /**
- * @brief Sets if certificate verification is required.
+ * @brief Sets if certificate verification is required. Applied on the next
+ * connection.
  */
 void SmtpClient::setVerifyPeer(const bool verify)
 {
     this->verifyPeer = verify;
 }
 
+/**
+ * @brief Sets the TLS settings used for encrypted connections. The profile
+ * is not owned by the client, a null profile selects the default one.
+ */
+void SmtpClient::setTlsProfile(SmtpTlsProfile *profile)
+{
+    this->tlsProfile = profile ? profile : SmtpTlsProfile::defaultProfile();
+}
+
+/**
+ * @brief Sets the limiter pacing the connections and messages of the
+ * client. The limiter is not owned by the client, null disables pacing.
+ */
+void SmtpClient::setRateLimiter(SmtpRateLimiter *limiter)
+{
+    this->rateLimiter = limiter;
+}
+
+/**
+ * @brief Sets the size of the BDAT chunks used when the server supports
+ * CHUNKING (RFC 3030).
+ */
+void SmtpClient::setChunkSize(int size)
+{
+    this->chunkSize = size > 0 ? size : 1024 * 1024;
+}
+
+/**
+ * @brief Sets how many recipients are sent in one transaction, larger
+ * envelopes are split into several transactions with the same body. A
+ * lower RCPTMAX announced by the server (LIMITS, RFC 9422) takes precedence.
+ * Zero sends all recipients in one transaction.
+ */
+void SmtpClient::setMaxRecipients(int count)
+{
+    this->maxRecipients = qMax(0, count);
+}
+
+/**
+ * @brief Sets if file parts may be sent unencoded (BINARYMIME, RFC 3030).
+ * This is only done on TcpConnection when the server supports both
+ * BINARYMIME and CHUNKING; the files are then sent with zero-copy.
+ */
+void SmtpClient::setBinaryMimeEnabled(bool enabled)
+{
+    this->binaryMimeEnabled = enabled;
+}
+
 /**
  * @brief Sets the host of connection.
  * @deprecated Use the constructor.
@@ -151,6 +330,49 @@ bool SmtpClient::getVerifyPeer() const
     return this->verifyPeer;
 }
 
+SmtpTlsProfile *SmtpClient::getTlsProfile() const
+{
+    return this->tlsProfile;
+}
+
+/**
+ * @brief Returns the connector that opens the connections of the client,
+ * e.g. to set its resolver or attempt delay.
+ */
+SmtpConnector *SmtpClient::getConnector() const
+{
+    return this->connector;
+}
+
+SmtpRateLimiter *SmtpClient::getRateLimiter() const
+{
+    return this->rateLimiter;
+}
+
+/**
+ * @brief Returns the size of the BDAT chunks.
+ */
+int SmtpClient::getChunkSize() const
+{
+    return this->chunkSize;
+}
+
+/**
+ * @brief Returns the maximum number of recipients of one transaction.
+ */
+int SmtpClient::getMaxRecipients() const
+{
+    return this->maxRecipients;
+}
+
+/**
+ * @brief Returns true if binary transfer of file parts is allowed.
+ */
+bool SmtpClient::isBinaryMimeEnabled() const
+{
+    return binaryMimeEnabled;
+}
+
 /**
  * @brief Return the port.
  */
@@ -188,7 +410,7 @@ void SmtpClient::setName(const QString &name)
  */
 QString SmtpClient::getResponseText() const
 {
-    return responseText;
+    return reply.getText();
 }
 
 /**
@@ -199,6 +421,43 @@ int SmtpClient::getResponseCode() const
     return responseCode;
 }
 
+/**
+ * @brief Returns the enhanced status code (RFC 3463) of the last response,
+ * e.g. "5.1.1", or an empty string if it had none.
+ */
+QString SmtpClient::getEnhancedStatusCode() const
+{
+    return reply.getEnhancedCode();
+}
+
+/**
+ * @brief Returns the last response of the server.
+ */
+SmtpReply SmtpClient::getLastReply() const
+{
+    return reply;
+}
+
+/**
+ * @brief Returns how long (in milliseconds) the server took to answer the
+ * final dot of DATA (or BDAT LAST) of the last message, counted from the
+ * last byte written, or -1 if it did not answer.
+ */
+qint64 SmtpClient::getReplyLatency() const
+{
+    return replyLatency;
+}
+
+/**
+ * @brief Returns the status of every recipient of the last message. The
+ * message is sent if at least one of them was accepted. If a send fails,
+ * recipients accepted in the transaction that did not commit are Pending.
+ */
+const QList<SmtpRecipientStatus> &SmtpClient::getRecipientStatuses() const
+{
+    return recipientStatuses;
+}
+
 /**
  * @brief Return the socket used by the client. The type of the of the
  * connection is QTcpConnection in case of TcpConnection, and QSslSocket
@@ -208,6 +467,33 @@ QTcpSocket* SmtpClient::getSocket() {
     return socket;
 }
 
+/**
+ * @brief Returns the current state of the client.
+ */
+SmtpClient::ClientState SmtpClient::getState() const
+{
+    return state;
+}
+
+/**
+ * @brief Returns the extensions announced by the server in its last EHLO
+ * reply. The result is invalid until the client is connected.
+ */
+SmtpCapabilities SmtpClient::getCapabilities() const
+{
+    return capabilities;
+}
+
+/**
+ * @brief Returns the capabilities recorded for this host and port by an
+ * earlier session (see SmtpCapabilityCache). They are available before the
+ * handshake finishes, but the server may have changed since then.
+ */
+SmtpCapabilities SmtpClient::getCachedCapabilities() const
+{
+    return SmtpCapabilityCache::lookup(host, port);
+}
+
 /* [2] --- */
 
 
@@ -250,15 +536,67 @@ bool SmtpClient::isLogged()
     return isAuthenticated;
 }
 
+/**
+ * @brief Returns true while the rate limiter holds back the next step. No
+ * message can be sent until it went out.
+ */
+bool SmtpClient::isPaced() const
+{
+    return paceTimer->isActive();
+}
+
 bool SmtpClient::sendMail(MimeMessage& email)
 {
-    if (!isReadyConnected)
+    return sendMail(email, SmtpEnvelope::fromMessage(email));
+}
+
+/**
+ * @brief Sends the message to the recipients of the envelope instead of the
+ * ones in its header, e.g. to retry only some of them. Returns false
+ * without touching the recipient statuses while isPaced().
+ */
+bool SmtpClient::sendMail(MimeMessage& email, const SmtpEnvelope &envelope)
+{
+    if (!isReadyConnected || paceTimer->isActive())
         return false;
 
     isMailSent = false;
 
     this->email = &email;
-    this->rcptType = 0;
+    this->envelope = envelope;
+    this->rawData.clear();
+
+    if (!prepareMail())
+        return false;
+
+    // The statuses of the previous message stay until this one is accepted
+    recipientStatuses.clear();
+    changeState(MailSendingState);
+
+    return true;
+}
+
+/**
+ * @brief Sends an already serialized message (headers and body, with CRLF
+ * line endings and no dot-stuffing) to the recipients of the envelope.
+ * The data is sent as it is, no encoding is applied.
+ */
+bool SmtpClient::sendMail(const SmtpEnvelope &envelope, const QByteArray &data)
+{
+    if (!isReadyConnected || paceTimer->isActive())
+        return false;
+
+    isMailSent = false;
+
+    this->email = 0;
+    this->envelope = envelope;
+    this->rawData = data;
+
+    if (!prepareMail())
+        return false;
+
+    // The statuses of the previous message stay until this one is accepted
+    recipientStatuses.clear();
     changeState(MailSendingState);
 
     return true;
@@ -281,6 +619,20 @@ bool SmtpClient::reset()
     return true;
 }
 
+/**
+ * @brief Sends a NOOP to keep an idle connection open. The client is back
+ * in ReadyState once the server replied.
+ */
+bool SmtpClient::noop()
+{
+    if (!isReadyConnected || state != ReadyState)
+        return false;
+
+    changeState(_NOOP_State);
+
+    return true;
+}
+
 bool SmtpClient::waitForReadyConnected(int msec) {
     if (state == UnconnectedState)
         return false;
@@ -312,6 +664,10 @@ bool SmtpClient::waitForMailSent(int msec) {
     if (isMailSent)
         return true;
 
+    // Nothing in progress, e.g. the message was rejected for its size
+    if (state == ReadyState)
+        return false;
+
     waitForEvent(msec, SIGNAL(mailSent()), SLOT(mailSendTimeout()));
 
     return isMailSent;
@@ -330,6 +686,76 @@ bool SmtpClient::waitForReset(int msec)
     return isReset;
 }
 
+/**
+ * @brief Connects to the server without blocking. The returned future
+ * finishes once the client is ready (or failed), after the operations
+ * queued before it.
+ */
+QFuture<SmtpResult> SmtpClient::connectToHostAsync(int msec)
+{
+    AsyncOperation op;
+    op.type = _CONNECT_OP;
+    op.timeout = msec;
+    return queueOperation(op);
+}
+
+QFuture<SmtpResult> SmtpClient::loginAsync(int msec)
+{
+    AsyncOperation op;
+    op.type = _LOGIN_OP;
+    op.timeout = msec;
+    op.setCredentials = false;
+    return queueOperation(op);
+}
+
+QFuture<SmtpResult> SmtpClient::loginAsync(const QString &user, const QString &password,
+                                           AuthMethod method, int msec)
+{
+    AsyncOperation op;
+    op.type = _LOGIN_OP;
+    op.timeout = msec;
+    op.setCredentials = true;
+    op.user = user;
+    op.password = password;
+    op.method = method;
+    return queueOperation(op);
+}
+
+/**
+ * @brief Sends the mail without blocking. The message must stay alive
+ * until the returned future has finished.
+ */
+QFuture<SmtpResult> SmtpClient::sendMailAsync(MimeMessage& email, int msec)
+{
+    AsyncOperation op;
+    op.type = _SEND_OP;
+    op.timeout = msec;
+    op.email = &email;
+    return queueOperation(op);
+}
+
+/**
+ * @brief Sends an already serialized message without blocking. The data is
+ * shared with the operation, not copied.
+ */
+QFuture<SmtpResult> SmtpClient::sendMailAsync(const SmtpEnvelope &envelope, const QByteArray &data, int msec)
+{
+    AsyncOperation op;
+    op.type = _SEND_OP;
+    op.timeout = msec;
+    op.envelope = envelope;
+    op.data = data;
+    return queueOperation(op);
+}
+
+QFuture<SmtpResult> SmtpClient::resetAsync(int msec)
+{
+    AsyncOperation op;
+    op.type = _RESET_OP;
+    op.timeout = msec;
+    return queueOperation(op);
+}
+
 /* [3] --- */
 
 
@@ -339,22 +765,52 @@ void SmtpClient::setConnectionType(ConnectionType ct)
 {
     this->connectionType = ct;
 
-    if (socket)
-        delete socket;
-
     switch (connectionType)
     {
     case TcpConnection:
-        socket = new QTcpSocket(this);
+        setSocket(new QTcpSocket(this));
         break;
     case SslConnection:
     case TlsConnection:
-        socket = new QSslSocket(this);
-        ((QSslSocket*)socket)->setPeerVerifyMode(verifyPeer ? QSslSocket::QueryPeer : QSslSocket::VerifyPeer);
+        setSocket(new QSslSocket(this));
+        break;
+    }
+}
+
+/**
+ * Replaces the socket of the client, e.g. with the one SmtpConnector
+ * connected.
+ */
+void SmtpClient::setSocket(QTcpSocket *socket)
+{
+    if (this->socket) {
+        this->socket->disconnect(this);
+        this->socket->deleteLater();
+    }
+
+    this->socket = socket;
+    socket->setParent(this);
+
+    connect(socket, SIGNAL(stateChanged(QAbstractSocket::SocketState)),
+            this, SLOT(socketStateChanged(QAbstractSocket::SocketState)));
+    connect(socket, SIGNAL(error(QAbstractSocket::SocketError)),
+            this, SLOT(socketError(QAbstractSocket::SocketError)));
+    connect(socket, SIGNAL(readyRead()),
+            this, SLOT(socketReadyRead()));
+    connect(socket, SIGNAL(bytesWritten(qint64)),
+            this, SLOT(socketBytesWritten()));
+
+    if (qobject_cast<QSslSocket*>(socket)) {
         connect(socket, SIGNAL(encrypted()),
                 this, SLOT(socketEncrypted()));
-        break;
+#if QT_VERSION >= QT_VERSION_CHECK(5, 15, 0)
+        // TLS 1.3 tickets arrive after the handshake
+        connect(socket, SIGNAL(newSessionTicketReceived()),
+                this, SLOT(sessionTicketReceived()));
+#endif
     }
+
+    writer->setSocket(socket);
 }
 
 void SmtpClient::changeState(SmtpClient::ClientState state) {
@@ -373,17 +829,29 @@ void SmtpClient::changeState(SmtpClient::ClientState state) {
 
     switch (state)
     {
+    case UnconnectedState:
+        // Nothing of the message is sent after the connection is gone, its
+        // data may belong to the caller (e.g. a mapped spool segment)
+        writer->clear();
+        if (bodyStreamer) {
+            bodyStreamer->stop();
+            bodyStreamer->deleteLater();
+            bodyStreamer = 0;
+        }
+        bodySegments.clear();
+        rawData.clear();
+        break;
+
     case ConnectingState:
-        switch (connectionType)
-        {
-        case TlsConnection:
-        case TcpConnection:
-            socket->connectToHost(host, port);
-            break;
-        case SslConnection:
-            ((QSslSocket*) socket)->connectToHostEncrypted(host, port);
+        if (delayForRate(ConnectingState))
             break;
-        }
+
+        capabilities = SmtpCapabilities();
+        replyParser.clear();
+
+        // The addresses of the host are raced, see hostConnected()
+        connector->setSslEnabled(connectionType != TcpConnection);
+        connector->connectToHost(host, port);
         break;
 
     case AuthenticatingState:
@@ -392,25 +860,49 @@ void SmtpClient::changeState(SmtpClient::ClientState state) {
         break;
 
     case MailSendingState:
+    {
+        if (delayForRate(MailSendingState))
+            break;
+
         isMailSent = false;
+        pendingReplies.clear();
+        committing = false;
+        replyLatency = -1;
+
+        recipientStatuses.clear();
+        rcptError = SmtpReply();
+        bodySegments.clear();
+        for (int i = 0; i < envelope.getRecipientCount(); ++i)
+            recipientStatuses << SmtpRecipientStatus(envelope.getRecipients().at(i), envelope.getRecipientType(i));
+
+        startBatch();
         changeState(_MAIL_0_FROM);
         break;
+    }
 
     case DisconnectingState:
+        cancelPace();
+        connector->abort();
         sendMessage("QUIT");
         socket->disconnectFromHost();
         break;
 
     case ResetState:
+        cancelPace();
         sendMessage("RSET");
         break;
 
+    case _NOOP_State:
+        sendMessage("NOOP");
+        break;
+
     case _EHLO_State:
         // Service ready. Send EHLO message and change the state
         sendMessage("EHLO " + name);
         break;
 
     case _READY_Connected:
+        SmtpCapabilityCache::insert(host, port, capabilities);
         isReadyConnected = true;
         changeState(ReadyState);
         emit readyConnected();
@@ -427,6 +919,7 @@ void SmtpClient::changeState(SmtpClient::ClientState state) {
         break;
 
     case _TLS_1_ENCRYPT:
+        prepareEncryption();
         ((QSslSocket*) socket)->startClientEncryption();
         break;
 
@@ -462,6 +955,7 @@ void SmtpClient::changeState(SmtpClient::ClientState state) {
 
     case _READY_Authenticated:
         isAuthenticated = true;
+        loggedUser = user;
         if (clearUserDataAfterLogin) {
             password = ""; user = "";
             clearUserDataAfterLogin = false;
@@ -472,37 +966,33 @@ void SmtpClient::changeState(SmtpClient::ClientState state) {
 
     /* --- MAIL --- */
     case _MAIL_0_FROM:
-        sendMessage("MAIL FROM: <" + email->getSender().getAddress() + ">");
+        // With PIPELINING the whole envelope goes out in one batch
+        if (capabilities.hasPipelining()) {
+            sendEnvelopePipelined();
+            break;
+        }
+        appendMailFrom();
+        writer->flush();
         break;
 
     case _MAIL_1_RCPT_INIT:
-        rcptType++;
-        switch (rcptType)
-        {
-        case _TO:
-            addressList = email->getRecipients(MimeMessage::To);
-            break;
-        case _CC:
-            addressList = email->getRecipients(MimeMessage::Cc);
-            break;
-        case _BCC:
-            addressList = email->getRecipients(MimeMessage::Bcc);
-            break;
-        default:
-            changeState(_MAIL_3_DATA);
-            return;
-        }
-        addressIt = addressList.constBegin();
+        rcptSent = 0;
         changeState(_MAIL_2_RCPT);
         break;
 
     case _MAIL_2_RCPT:
-        if (addressIt != addressList.constEnd()) {
-            sendMessage("RCPT TO: <" + (*addressIt).getAddress() + ">");
-            addressIt++;
-        } else {
-            changeState(_MAIL_1_RCPT_INIT);
+        if (rcptSent < batch.size() && !batchFull) {
+            appendRcptTo(recipientStatuses.at(batch.at(rcptSent)).getAddress());
+            writer->flush();
+            rcptSent++;
+            break;
+        }
+        // Rejected recipients do not stop the others
+        if (!hasAcceptedRecipient(true)) {
+            skipBatch();
+            return;
         }
+        changeState(capabilities.hasChunking() ? _MAIL_5_BDAT : _MAIL_3_DATA);
         break;
 
     case _MAIL_3_DATA:
@@ -510,27 +1000,124 @@ void SmtpClient::changeState(SmtpClient::ClientState state) {
         break;
 
     case _MAIL_4_SEND_DATA:
-        email->writeToDevice(*socket);
+    {
+        // Only the structure is serialized here, files are read and encoded
+        // as the socket drains
+        prepareBody();
 
 #ifdef QT_DEBUG
-        qDebug() << "[Socket] OUT:";
-        qDebug() << email->toString();
+        qDebug() << "[Socket] OUT: DATA" << bodySize << "bytes";
 #endif
-        sendMessage("\r\n.");
-        break;
 
-    case _READY_MailSent:
-        isMailSent = true;
-        changeState(ReadyState);
-        emit mailSent();
+        delete bodyStreamer;
+        bodyStreamer = new SmtpBodyStreamer(socket, bodySegments, this);
+        connect(bodyStreamer, SIGNAL(finished()), this, SLOT(bodyStreamed()));
+        connect(bodyStreamer, SIGNAL(error(QString)), this, SLOT(writerError(QString)));
+        bodyStreamer->start();
         break;
-
-    default:
-        ;
     }
-}
 
-void SmtpClient::processResponse() {
+    case _MAIL_5_BDAT:
+    {
+        // The message goes out in sized chunks, no dot-terminated DATA.
+        // Files are read and encoded by the writer as the chunks leave.
+        prepareBody();
+
+        bodySegment = 0;
+        bodySegmentOffset = 0;
+        bdatRemaining = bodySize;
+        bdatInFlight = 0;
+        pipelineError = SmtpReply();
+
+#ifdef QT_DEBUG
+        qDebug() << "[Socket] OUT: BDAT" << bdatRemaining << "bytes";
+#endif
+
+        sendBdatChunks();
+        break;
+    }
+
+    case _MAIL_6_NEXT:
+        // Recipients beyond the limit of the transaction get the same body
+        // in another one
+        batchOpen = false;
+        if (startBatch()) {
+            changeState(_MAIL_0_FROM);
+            break;
+        }
+        if (!hasAcceptedRecipient()) {
+            emitReplyError(rcptError);
+            return;
+        }
+        changeState(_READY_MailSent);
+        break;
+
+    case _MAIL_7_RSET:
+        sendMessage("RSET");
+        break;
+
+    case _MAIL_8_END_DATA:
+        // An empty message ends the data mode the server entered anyway
+        sendMessage(".");
+        break;
+
+    case _READY_MailSent:
+        batchOpen = false;
+        bodySegments.clear();
+        rawData.clear();
+        if (bodyStreamer) {
+            bodyStreamer->deleteLater();
+            bodyStreamer = 0;
+        }
+        isMailSent = true;
+        changeState(ReadyState);
+        emit mailSent();
+        break;
+
+    default:
+        ;
+    }
+}
+
+/**
+ * Takes the tokens of the step from the rate limiter. If they are not
+ * available yet the state is entered again when they are, and true is
+ * returned.
+ */
+bool SmtpClient::delayForRate(ClientState next)
+{
+    if (!rateLimiter || paced) {
+        paced = false;
+        return false;
+    }
+
+    QString key = SmtpRateLimiter::makeKey(host, isAuthenticated ? loggedUser : user);
+    int wait;
+    if (next == ConnectingState)
+        wait = rateLimiter->reserve(key, SmtpRateLimiter::Connections);
+    else
+        wait = qMax(rateLimiter->reserve(key, SmtpRateLimiter::Messages),
+                    rateLimiter->reserve(key, SmtpRateLimiter::Recipients, envelope.getRecipientCount()));
+
+    if (wait <= 0)
+        return false;
+
+#ifdef QT_DEBUG
+    qDebug() << "[SmtpClient] Paced for" << wait << "ms";
+#endif
+
+    pacedState = next;
+    paceTimer->start(wait);
+    return true;
+}
+
+void SmtpClient::processResponse() {
+
+    // Replies to a pipelined envelope are matched to the queued commands in order
+    if (!pendingReplies.isEmpty()) {
+        processPipelinedResponse();
+        return;
+    }
 
     switch (state)
     {
@@ -548,10 +1135,19 @@ void SmtpClient::processResponse() {
             emitError(ServerError);
             return;
         }
+        isReset = true;
         emit mailReset();
         changeState(ReadyState);
         break;
 
+    case _NOOP_State:
+        if (responseCode != 250) {
+            emitError(ServerError);
+            return;
+        }
+        changeState(ReadyState);
+        break;
+
     case _EHLO_State:
         // The response code needs to be 250.
         if (responseCode != 250) {
@@ -559,6 +1155,7 @@ void SmtpClient::processResponse() {
             return;
         }
 
+        capabilities = SmtpCapabilities::fromEhloResponse(reply.getText());
         changeState((connectionType != TlsConnection) ? _READY_Connected : _TLS_State);
         break;
 
@@ -578,6 +1175,7 @@ void SmtpClient::processResponse() {
             emitError(ServerError);
             return;
         }
+        capabilities = SmtpCapabilities::fromEhloResponse(reply.getText());
         changeState(_READY_Encrypted);
         break;
 
@@ -625,10 +1223,7 @@ void SmtpClient::processResponse() {
         break;
 
     case _MAIL_2_RCPT:
-        if (responseCode != 250) {
-            emitError(MailSendingError);
-            return;
-        }
+        recordRecipientReply();
         changeState(_MAIL_2_RCPT);
         break;
 
@@ -641,11 +1236,45 @@ void SmtpClient::processResponse() {
         break;
 
     case _MAIL_4_SEND_DATA:
+        commitAnswered();
         if (responseCode != 250) {
             emitError(MailSendingError);
             return;
         }
-        changeState(_READY_MailSent);
+        changeState(_MAIL_6_NEXT);
+        break;
+
+    case _MAIL_5_BDAT:
+        if (responseCode != 250) {
+            emitError(MailSendingError);
+            return;
+        }
+        // The reply to BDAT LAST commits the message
+        bdatInFlight--;
+        if (bdatRemaining > 0) {
+            sendBdatChunks();
+        } else {
+            commitAnswered();
+            changeState(_MAIL_6_NEXT);
+        }
+        break;
+
+    case _MAIL_7_RSET:
+        if (responseCode != 250) {
+            emitError(MailSendingError);
+            return;
+        }
+        changeState(_MAIL_6_NEXT);
+        break;
+
+    case _MAIL_8_END_DATA:
+        // The transaction is over whatever the reply, without a recipient
+        // nothing was delivered
+        if (pipelineError.isValid()) {
+            emitReplyError(pipelineError);
+            return;
+        }
+        skipBatch();
         break;
 
     default:
@@ -653,6 +1282,469 @@ void SmtpClient::processResponse() {
     }
 }
 
+void SmtpClient::processPipelinedResponse()
+{
+    ClientState command = pendingReplies.takeFirst();
+
+    switch (command)
+    {
+    case _MAIL_2_RCPT:
+        recordRecipientReply();
+        break;
+    case _MAIL_3_DATA:
+        // Checked below, once it is known if any recipient was accepted
+        break;
+    case _MAIL_5_BDAT:
+        bdatInFlight--;
+        if (bdatRemaining == 0 && bdatInFlight == 0)
+            commitAnswered();
+        if (responseCode != 250 && !pipelineError.isValid())
+            pipelineError = reply;
+        break;
+    default:
+        // Keep only the first failure, the rest of the replies just have to be drained
+        if (responseCode != 250 && !pipelineError.isValid())
+            pipelineError = reply;
+    }
+
+#ifdef QT_DEBUG
+    qDebug() << "[SmtpClient] Pipelined reply:" << staticMetaObject.enumerator(staticMetaObject.indexOfEnumerator("ClientState")).valueToKey(command) << responseCode;
+#endif
+
+    // Every chunk reply makes room for the next one
+    if (command == _MAIL_5_BDAT && bdatRemaining > 0)
+        sendBdatChunks();
+
+    if (!pendingReplies.isEmpty())
+        return;
+
+    // Some servers answer the pipelined DATA with 354 even if the envelope
+    // failed. RSET or QUIT would then be taken as the message content.
+    if (command == _MAIL_3_DATA && responseCode == 354
+            && (pipelineError.isValid() || !hasAcceptedRecipient(true))) {
+        changeState(_MAIL_8_END_DATA);
+        return;
+    }
+
+    if (pipelineError.isValid()) {
+        emitReplyError(pipelineError);
+        return;
+    }
+
+    if (command == _MAIL_5_BDAT) {
+        changeState(_MAIL_6_NEXT);
+        return;
+    }
+
+    if (!hasAcceptedRecipient(true)) {
+        skipBatch();
+        return;
+    }
+
+    // DATA was sent with the envelope when CHUNKING is not used
+    if (command == _MAIL_3_DATA) {
+        if (responseCode != 354) {
+            emitReplyError(reply);
+            return;
+        }
+        changeState(_MAIL_4_SEND_DATA);
+        return;
+    }
+
+    changeState(_MAIL_5_BDAT);
+}
+
+void SmtpClient::recordRecipientReply()
+{
+    if (rcptReplies >= batch.size())
+        return;
+    int index = batch.at(rcptReplies++);
+
+    // The server takes no more recipients in this transaction (RFC 5321,
+    // 4.5.3.1.10): the rest stays Pending for the next one. Without an
+    // accepted recipient the limit is not the problem and the reply counts.
+    if (isTooManyRecipients(reply) && hasAcceptedRecipient(true)) {
+        batchFull = true;
+        return;
+    }
+
+    recipientStatuses[index].setReply(reply);
+
+    if (responseCode / 100 != 2 && !rcptError.isValid())
+        rcptError = reply;
+}
+
+/**
+ * Picks the recipients of the next transaction: the ones not answered yet,
+ * up to the limit of the client and of the server. Returns false if none
+ * are left.
+ */
+bool SmtpClient::startBatch()
+{
+    int limit = maxRecipients;
+    if (capabilities.getRecipientLimit() > 0 && (limit == 0 || capabilities.getRecipientLimit() < limit))
+        limit = capabilities.getRecipientLimit();
+
+    batch.clear();
+    batchFull = false;
+    rcptReplies = 0;
+
+    for (int i = 0; i < recipientStatuses.size() && (limit == 0 || batch.size() < limit); ++i) {
+        if (recipientStatuses.at(i).getStatus() == SmtpRecipientStatus::Pending)
+            batch << i;
+    }
+
+    batchOpen = !batch.isEmpty();
+    return batchOpen;
+}
+
+/**
+ * Ends a transaction in which no recipient was accepted. The send only
+ * fails if no other transaction delivered or is left to try.
+ */
+void SmtpClient::skipBatch()
+{
+    if (!hasAcceptedRecipient() && !hasPendingRecipient()) {
+        emitReplyError(rcptError);
+        return;
+    }
+    changeState(_MAIL_7_RSET);
+}
+
+bool SmtpClient::hasAcceptedRecipient(bool inBatch) const
+{
+    if (inBatch) {
+        foreach (int index, batch) {
+            if (recipientStatuses.at(index).isAccepted())
+                return true;
+        }
+        return false;
+    }
+
+    foreach (const SmtpRecipientStatus &recipient, recipientStatuses) {
+        if (recipient.isAccepted())
+            return true;
+    }
+    return false;
+}
+
+bool SmtpClient::hasPendingRecipient() const
+{
+    foreach (const SmtpRecipientStatus &recipient, recipientStatuses) {
+        if (recipient.getStatus() == SmtpRecipientStatus::Pending)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Returns true for the replies of a server that reached its recipient
+ * limit: 452, or the enhanced code x.5.3 (RFC 3463) some servers send with
+ * 552 instead.
+ */
+bool SmtpClient::isTooManyRecipients(const SmtpReply &reply)
+{
+    if (reply.hasEnhancedCode())
+        return reply.getEnhancedSubject() == 5 && reply.getEnhancedDetail() == 3;
+    return reply.getCode() == 452;
+}
+
+/**
+ * Reports the failed reply as the last server response, as a server or
+ * client error depending on its class.
+ */
+void SmtpClient::emitReplyError(const SmtpReply &failed)
+{
+    reply = failed;
+    responseCode = reply.getCode();
+
+    switch (responseCode / 100)
+    {
+    case 4:
+        emitError(ServerError);
+        break;
+    case 5:
+        emitError(ClientError);
+        break;
+    default:
+        emitError(MailSendingError);
+    }
+}
+
+void SmtpClient::sendEnvelopePipelined()
+{
+    pendingReplies.clear();
+    pipelineError = SmtpReply();
+
+    appendMailFrom();
+    pendingReplies << _MAIL_0_FROM;
+
+    foreach (int index, batch) {
+        appendRcptTo(recipientStatuses.at(index).getAddress());
+        pendingReplies << _MAIL_2_RCPT;
+    }
+
+    // DATA may follow the recipients in the same batch (RFC 2920). BDAT
+    // waits for the replies since it carries the message itself.
+    if (!capabilities.hasChunking()) {
+        writer->appendCommand("DATA");
+        pendingReplies << _MAIL_3_DATA;
+    }
+
+    // The whole envelope leaves in a single write
+    writer->flush();
+}
+
+void SmtpClient::sendBdatChunk()
+{
+    qint64 length = qMin<qint64>(chunkSize, bdatRemaining);
+    bool last = (length == bdatRemaining);
+
+    if (last)
+        startCommit();
+
+    writer->append("BDAT ");
+    writer->append(QByteArray::number(length));
+    writer->appendCommand(last ? " LAST" : "");
+
+    // File segments are read (or sent with zero-copy) by the writer, small
+    // pieces of data join the BDAT command in the batch
+    while (length > 0) {
+        const MimeSegmentBuffer::Segment &segment = bodySegments.at(bodySegment);
+        qint64 n = qMin(length, segment.size - bodySegmentOffset);
+
+        if (segment.file && segment.encoding == MimeSegmentBuffer::Base64Segment)
+            writer->writeBase64File(segment.file, segment.fileSize, bodySegmentOffset, n);
+        else if (segment.file)
+            writer->writeFile(segment.file, bodySegmentOffset, n);
+        else if (n < 4096)
+            writer->append(segment.data.mid(bodySegmentOffset, n));
+        else if (n == segment.size)
+            writer->write(segment.data);
+        else
+            writer->write(segment.data.mid(bodySegmentOffset, n));
+
+        bodySegmentOffset += n;
+        bdatRemaining -= n;
+        length -= n;
+
+        if (bodySegmentOffset == segment.size) {
+            bodySegment++;
+            bodySegmentOffset = 0;
+        }
+    }
+}
+
+/**
+ * The message is about to be committed. The reply latency is counted from
+ * the last write of the socket, the upload is not the server's time.
+ */
+void SmtpClient::startCommit()
+{
+    committing = true;
+    commitTimer.start();
+    emit mailCommitting();
+}
+
+void SmtpClient::commitAnswered()
+{
+    if (!committing)
+        return;
+    committing = false;
+    replyLatency = commitTimer.elapsed();
+}
+
+/**
+ * Keeps up to BDAT_WINDOW chunks waiting for their reply, one without
+ * PIPELINING. The next chunk is composed only once the writer handed the
+ * previous ones to the socket, so the files are read as the data leaves.
+ */
+void SmtpClient::sendBdatChunks()
+{
+    if (state != _MAIL_5_BDAT || pipelineError.isValid())
+        return;
+
+    int window = capabilities.hasPipelining() ? BDAT_WINDOW : 1;
+    while (bdatRemaining > 0 && bdatInFlight < window && (bdatInFlight == 0 || writer->isEmpty())) {
+        sendBdatChunk();
+        writer->flush();
+        bdatInFlight++;
+        if (capabilities.hasPipelining())
+            pendingReplies << _MAIL_5_BDAT;
+    }
+}
+
+/**
+ * Applies the TLS profile and peer verification to the socket and offers a
+ * stored session, right before the handshake.
+ */
+void SmtpClient::prepareEncryption()
+{
+    QSslSocket *sslSocket = (QSslSocket*) socket;
+    sslSocket->setSslConfiguration(tlsProfile->getConfiguration());
+    sslSocket->setPeerVerifyMode(verifyPeer ? QSslSocket::VerifyPeer : QSslSocket::QueryPeer);
+    sslSocket->setPeerVerifyName(host);
+    SmtpTlsSessionCache::prepare(sslSocket, host, port);
+}
+
+/**
+ * Chooses the extensions used for the current message and checks its size
+ * against the limit announced by the server, before anything is sent.
+ */
+bool SmtpClient::prepareMail()
+{
+    if (!email) {
+        // Serialized messages go out as they are
+        useBinaryMime = false;
+        use8BitMime = capabilities.has8BitMime() && hasHighBytes(rawData);
+        useSmtpUtf8 = capabilities.hasSmtpUtf8() && !hasAsciiAddresses(envelope);
+        messageSize = rawData.size();
+        return checkMessageSize();
+    }
+
+    QList<MimePart*> parts;
+    findParts(&email->getContent(), parts);
+
+    bool hasFiles = false, has8Bit = false;
+    foreach (MimePart *part, parts) {
+        hasFiles |= (dynamic_cast<MimeFile*>(part) != 0);
+        has8Bit |= (part->getEncoding() == MimePart::_8Bit);
+    }
+
+    // File parts go out unencoded if the server can take binary chunks
+    useBinaryMime = binaryMimeEnabled && hasFiles
+            && connectionType == TcpConnection
+            && capabilities.hasBinaryMime() && capabilities.hasChunking();
+
+    // 8-bit parts and UTF-8 headers are only encoded when the server
+    // cannot take them as they are
+    use8BitMime = !useBinaryMime && has8Bit && capabilities.has8BitMime();
+    useSmtpUtf8 = capabilities.hasSmtpUtf8()
+            && (!hasAsciiAddresses(envelope)
+                || (email->getHeaderEncoding() == MimePart::_8Bit && !hasAsciiHeaders(*email)));
+
+    // Exact size of the message as it will be encoded, without encoding it
+    applyEncodings();
+    messageSize = email->getSize();
+    restoreEncodings();
+
+    return checkMessageSize();
+}
+
+bool SmtpClient::checkMessageSize()
+{
+    qint64 limit = capabilities.getSizeLimit();
+    if (limit > 0 && messageSize > limit) {
+        emit error(MailSendingError, QString("Message size %1 exceeds the server limit of %2 bytes")
+                   .arg(messageSize).arg(limit));
+        return false;
+    }
+
+    return true;
+}
+
+void SmtpClient::appendMailFrom()
+{
+#ifdef QT_DEBUG
+    qDebug() << "[Socket] OUT: MAIL FROM:" << envelope.getSender().getAddress();
+#endif
+
+    QByteArray parameters(">");
+    if (useBinaryMime)
+        parameters.append(" BODY=BINARYMIME");
+    else if (use8BitMime)
+        parameters.append(" BODY=8BITMIME");
+    if (useSmtpUtf8)
+        parameters.append(" SMTPUTF8");
+    if (messageSize >= 0 && capabilities.hasExtension("SIZE"))
+        parameters.append(" SIZE=").append(QByteArray::number(messageSize));
+
+    writer->appendCommand("MAIL FROM: <", envelope.getSender().getAddress(), parameters);
+}
+
+/**
+ * Serializes the body for the first transaction of the message; the others
+ * send the same segments again.
+ */
+void SmtpClient::prepareBody()
+{
+    if (!bodySegments.isEmpty())
+        return;
+
+    // DATA and BDAT both encode base64 files while they are sent
+    MimeSegmentBuffer body;
+    body.setDeferredEncodingEnabled(true);
+    serializeBody(body);
+
+    bodySegments = body.getSegments();
+    bodySize = body.getTotalSize();
+}
+
+void SmtpClient::serializeBody(MimeSegmentBuffer &body)
+{
+    if (!email) {
+        body.appendData(rawData);
+        return;
+    }
+
+    applyEncodings();
+    email->writeToDevice(body);
+    restoreEncodings();
+}
+
+/**
+ * Switches the parts to the encodings negotiated for this transaction:
+ * files to binary with BINARYMIME, 8-bit parts to quoted-printable without
+ * 8BITMIME and UTF-8 headers to encoded words without SMTPUTF8. The original
+ * encodings are put back by restoreEncodings(). Parts keep the serialization
+ * of both encodings, switching does not drop their cache.
+ */
+void SmtpClient::applyEncodings()
+{
+    QList<MimePart*> parts;
+    findParts(&email->getContent(), parts);
+
+    foreach (MimePart *part, parts) {
+        MimePart::Encoding encoding = part->getEncoding();
+        MimePart::Encoding target = encoding;
+        bool isMultiPart = (dynamic_cast<MimeMultiPart*>(part) != 0);
+
+        if (useBinaryMime && dynamic_cast<MimeFile*>(part))
+            target = MimePart::Binary;
+        else if (encoding == MimePart::Binary && !useBinaryMime)
+            target = isMultiPart ? MimePart::_7Bit : MimePart::Base64;
+        else if (encoding == MimePart::_8Bit && !use8BitMime && !useBinaryMime)
+            target = isMultiPart ? MimePart::_7Bit : MimePart::QuotedPrintable;
+
+        if (target != encoding) {
+            savedEncodings << qMakePair(part, encoding);
+            part->setEncoding(target);
+        }
+    }
+
+    savedHeaderEncoding = email->getHeaderEncoding();
+    if (savedHeaderEncoding == MimePart::_8Bit && !useSmtpUtf8 && !hasAsciiHeaders(*email))
+        email->setHeaderEncoding(MimePart::Base64);
+}
+
+void SmtpClient::restoreEncodings()
+{
+    for (int i = 0; i < savedEncodings.size(); ++i)
+        savedEncodings.at(i).first->setEncoding(savedEncodings.at(i).second);
+    savedEncodings.clear();
+
+    email->setHeaderEncoding(savedHeaderEncoding);
+}
+
+void SmtpClient::appendRcptTo(const EmailAddress &rcpt)
+{
+#ifdef QT_DEBUG
+    qDebug() << "[Socket] OUT: RCPT TO:" << rcpt.getAddress();
+#endif
+
+    writer->appendCommand("RCPT TO: <", rcpt.getAddress(), ">");
+}
+
 void SmtpClient::sendMessage(const QString &text)
 {
 
@@ -660,13 +1752,13 @@ void SmtpClient::sendMessage(const QString &text)
     qDebug() << "[Socket] OUT:" << text;
 #endif
 
-    socket->flush();
-    socket->write(text.toUtf8() + "\r\n");
+    writer->appendCommand(text.toUtf8());
+    writer->flush();
 }
 
 void SmtpClient::emitError(SmtpClient::SmtpError e)
 {
-    emit error(e, QString("Last server response: %1").arg(responseText));
+    emit error(e, QString("Last server response: %1").arg(reply.getText()));
 }
 
 void SmtpClient::waitForEvent(int msec, const char *successSignal, const char *timeoutSlot)
@@ -687,6 +1779,44 @@ void SmtpClient::waitForEvent(int msec, const char *successSignal, const char *t
     loop.exec();
 }
 
+QFuture<SmtpResult> SmtpClient::queueOperation(AsyncOperation &op)
+{
+    op.queued.start();
+    op.result.reportStarted();
+    operations.append(op);
+
+    // Operations run one after the other, in the order they were requested
+    if (!operationRunning)
+        QMetaObject::invokeMethod(this, "startNextOperation", Qt::QueuedConnection);
+
+    return op.result.future();
+}
+
+void SmtpClient::finishOperation(bool success, int error, const QString &errorText)
+{
+    if (!operationRunning || operations.isEmpty())
+        return;
+
+    operationRunning = false;
+    operationTimer->stop();
+
+    AsyncOperation op = operations.takeFirst();
+
+    SmtpResult result(success, responseCode, reply.getText(), error, errorText);
+    qint64 elapsed = op.started.isValid() ? op.started.elapsed() : 0;
+    result.setWaitTime(op.queued.elapsed() - elapsed);
+    result.setElapsed(elapsed);
+
+    if (op.type == _SEND_OP)
+        result.setRecipients(recipientStatuses);
+
+    op.result.reportResult(result);
+    op.result.reportFinished();
+
+    if (!operations.isEmpty())
+        QMetaObject::invokeMethod(this, "startNextOperation", Qt::QueuedConnection);
+}
+
 /* [4] --- */
 
 
@@ -722,50 +1852,121 @@ void SmtpClient::socketError(QAbstractSocket::SocketError socketError) {
 
 void SmtpClient::socketReadyRead()
 {
-    QString responseLine;
+    replyParser.readFrom(socket);
 
-    while (socket->canReadLine()) {
-        // Save the server's response
-        responseLine = socket->readLine();
-        tempResponse += responseLine;
+    // A single read can carry several replies when commands are pipelined
+    while (replyParser.next(reply)) {
 
 #ifdef QT_DEBUG
-        qDebug() << "[Socket] IN: " << responseLine;
+        qDebug() << "[Socket] IN: " << reply.toByteArray();
 #endif
-    }
-
 
+        responseCode = reply.getCode();
+
+        // Pipelined replies are checked once every queued command got its
+        // reply, RCPT replies are recorded per recipient
+        if (pendingReplies.isEmpty() && state != _MAIL_2_RCPT) {
+            // Check for server error
+            if (responseCode / 100 == 4) {
+                emitError(ServerError);
+                continue;
+            }
+
+            // Check for client error
+            if (responseCode / 100 == 5) {
+                emitError(ClientError);
+                continue;
+            }
+        }
 
-    // Is this the last line of the response
-    if (responseLine[3] == ' ') {
-        responseText = tempResponse;
-        tempResponse = "";
+        processResponse();
+    }
+}
 
-        // Extract the respose code from the server's responce (first 3 digits)
-        responseCode = responseLine.left(3).toInt();
+void SmtpClient::hostConnected(QTcpSocket *socket)
+{
+    setSocket(socket);
 
-        // Check for server error
-        if (responseCode / 100 == 4) {
-            emitError(ServerError);
-            return;
-        }
+    if (connectionType == SslConnection) {
+        prepareEncryption();
+        ((QSslSocket*) socket)->startClientEncryption();
+    }
 
-        // Check for client error
-        if (responseCode / 100 == 5) {
-            emitError(ClientError);
-            return;
-        }
+    // Wait for the greeting (after the handshake with SslConnection)
+    changeState(ConnectedState);
+}
 
-        processResponse();
-    }
+void SmtpClient::hostConnectFailed(const QString &errorText)
+{
+    // No socket ever connected, so none reports the state: the client has to
+    // be able to connect again
+    changeState(UnconnectedState);
+    emit error(SocketError, errorText);
 }
 
 void SmtpClient::socketEncrypted() {
+    QSslSocket *sslSocket = (QSslSocket*) socket;
+    if (!tlsProfile->isPinned(sslSocket->peerCertificateChain())) {
+        emit error(SocketError, "Server certificate is not pinned");
+        sslSocket->abort();
+        return;
+    }
+
+    // Keep the session, the next connection to this server can resume it
+    SmtpTlsSessionCache::update((QSslSocket*) socket, host, port);
+
     if (state == _TLS_1_ENCRYPT) {
         changeState(_TLS_2_EHLO);
     }
 }
 
+void SmtpClient::socketBytesWritten() {
+    if (committing)
+        commitTimer.start();
+}
+
+void SmtpClient::sessionTicketReceived() {
+    SmtpTlsSessionCache::store((QSslSocket*) socket, host, port);
+}
+
+void SmtpClient::writerError(const QString &text)
+{
+    emit error(MailSendingError, text);
+}
+
+void SmtpClient::paceTimeout()
+{
+    paced = true;
+    changeState(pacedState);
+}
+
+void SmtpClient::cancelPace()
+{
+    paceTimer->stop();
+    paced = false;
+}
+
+void SmtpClient::transactionFailed()
+{
+    if (!batchOpen)
+        return;
+    batchOpen = false;
+
+    // The recipients of a transaction that did not commit did not get the
+    // message, whatever they were answered
+    foreach (int index, batch) {
+        if (recipientStatuses.at(index).isAccepted())
+            recipientStatuses[index].reset();
+    }
+}
+
+void SmtpClient::bodyStreamed()
+{
+    // Lines starting with a dot were escaped while the body was streamed
+    startCommit();
+    sendMessage(bodyStreamer->isAtLineStart() ? "." : "\r\n.");
+}
+
 void SmtpClient::connectionTimeout()
 {
     emit error(ConnectionTimeoutError, "Connection timeout");
@@ -781,6 +1982,105 @@ void SmtpClient::mailSendTimeout()
     emit error(ResponseTimeoutError, "Mail send timeout");
 }
 
+void SmtpClient::startNextOperation()
+{
+    if (operationRunning || operations.isEmpty())
+        return;
+
+    AsyncOperation &op = operations.first();
+    operationRunning = true;
+    op.started.start();
+
+    if (op.timeout > 0)
+        operationTimer->start(op.timeout);
+
+    switch (op.type)
+    {
+    case _CONNECT_OP:
+        if (isReadyConnected)
+            finishOperation(true);
+        else if (state == UnconnectedState)
+            connectToHost();
+        break;
+
+    case _LOGIN_OP:
+        if (op.setCredentials) {
+            user = op.user;
+            password = op.password;
+            authMethod = op.method;
+            clearUserDataAfterLogin = true;
+        }
+        if (isAuthenticated)
+            finishOperation(true);
+        else if (!login())
+            finishOperation(false, AuthenticationError, "Client is not connected");
+        break;
+
+    case _SEND_OP:
+        if (isPaced())
+            finishOperation(false, MailSendingError, "Client is paced by the rate limiter");
+        else if (!(op.email ? sendMail(*op.email) : sendMail(op.envelope, op.data)))
+            finishOperation(false, MailSendingError, "Client is not connected");
+        break;
+
+    case _RESET_OP:
+        if (!reset())
+            finishOperation(false, MailSendingError, "Client is not connected");
+        break;
+    }
+}
+
+void SmtpClient::operationSucceeded()
+{
+    if (!operationRunning)
+        return;
+
+    switch (operations.first().type)
+    {
+    case _CONNECT_OP:
+        if (isReadyConnected)
+            finishOperation(true);
+        break;
+    case _LOGIN_OP:
+        if (isAuthenticated)
+            finishOperation(true);
+        break;
+    case _SEND_OP:
+        if (isMailSent)
+            finishOperation(true);
+        break;
+    case _RESET_OP:
+        if (isReset)
+            finishOperation(true);
+        break;
+    }
+}
+
+void SmtpClient::operationFailed(SmtpClient::SmtpError e, const QString &errorText)
+{
+    finishOperation(false, e, errorText);
+}
+
+void SmtpClient::operationTimeout()
+{
+    if (!operationRunning)
+        return;
+
+    switch (operations.first().type)
+    {
+    case _CONNECT_OP:
+        connectionTimeout();
+        break;
+    case _LOGIN_OP:
+        authenticationTimeout();
+        break;
+    case _SEND_OP:
+    case _RESET_OP:
+        mailSendTimeout();
+        break;
+    }
+}
+
 /* [5] --- */
 
 
@@ -22,8 +22,24 @@
 #include <QObject>
 #include <QtNetwork/QSslSocket>
 #include <QEventLoop>
+#include <QElapsedTimer>
+#include <QFuture>
+#include <QFutureInterface>
+#include <QPair>
 #include "smtpmime_global.h"
 #include "mimemessage.h"
+#include "smtpenvelope.h"
+#include "smtpcapabilities.h"
+#include "mimesegmentbuffer.h"
+#include "smtpresult.h"
+#include "smtpreplyparser.h"
+
+class QTimer;
+class SmtpWriter;
+class SmtpBodyStreamer;
+class SmtpTlsProfile;
+class SmtpConnector;
+class SmtpRateLimiter;
 
 
 class SMTP_MIME_EXPORT SmtpClient : public QObject
@@ -76,6 +92,7 @@ public:
         _READY_Authenticated = 53,
         _READY_MailSent = 54,
         _READY_Encrypted = 55,
+        _NOOP_State = 56,
 
         /* Internal Substates */
 
@@ -95,7 +112,11 @@ public:
         _MAIL_1_RCPT_INIT = 82,
         _MAIL_2_RCPT = 83,
         _MAIL_3_DATA = 84,
-        _MAIL_4_SEND_DATA = 85
+        _MAIL_4_SEND_DATA = 85,
+        _MAIL_5_BDAT = 86,
+        _MAIL_6_NEXT = 87,
+        _MAIL_7_RSET = 88,
+        _MAIL_8_END_DATA = 89
     };
 
     /* [0] --- */
@@ -135,10 +156,35 @@ public:
     bool getVerifyPeer() const;
     void setVerifyPeer(const bool verify);
 
+    SmtpTlsProfile *getTlsProfile() const;
+    void setTlsProfile(SmtpTlsProfile *profile);
+
+    SmtpConnector *getConnector() const;
+
+    SmtpRateLimiter *getRateLimiter() const;
+    void setRateLimiter(SmtpRateLimiter *limiter);
+
+    int getChunkSize() const;
+    void setChunkSize(int size);
+
+    int getMaxRecipients() const;
+    void setMaxRecipients(int count);
+
+    bool isBinaryMimeEnabled() const;
+    void setBinaryMimeEnabled(bool enabled);
+
     QString getResponseText() const;
     int getResponseCode() const;
+    QString getEnhancedStatusCode() const;
+    SmtpReply getLastReply() const;
+    qint64 getReplyLatency() const;
+    const QList<SmtpRecipientStatus> &getRecipientStatuses() const;
 
     QTcpSocket* getSocket();
+    ClientState getState() const;
+
+    SmtpCapabilities getCapabilities() const;
+    SmtpCapabilities getCachedCapabilities() const;
 
     /* [2] --- */
 
@@ -151,16 +197,28 @@ public:
     bool login();
     bool login(const QString &user, const QString &password, AuthMethod method = AuthLogin);
     bool isLogged();
+    bool isPaced() const;
 
     bool sendMail(MimeMessage& email);
+    bool sendMail(MimeMessage& email, const SmtpEnvelope &envelope);
+    bool sendMail(const SmtpEnvelope &envelope, const QByteArray &data);
     void quit();
     bool reset();
+    bool noop();
 
     bool waitForReadyConnected(int msec = 30000);
     bool waitForAuthenticated(int msec = 30000);
     bool waitForMailSent(int msec = 30000);
     bool waitForReset(int msec = 30000);
 
+    QFuture<SmtpResult> connectToHostAsync(int msec = 30000);
+    QFuture<SmtpResult> loginAsync(int msec = 30000);
+    QFuture<SmtpResult> loginAsync(const QString &user, const QString &password,
+                                   AuthMethod method = AuthLogin, int msec = 30000);
+    QFuture<SmtpResult> sendMailAsync(MimeMessage& email, int msec = 30000);
+    QFuture<SmtpResult> sendMailAsync(const SmtpEnvelope &envelope, const QByteArray &data, int msec = 30000);
+    QFuture<SmtpResult> resetAsync(int msec = 30000);
+
     /* [3] --- */
 
 protected:
@@ -168,6 +226,7 @@ protected:
     /* [4] Protected members */
 
     QTcpSocket *socket;
+    SmtpWriter *writer;
     ClientState state;
     bool syncMode;
 
@@ -181,9 +240,16 @@ protected:
     AuthMethod authMethod;
     bool clearUserDataAfterLogin;
     bool verifyPeer;
-
-    QString responseText;
-    QString tempResponse;
+    SmtpTlsProfile *tlsProfile;
+    SmtpConnector *connector;
+    SmtpRateLimiter *rateLimiter;
+    QTimer *paceTimer;
+    ClientState pacedState;
+    bool paced;
+    QString loggedUser;
+
+    SmtpReplyParser replyParser;
+    SmtpReply reply;
     int responseCode;
 
     bool isReadyConnected;
@@ -192,22 +258,100 @@ protected:
     bool isReset;
 
     MimeMessage *email;
-    QList<EmailAddress>::const_iterator addressIt;
-    QList<EmailAddress> addressList;
+    SmtpEnvelope envelope;
+    QByteArray rawData;
+    int rcptSent;
+
+    SmtpCapabilities capabilities;
+    QList<ClientState> pendingReplies;
+    QList<SmtpRecipientStatus> recipientStatuses;
+    QList<int> batch;
+    bool batchFull;
+    bool batchOpen;
+    int maxRecipients;
+    int rcptReplies;
+    SmtpReply rcptError;
+    SmtpReply pipelineError;
+
+    enum _OperationType { _CONNECT_OP, _LOGIN_OP, _SEND_OP, _RESET_OP };
+
+    struct AsyncOperation
+    {
+        AsyncOperation() : type(_CONNECT_OP), timeout(0), email(0),
+            setCredentials(false), method(AuthLogin) {}
+
+        _OperationType type;
+        QFutureInterface<SmtpResult> result;
+        QElapsedTimer queued;
+        QElapsedTimer started;
+        int timeout;
+        MimeMessage *email;
+        SmtpEnvelope envelope;
+        QByteArray data;
+        bool setCredentials;
+        QString user;
+        QString password;
+        AuthMethod method;
+    };
 
-    int rcptType;
-    enum _RcptType { _TO = 1, _CC = 2, _BCC = 3};
+    QList<AsyncOperation> operations;
+    bool operationRunning;
+    QTimer *operationTimer;
+
+    int chunkSize;
+    bool binaryMimeEnabled;
+    bool useBinaryMime;
+    bool use8BitMime;
+    bool useSmtpUtf8;
+    qint64 messageSize;
+    QList<QPair<MimePart*, MimePart::Encoding> > savedEncodings;
+    MimePart::Encoding savedHeaderEncoding;
+    QList<MimeSegmentBuffer::Segment> bodySegments;
+    qint64 bodySize;
+    int bodySegment;
+    qint64 bodySegmentOffset;
+    qint64 bdatRemaining;
+    int bdatInFlight;
+    bool committing;
+    QElapsedTimer commitTimer;
+    qint64 replyLatency;
+    SmtpBodyStreamer *bodyStreamer;
 
     /* [4] --- */
 
 
     /* [5] Protected methods */
     void setConnectionType(ConnectionType ct);
+    void setSocket(QTcpSocket *socket);
     void changeState(ClientState state);
+    bool delayForRate(ClientState next);
     void processResponse();
+    void processPipelinedResponse();
+    void sendEnvelopePipelined();
+    void recordRecipientReply();
+    bool startBatch();
+    void skipBatch();
+    bool hasAcceptedRecipient(bool inBatch = false) const;
+    bool hasPendingRecipient() const;
+    static bool isTooManyRecipients(const SmtpReply &reply);
+    void emitReplyError(const SmtpReply &failed);
+    void sendBdatChunk();
+    void startCommit();
+    void commitAnswered();
+    void prepareEncryption();
+    bool prepareMail();
+    bool checkMessageSize();
+    void appendMailFrom();
+    void appendRcptTo(const EmailAddress &rcpt);
+    void serializeBody(MimeSegmentBuffer &body);
+    void prepareBody();
+    void applyEncodings();
+    void restoreEncodings();
     void sendMessage(const QString &text);
     void emitError(SmtpClient::SmtpError e);
     void waitForEvent(int msec, const char *successSignal, const char *timeoutSlot);
+    QFuture<SmtpResult> queueOperation(AsyncOperation &op);
+    void finishOperation(bool success, int error = -1, const QString &errorText = "");
 
     /* [5] --- */
 
@@ -219,11 +363,26 @@ protected slots:
     void socketError(QAbstractSocket::SocketError error);
     void socketReadyRead();
     void socketEncrypted();
+    void socketBytesWritten();
+    void sessionTicketReceived();
+    void hostConnected(QTcpSocket *socket);
+    void hostConnectFailed(const QString &errorText);
+    void writerError(const QString &text);
+    void paceTimeout();
+    void cancelPace();
+    void transactionFailed();
+    void bodyStreamed();
+    void sendBdatChunks();
 
     void connectionTimeout();
     void authenticationTimeout();
     void mailSendTimeout();
 
+    void startNextOperation();
+    void operationSucceeded();
+    void operationFailed(SmtpClient::SmtpError e, const QString &errorText);
+    void operationTimeout();
+
     /* [6] --- */
 
 
@@ -236,6 +395,7 @@ signals:
     void connected();
     void readyConnected();
     void authenticated();
+    void mailCommitting();
     void mailSent();
     void mailReset();
     void disconnected();
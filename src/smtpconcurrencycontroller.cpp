@@ -0,0 +1,263 @@
+#include "smtpconcurrencycontroller.h"
+
+#include <QMutexLocker>
+#include <qmath.h>
+
+/* [1] Constructors and Destructors */
+
+SmtpConcurrencyController::SmtpConcurrencyController() :
+    minLimit(1),
+    maxLimit(16),
+    initialLimit(2),
+    decreaseFactor(0.5),
+    latencyTolerance(2.0),
+    predictionHorizon(2000)
+{
+    clock.start();
+}
+
+SmtpConcurrencyController::~SmtpConcurrencyController()
+{
+}
+
+/* [1] --- */
+
+
+/* [2] Getters and Setters */
+
+int SmtpConcurrencyController::getMinLimit() const
+{
+    QMutexLocker locker(&mutex);
+    return minLimit;
+}
+
+void SmtpConcurrencyController::setMinLimit(int limit)
+{
+    QMutexLocker locker(&mutex);
+    this->minLimit = qMax(1, limit);
+}
+
+int SmtpConcurrencyController::getMaxLimit() const
+{
+    QMutexLocker locker(&mutex);
+    return maxLimit;
+}
+
+void SmtpConcurrencyController::setMaxLimit(int limit)
+{
+    QMutexLocker locker(&mutex);
+    this->maxLimit = qMax(1, limit);
+}
+
+int SmtpConcurrencyController::getInitialLimit() const
+{
+    QMutexLocker locker(&mutex);
+    return initialLimit;
+}
+
+/**
+ * @brief Sets the limit a destination starts with.
+ */
+void SmtpConcurrencyController::setInitialLimit(int limit)
+{
+    QMutexLocker locker(&mutex);
+    this->initialLimit = qMax(1, limit);
+}
+
+double SmtpConcurrencyController::getDecreaseFactor() const
+{
+    QMutexLocker locker(&mutex);
+    return decreaseFactor;
+}
+
+/**
+ * @brief Sets the factor the limit is multiplied with when the relay pushes
+ * back.
+ */
+void SmtpConcurrencyController::setDecreaseFactor(double factor)
+{
+    QMutexLocker locker(&mutex);
+    this->decreaseFactor = qBound(0.1, factor, 0.9);
+}
+
+double SmtpConcurrencyController::getLatencyTolerance() const
+{
+    QMutexLocker locker(&mutex);
+    return latencyTolerance;
+}
+
+/**
+ * @brief Sets how many times slower than the best response time sends may
+ * get before the limit is cut.
+ */
+void SmtpConcurrencyController::setLatencyTolerance(double tolerance)
+{
+    QMutexLocker locker(&mutex);
+    this->latencyTolerance = qMax(1.0, tolerance);
+}
+
+int SmtpConcurrencyController::getPredictionHorizon() const
+{
+    QMutexLocker locker(&mutex);
+    return predictionHorizon;
+}
+
+/**
+ * @brief Sets how far ahead (in milliseconds) getPredictedDemand() looks.
+ * It should cover the time to open and authenticate a session.
+ */
+void SmtpConcurrencyController::setPredictionHorizon(int msec)
+{
+    QMutexLocker locker(&mutex);
+    this->predictionHorizon = qMax(0, msec);
+}
+
+int SmtpConcurrencyController::getLimit(const QString &destination) const
+{
+    QMutexLocker locker(&mutex);
+    QHash<QString, Destination>::const_iterator it = destinations.constFind(destination);
+    return (it != destinations.constEnd()) ? int(it.value().limit) : qMin(initialLimit, maxLimit);
+}
+
+int SmtpConcurrencyController::getActive(const QString &destination) const
+{
+    QMutexLocker locker(&mutex);
+    QHash<QString, Destination>::const_iterator it = destinations.constFind(destination);
+    return (it != destinations.constEnd()) ? it.value().active : 0;
+}
+
+int SmtpConcurrencyController::getQueueDepth(const QString &destination) const
+{
+    QMutexLocker locker(&mutex);
+    QHash<QString, Destination>::const_iterator it = destinations.constFind(destination);
+    return (it != destinations.constEnd()) ? it.value().depth : 0;
+}
+
+/* [2] --- */
+
+
+/* [3] Public methods */
+
+/**
+ * @brief Takes a slot for a send to the destination, if the limit allows.
+ */
+bool SmtpConcurrencyController::tryAcquire(const QString &destination)
+{
+    QMutexLocker locker(&mutex);
+
+    Destination &target = this->destination(destination);
+    if (target.active >= qMax(minLimit, int(target.limit)))
+        return false;
+
+    target.active++;
+    return true;
+}
+
+/**
+ * @brief Gives the slot back and adapts the limit to the outcome of the
+ * send: its reply code (0 if the connection failed) and how long it took
+ * in milliseconds.
+ */
+void SmtpConcurrencyController::release(const QString &destination, int responseCode, qint64 latency)
+{
+    QMutexLocker locker(&mutex);
+
+    Destination &target = this->destination(destination);
+    target.active = qMax(0, target.active - 1);
+
+    if (latency > 0) {
+        target.latency = (target.latency == 0) ? latency : 0.8 * target.latency + 0.2 * latency;
+
+        // The best response time seen, drifting up slowly so that a single
+        // lucky send does not make every later one look slow
+        if (target.baseline == 0 || latency < target.baseline)
+            target.baseline = latency;
+        else
+            target.baseline += (latency - target.baseline) * 0.01;
+    }
+
+    bool congested = (responseCode == 0 || responseCode / 100 == 4);
+    if (!congested && target.baseline > 0)
+        congested = (target.latency > latencyTolerance * target.baseline);
+
+    qint64 now = clock.elapsed();
+
+    if (congested) {
+        // Replies to sends started before the cut do not cut again
+        if (now - target.lastDecrease >= qMax<qint64>(1000, qint64(target.latency))) {
+            target.limit = qMax<double>(minLimit, target.limit * decreaseFactor);
+            target.lastDecrease = now;
+        }
+    } else if (responseCode / 100 == 2) {
+        target.limit = qMin<double>(maxLimit, target.limit + 1.0 / target.limit);
+    }
+}
+
+/**
+ * @brief Records that delta messages were queued for (or taken from the
+ * queue of) the destination.
+ */
+void SmtpConcurrencyController::addQueued(const QString &destination, int delta)
+{
+    QMutexLocker locker(&mutex);
+
+    Destination &target = this->destination(destination);
+    qint64 now = clock.elapsed();
+    qint64 elapsed = now - target.depthUpdated;
+
+    target.depth = qMax(0, target.depth + delta);
+
+    // Growth in messages per millisecond, smoothed over the recent changes
+    double growth = double(delta) / qMax<qint64>(1, elapsed);
+    target.growth = 0.7 * target.growth + 0.3 * growth;
+    target.depthUpdated = now;
+}
+
+/**
+ * @brief Returns how many sessions the destination is expected to need
+ * getPredictionHorizon() from now: the sends in progress plus the queue
+ * depth extrapolated from its growth, capped by the current limit.
+ */
+int SmtpConcurrencyController::getPredictedDemand(const QString &destination) const
+{
+    QMutexLocker locker(&mutex);
+
+    QHash<QString, Destination>::const_iterator it = destinations.constFind(destination);
+    if (it == destinations.constEnd())
+        return 0;
+
+    const Destination &target = it.value();
+    double predicted = target.active + target.depth + qMax(0.0, target.growth) * predictionHorizon;
+    return qMin(qCeil(predicted), qMax(minLimit, int(target.limit)));
+}
+
+void SmtpConcurrencyController::clear()
+{
+    QMutexLocker locker(&mutex);
+    destinations.clear();
+}
+
+/* [3] --- */
+
+
+/* [4] Protected methods */
+
+SmtpConcurrencyController::Destination &SmtpConcurrencyController::destination(const QString &key)
+{
+    QHash<QString, Destination>::iterator it = destinations.find(key);
+    if (it != destinations.end())
+        return it.value();
+
+    Destination target;
+    target.limit = qBound(minLimit, initialLimit, maxLimit);
+    target.active = 0;
+    target.latency = 0;
+    target.baseline = 0;
+    target.lastDecrease = -1000000;
+    target.depth = 0;
+    target.growth = 0;
+    target.depthUpdated = clock.elapsed();
+    return destinations.insert(key, target).value();
+}
+
+/* [4] --- */
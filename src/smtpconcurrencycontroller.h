@@ -0,0 +1,116 @@
+#ifndef SMTPCONCURRENCYCONTROLLER_H
+#define SMTPCONCURRENCYCONTROLLER_H
+
+#include <QString>
+#include <QHash>
+#include <QMutex>
+#include <QElapsedTimer>
+#include "smtpmime_global.h"
+
+/**
+ * @brief Adapts the number of parallel sessions per relay (AIMD).
+ *
+ * Every destination has a concurrency limit. A send takes a slot with
+ * tryAcquire() and gives it back with release(), together with the reply
+ * code and the time the server took to answer it. While sends succeed at a healthy response
+ * time the limit grows by about one per window of sends; a 421 or other
+ * 4xx reply, a lost connection or a response time above
+ * getLatencyTolerance() times the best one seen cuts the limit by
+ * getDecreaseFactor(), at most once per response time.
+ *
+ * The controller also follows the queue depth of each destination and
+ * predicts the demand getPredictionHorizon() ahead, so sessions can be
+ * opened before the queue grows.
+ *
+ * The controller can be shared between threads.
+ */
+class SMTP_MIME_EXPORT SmtpConcurrencyController
+{
+public:
+
+    /* [1] Constructors and Destructors */
+
+    SmtpConcurrencyController();
+    ~SmtpConcurrencyController();
+
+    /* [1] --- */
+
+
+    /* [2] Getters and Setters */
+
+    int getMinLimit() const;
+    void setMinLimit(int limit);
+
+    int getMaxLimit() const;
+    void setMaxLimit(int limit);
+
+    int getInitialLimit() const;
+    void setInitialLimit(int limit);
+
+    double getDecreaseFactor() const;
+    void setDecreaseFactor(double factor);
+
+    double getLatencyTolerance() const;
+    void setLatencyTolerance(double tolerance);
+
+    int getPredictionHorizon() const;
+    void setPredictionHorizon(int msec);
+
+    int getLimit(const QString &destination) const;
+    int getActive(const QString &destination) const;
+    int getQueueDepth(const QString &destination) const;
+
+    /* [2] --- */
+
+
+    /* [3] Public methods */
+
+    bool tryAcquire(const QString &destination);
+    void release(const QString &destination, int responseCode, qint64 latency);
+
+    void addQueued(const QString &destination, int delta);
+    int getPredictedDemand(const QString &destination) const;
+
+    void clear();
+
+    /* [3] --- */
+
+protected:
+
+    struct Destination
+    {
+        double limit;
+        int active;
+        double latency;
+        double baseline;
+        qint64 lastDecrease;
+
+        int depth;
+        double growth;
+        qint64 depthUpdated;
+    };
+
+    /* [4] Protected members */
+
+    mutable QMutex mutex;
+    QElapsedTimer clock;
+    QHash<QString, Destination> destinations;
+
+    int minLimit;
+    int maxLimit;
+    int initialLimit;
+    double decreaseFactor;
+    double latencyTolerance;
+    int predictionHorizon;
+
+    /* [4] --- */
+
+
+    /* [5] Protected methods */
+
+    Destination &destination(const QString &key);
+
+    /* [5] --- */
+};
+
+#endif // SMTPCONCURRENCYCONTROLLER_H
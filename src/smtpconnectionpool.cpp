@@ -0,0 +1,389 @@
+#include "smtpconnectionpool.h"
+
+#include <QCryptographicHash>
+#include "smtptlsprofile.h"
+
+/* [1] Constructors and Destructors */
+
+SmtpConnectionPool::SmtpConnectionPool(QObject *parent) :
+    QObject(parent),
+    maxIdleTime(60000),
+    keepAliveInterval(20000),
+    maxIdleConnections(4),
+    timeout(30000),
+    name("localhost"),
+    tlsProfile(SmtpTlsProfile::defaultProfile()),
+    rateLimiter(0)
+{
+    connect(&timer, SIGNAL(timeout()), this, SLOT(keepAlive()));
+}
+
+SmtpConnectionPool::~SmtpConnectionPool()
+{
+    clear();
+}
+
+/* [1] --- */
+
+
+/* [2] Getters and Setters */
+
+int SmtpConnectionPool::getMaxIdleTime() const
+{
+    return maxIdleTime;
+}
+
+/**
+ * @brief Sets how long (in milliseconds) a session may stay unused in the
+ * pool before it is closed.
+ */
+void SmtpConnectionPool::setMaxIdleTime(int msec)
+{
+    this->maxIdleTime = msec;
+}
+
+int SmtpConnectionPool::getKeepAliveInterval() const
+{
+    return keepAliveInterval;
+}
+
+/**
+ * @brief Sets the interval (in milliseconds) of the NOOP commands sent on
+ * idle sessions.
+ */
+void SmtpConnectionPool::setKeepAliveInterval(int msec)
+{
+    this->keepAliveInterval = msec;
+}
+
+int SmtpConnectionPool::getMaxIdleConnections() const
+{
+    return maxIdleConnections;
+}
+
+/**
+ * @brief Sets how many idle sessions are kept for each host and
+ * credentials. Released sessions above this limit are closed.
+ */
+void SmtpConnectionPool::setMaxIdleConnections(int count)
+{
+    this->maxIdleConnections = count;
+}
+
+int SmtpConnectionPool::getTimeout() const
+{
+    return timeout;
+}
+
+/**
+ * @brief Sets the timeout (in milliseconds) of connecting, logging in and
+ * resetting a session.
+ */
+void SmtpConnectionPool::setTimeout(int msec)
+{
+    this->timeout = msec;
+}
+
+QString SmtpConnectionPool::getName() const
+{
+    return name;
+}
+
+/**
+ * @brief Sets the name new clients send with EHLO.
+ */
+void SmtpConnectionPool::setName(const QString &name)
+{
+    this->name = name;
+}
+
+SmtpTlsProfile *SmtpConnectionPool::getTlsProfile() const
+{
+    return tlsProfile;
+}
+
+/**
+ * @brief Sets the TLS profile given to new clients. The profile is not
+ * owned by the pool.
+ */
+void SmtpConnectionPool::setTlsProfile(SmtpTlsProfile *profile)
+{
+    this->tlsProfile = profile ? profile : SmtpTlsProfile::defaultProfile();
+}
+
+SmtpRateLimiter *SmtpConnectionPool::getRateLimiter() const
+{
+    return rateLimiter;
+}
+
+/**
+ * @brief Sets the rate limiter given to new clients. The limiter is not
+ * owned by the pool.
+ */
+void SmtpConnectionPool::setRateLimiter(SmtpRateLimiter *limiter)
+{
+    this->rateLimiter = limiter;
+}
+
+int SmtpConnectionPool::getIdleCount() const
+{
+    return idle.size();
+}
+
+int SmtpConnectionPool::getBusyCount() const
+{
+    return keys.size() - idle.size();
+}
+
+/* [2] --- */
+
+
+/* [3] Public methods */
+
+/**
+ * @brief Returns a connected (and, if a user is given, authenticated)
+ * client in ReadyState, or NULL if no session could be established. The
+ * client has to be given back with release() or discard().
+ */
+SmtpClient *SmtpConnectionPool::acquire(const QString &host, int port, SmtpClient::ConnectionType ct,
+                                        const QString &user, const QString &password,
+                                        SmtpClient::AuthMethod method)
+{
+    QString key = makeKey(host, port, ct, user, password, method);
+
+    for (int i = idle.size() - 1; i >= 0; --i) {
+        if (idle.at(i).key != key)
+            continue;
+
+        SmtpClient *client = idle.at(i).client;
+
+        // Sessions closed by the server are replaced by a new one
+        if (client->getSocket()->state() != QAbstractSocket::ConnectedState) {
+            closeClient(client);
+            continue;
+        }
+
+        // Skip sessions waiting for a NOOP reply
+        if (client->getState() != SmtpClient::ReadyState)
+            continue;
+
+        idle.removeAt(i);
+        return client;
+    }
+
+    SmtpClient *client = connectClient(host, port, ct, user, password, method);
+    if (client)
+        keys.insert(client, key);
+
+    return client;
+}
+
+/**
+ * @brief Gives the client back to the pool. The session is reset with RSET
+ * and kept for the next message, or closed if it is no longer usable.
+ */
+void SmtpConnectionPool::release(SmtpClient *client)
+{
+    if (!client || !keys.contains(client) || findIdle(client) >= 0)
+        return;
+
+    if (client->getSocket()->state() != QAbstractSocket::ConnectedState
+            || client->getResponseCode() == 421
+            || !client->reset() || !client->waitForReset(timeout)) {
+        closeClient(client);
+        return;
+    }
+
+    addIdle(client);
+}
+
+/**
+ * @brief Opens a session ahead of time and keeps it idle, unless there is
+ * an idle session for the host and credentials already. Returns false if
+ * no session could be established.
+ */
+bool SmtpConnectionPool::prewarm(const QString &host, int port, SmtpClient::ConnectionType ct,
+                                 const QString &user, const QString &password,
+                                 SmtpClient::AuthMethod method)
+{
+    QString key = makeKey(host, port, ct, user, password, method);
+    foreach (const IdleClient &entry, idle) {
+        if (entry.key == key)
+            return true;
+    }
+
+    SmtpClient *client = connectClient(host, port, ct, user, password, method);
+    if (!client)
+        return false;
+
+    keys.insert(client, key);
+    addIdle(client);
+    return true;
+}
+
+/**
+ * @brief Closes a client taken from the pool instead of giving it back.
+ */
+void SmtpConnectionPool::discard(SmtpClient *client)
+{
+    if (client && keys.contains(client))
+        closeClient(client);
+}
+
+/**
+ * @brief Closes every idle session. Clients that are in use are left alone
+ * but are no longer tracked by the pool.
+ */
+void SmtpConnectionPool::clear()
+{
+    while (!idle.isEmpty())
+        closeClient(idle.last().client);
+
+    foreach (SmtpClient *client, keys.keys())
+        disconnect(client, 0, this, 0);
+    keys.clear();
+
+    timer.stop();
+}
+
+/* [3] --- */
+
+
+/* [4] Protected slots */
+
+void SmtpConnectionPool::keepAlive()
+{
+    for (int i = idle.size() - 1; i >= 0; --i) {
+        IdleClient &entry = idle[i];
+
+        if (entry.idleSince.elapsed() >= maxIdleTime) {
+            closeClient(entry.client);
+            continue;
+        }
+
+        if (entry.lastActivity.elapsed() >= keepAliveInterval && entry.client->noop())
+            entry.lastActivity.restart();
+    }
+
+    if (idle.isEmpty())
+        timer.stop();
+}
+
+void SmtpConnectionPool::clientError()
+{
+    // Errors of clients in use are reported to their user
+    SmtpClient *client = qobject_cast<SmtpClient*>(sender());
+    if (client && findIdle(client) >= 0)
+        closeClient(client);
+}
+
+void SmtpConnectionPool::clientStateChanged(SmtpClient::ClientState state)
+{
+    SmtpClient *client = qobject_cast<SmtpClient*>(sender());
+    if (client && state == SmtpClient::UnconnectedState && findIdle(client) >= 0)
+        closeClient(client);
+}
+
+/* [4] --- */
+
+
+/* [5] Protected methods */
+
+QString SmtpConnectionPool::makeKey(const QString &host, int port, SmtpClient::ConnectionType ct,
+                                    const QString &user, const QString &password,
+                                    SmtpClient::AuthMethod method)
+{
+    // The password only takes part as a hash
+    QByteArray secret = QCryptographicHash::hash(password.toUtf8(), QCryptographicHash::Sha1).toHex();
+
+    return QString("%1:%2/%3/%4/%5/%6").arg(host.toLower()).arg(port).arg(int(ct))
+            .arg(user).arg(QString(secret)).arg(int(method));
+}
+
+SmtpClient *SmtpConnectionPool::connectClient(const QString &host, int port, SmtpClient::ConnectionType ct,
+                                              const QString &user, const QString &password,
+                                              SmtpClient::AuthMethod method)
+{
+    SmtpClient *client = new SmtpClient(host, port, ct);
+    client->setName(name);
+    client->setTlsProfile(tlsProfile);
+    client->setRateLimiter(rateLimiter);
+
+    connect(client, SIGNAL(error(SmtpClient::SmtpError,QString)),
+            this, SLOT(clientError()));
+    connect(client, SIGNAL(stateChanged(SmtpClient::ClientState)),
+            this, SLOT(clientStateChanged(SmtpClient::ClientState)));
+
+    client->connectToHost();
+    if (!client->waitForReadyConnected(timeout)) {
+        delete client;
+        return NULL;
+    }
+
+    if (!user.isEmpty()) {
+        client->login(user, password, method);
+        if (!client->waitForAuthenticated(timeout)) {
+            delete client;
+            return NULL;
+        }
+    }
+
+    return client;
+}
+
+void SmtpConnectionPool::closeClient(SmtpClient *client)
+{
+    keys.remove(client);
+
+    int i = findIdle(client);
+    if (i >= 0)
+        idle.removeAt(i);
+
+    disconnect(client, 0, this, 0);
+
+    // Let QUIT reach the server before the client goes away
+    QTcpSocket *socket = client->getSocket();
+    if (socket->state() == QAbstractSocket::ConnectedState) {
+        connect(socket, SIGNAL(disconnected()), client, SLOT(deleteLater()));
+        QTimer::singleShot(timeout, client, SLOT(deleteLater()));
+        client->quit();
+    } else {
+        client->deleteLater();
+    }
+}
+
+void SmtpConnectionPool::addIdle(SmtpClient *client)
+{
+    QString key = keys.value(client);
+    int count = 0;
+    foreach (const IdleClient &entry, idle) {
+        if (entry.key == key)
+            count++;
+    }
+
+    if (count >= maxIdleConnections) {
+        closeClient(client);
+        return;
+    }
+
+    IdleClient entry;
+    entry.client = client;
+    entry.key = key;
+    entry.idleSince.start();
+    entry.lastActivity.start();
+    idle.append(entry);
+
+    if (!timer.isActive())
+        timer.start(qMax(1000, qMin(keepAliveInterval, maxIdleTime) / 2));
+}
+
+int SmtpConnectionPool::findIdle(SmtpClient *client) const
+{
+    for (int i = 0; i < idle.size(); ++i) {
+        if (idle.at(i).client == client)
+            return i;
+    }
+    return -1;
+}
+
+/* [5] --- */
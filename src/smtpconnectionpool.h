@@ -0,0 +1,134 @@
+#ifndef SMTPCONNECTIONPOOL_H
+#define SMTPCONNECTIONPOOL_H
+
+#include <QObject>
+#include <QList>
+#include <QHash>
+#include <QElapsedTimer>
+#include <QTimer>
+#include "smtpmime_global.h"
+#include "smtpclient.h"
+
+/**
+ * @brief Keeps connected and authenticated SmtpClient sessions for reuse.
+ *
+ * Sessions are keyed by host, port, connection type and credentials.
+ * acquire() hands out a ready client (reusing an idle one when possible),
+ * release() resets it with RSET and keeps it for the next message. Idle
+ * sessions are kept alive with NOOP and closed after getMaxIdleTime(); a
+ * session dropped by the server (e.g. 421) is discarded and replaced on
+ * the next acquire().
+ *
+ * The pool and its clients belong to the thread the pool lives in.
+ */
+class SMTP_MIME_EXPORT SmtpConnectionPool : public QObject
+{
+    Q_OBJECT
+public:
+
+    /* [1] Constructors and Destructors */
+
+    SmtpConnectionPool(QObject *parent = 0);
+    ~SmtpConnectionPool();
+
+    /* [1] --- */
+
+
+    /* [2] Getters and Setters */
+
+    int getMaxIdleTime() const;
+    void setMaxIdleTime(int msec);
+
+    int getKeepAliveInterval() const;
+    void setKeepAliveInterval(int msec);
+
+    int getMaxIdleConnections() const;
+    void setMaxIdleConnections(int count);
+
+    int getTimeout() const;
+    void setTimeout(int msec);
+
+    QString getName() const;
+    void setName(const QString &name);
+
+    SmtpTlsProfile *getTlsProfile() const;
+    void setTlsProfile(SmtpTlsProfile *profile);
+
+    SmtpRateLimiter *getRateLimiter() const;
+    void setRateLimiter(SmtpRateLimiter *limiter);
+
+    int getIdleCount() const;
+    int getBusyCount() const;
+
+    /* [2] --- */
+
+
+    /* [3] Public methods */
+
+    SmtpClient *acquire(const QString &host, int port = 25,
+                        SmtpClient::ConnectionType ct = SmtpClient::TcpConnection,
+                        const QString &user = "", const QString &password = "",
+                        SmtpClient::AuthMethod method = SmtpClient::AuthLogin);
+    void release(SmtpClient *client);
+    void discard(SmtpClient *client);
+    bool prewarm(const QString &host, int port = 25,
+                 SmtpClient::ConnectionType ct = SmtpClient::TcpConnection,
+                 const QString &user = "", const QString &password = "",
+                 SmtpClient::AuthMethod method = SmtpClient::AuthLogin);
+    void clear();
+
+    /* [3] --- */
+
+protected slots:
+
+    /* [4] Protected slots */
+
+    void keepAlive();
+    void clientError();
+    void clientStateChanged(SmtpClient::ClientState state);
+
+    /* [4] --- */
+
+protected:
+
+    struct IdleClient
+    {
+        SmtpClient *client;
+        QString key;
+        QElapsedTimer idleSince;
+        QElapsedTimer lastActivity;
+    };
+
+    /* [5] Protected members */
+
+    QList<IdleClient> idle;
+    QHash<SmtpClient*, QString> keys;
+    QTimer timer;
+
+    int maxIdleTime;
+    int keepAliveInterval;
+    int maxIdleConnections;
+    int timeout;
+    QString name;
+    SmtpTlsProfile *tlsProfile;
+    SmtpRateLimiter *rateLimiter;
+
+    /* [5] --- */
+
+
+    /* [6] Protected methods */
+
+    static QString makeKey(const QString &host, int port, SmtpClient::ConnectionType ct,
+                           const QString &user, const QString &password,
+                           SmtpClient::AuthMethod method);
+    SmtpClient *connectClient(const QString &host, int port, SmtpClient::ConnectionType ct,
+                              const QString &user, const QString &password,
+                              SmtpClient::AuthMethod method);
+    void addIdle(SmtpClient *client);
+    void closeClient(SmtpClient *client);
+    int findIdle(SmtpClient *client) const;
+
+    /* [6] --- */
+};
+
+#endif // SMTPCONNECTIONPOOL_H
@@ -0,0 +1,365 @@
+#include "smtpconnector.h"
+
+#include <QDateTime>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QtNetwork/QSslSocket>
+#include "smtpresolver.h"
+
+/* [1] Constructors and Destructors */
+
+SmtpConnector::SmtpConnector(QObject *parent) :
+    QObject(parent),
+    resolver(0),
+    dnsResolver(0),
+    attemptDelay(250),
+    sslEnabled(false),
+    running(false),
+    resolving(false),
+    port(0)
+{
+    attemptTimer.setSingleShot(true);
+    connect(&attemptTimer, SIGNAL(timeout()), this, SLOT(startNextAttempt()));
+}
+
+SmtpConnector::~SmtpConnector()
+{
+    abort();
+}
+
+/* [1] --- */
+
+
+/* [2] Getters and Setters */
+
+/**
+ * @brief Sets the resolver used for hosts that are not cached. The resolver
+ * is not owned by the connector; null selects an SmtpDnsResolver.
+ */
+void SmtpConnector::setResolver(SmtpResolver *resolver)
+{
+    if (this->resolver)
+        disconnect(this->resolver, 0, this, 0);
+
+    this->resolver = resolver;
+
+    if (resolver)
+        connect(resolver, SIGNAL(hostFound(QString,QList<QHostAddress>,int)),
+                this, SLOT(hostFound(QString,QList<QHostAddress>,int)));
+}
+
+SmtpResolver *SmtpConnector::getResolver() const
+{
+    return resolver;
+}
+
+/**
+ * @brief Sets the delay (in milliseconds) between the starts of two
+ * connection attempts. RFC 8305 recommends 250 ms.
+ */
+void SmtpConnector::setAttemptDelay(int msec)
+{
+    this->attemptDelay = msec;
+}
+
+int SmtpConnector::getAttemptDelay() const
+{
+    return attemptDelay;
+}
+
+/**
+ * @brief Sets if the attempts are made with QSslSocket, so the connected
+ * socket can start encryption afterwards.
+ */
+void SmtpConnector::setSslEnabled(bool enabled)
+{
+    this->sslEnabled = enabled;
+}
+
+bool SmtpConnector::isSslEnabled() const
+{
+    return sslEnabled;
+}
+
+bool SmtpConnector::isConnecting() const
+{
+    return running;
+}
+
+/* [2] --- */
+
+
+/* [3] Public methods */
+
+void SmtpConnector::connectToHost(const QString &host, int port)
+{
+    abort();
+
+    this->host = host;
+    this->port = port;
+    this->lastError.clear();
+    running = true;
+
+    QHostAddress literal;
+    if (literal.setAddress(host)) {
+        startAttempts(QList<QHostAddress>() << literal);
+        return;
+    }
+
+    QList<QHostAddress> cached = SmtpAddressCache::lookup(host);
+    if (!cached.isEmpty()) {
+        startAttempts(cached);
+        return;
+    }
+
+    if (!resolver) {
+        if (!dnsResolver)
+            dnsResolver = new SmtpDnsResolver(this);
+        setResolver(dnsResolver);
+    }
+
+    resolving = true;
+    resolver->lookupHost(host);
+}
+
+/**
+ * @brief Stops connecting and closes the pending attempts.
+ */
+void SmtpConnector::abort()
+{
+    running = false;
+    resolving = false;
+    attemptTimer.stop();
+    addresses.clear();
+
+    foreach (QTcpSocket *attempt, attempts) {
+        attempt->disconnect(this);
+        attempt->abort();
+        attempt->deleteLater();
+    }
+    attempts.clear();
+}
+
+/**
+ * @brief Orders the addresses for connecting: the preferred address first,
+ * then IPv6 and IPv4 alternating (RFC 8305, section 4).
+ */
+QList<QHostAddress> SmtpConnector::sortAddresses(const QList<QHostAddress> &addresses,
+                                                 const QHostAddress &preferred)
+{
+    QList<QHostAddress> result, v6, v4;
+
+    foreach (const QHostAddress &address, addresses) {
+        if (!preferred.isNull() && address == preferred) {
+            if (result.isEmpty())
+                result << address;
+            continue;
+        }
+        if (address.protocol() == QAbstractSocket::IPv6Protocol)
+            v6 << address;
+        else
+            v4 << address;
+    }
+
+    // Continue with the other family than the one tried first
+    bool v6Next = result.isEmpty() || result.first().protocol() != QAbstractSocket::IPv6Protocol;
+    QList<QHostAddress> &first = v6Next ? v6 : v4;
+    QList<QHostAddress> &second = v6Next ? v4 : v6;
+
+    for (int i = 0; i < qMax(first.size(), second.size()); ++i) {
+        if (i < first.size())
+            result << first.at(i);
+        if (i < second.size())
+            result << second.at(i);
+    }
+    return result;
+}
+
+/* [3] --- */
+
+
+/* [4] Protected slots */
+
+void SmtpConnector::hostFound(const QString &host, const QList<QHostAddress> &addresses, int ttl)
+{
+    if (!resolving || host != this->host)
+        return;
+
+    resolving = false;
+
+    if (addresses.isEmpty()) {
+        fail(QString("Host %1 not found").arg(host));
+        return;
+    }
+
+    SmtpAddressCache::insert(host, addresses, ttl);
+    startAttempts(addresses);
+}
+
+void SmtpConnector::startNextAttempt()
+{
+    if (!running || addresses.isEmpty())
+        return;
+
+    QHostAddress address = addresses.takeFirst();
+
+    QTcpSocket *attempt = sslEnabled ? new QSslSocket(this) : new QTcpSocket(this);
+    connect(attempt, SIGNAL(connected()), this, SLOT(attemptConnected()));
+    connect(attempt, SIGNAL(error(QAbstractSocket::SocketError)),
+            this, SLOT(attemptFailed(QAbstractSocket::SocketError)));
+    attempts << attempt;
+
+    // The next attempt starts after the delay, or as soon as this one fails
+    if (!addresses.isEmpty())
+        attemptTimer.start(attemptDelay);
+
+    attempt->connectToHost(address, port);
+}
+
+void SmtpConnector::attemptConnected()
+{
+    QTcpSocket *winner = qobject_cast<QTcpSocket*>(sender());
+    if (!running || !winner)
+        return;
+
+    attempts.removeAll(winner);
+    abort();
+
+    SmtpAddressCache::setPreferred(host, port, winner->peerAddress());
+
+    winner->disconnect(this);
+    winner->setParent(0);
+    emit connected(winner);
+}
+
+void SmtpConnector::attemptFailed(QAbstractSocket::SocketError)
+{
+    QTcpSocket *attempt = qobject_cast<QTcpSocket*>(sender());
+    if (!attempt)
+        return;
+
+    lastError = attempt->errorString();
+    attempts.removeAll(attempt);
+    attempt->disconnect(this);
+    attempt->deleteLater();
+
+    if (!running)
+        return;
+
+    if (!addresses.isEmpty()) {
+        attemptTimer.stop();
+        startNextAttempt();
+    } else if (attempts.isEmpty()) {
+        fail(lastError);
+    }
+}
+
+/* [4] --- */
+
+
+/* [5] Protected methods */
+
+void SmtpConnector::startAttempts(const QList<QHostAddress> &addresses)
+{
+    this->addresses = sortAddresses(addresses, SmtpAddressCache::getPreferred(host, port));
+    startNextAttempt();
+}
+
+void SmtpConnector::fail(const QString &errorText)
+{
+    abort();
+    emit failed(errorText);
+}
+
+/* [5] --- */
+
+
+/* [6] Address cache */
+
+namespace {
+
+struct AddressEntry
+{
+    QList<QHostAddress> addresses;
+    QDateTime expires;
+};
+
+QMutex addressMutex;
+QHash<QString, AddressEntry> addressEntries;
+QHash<QString, QHostAddress> preferredAddresses;
+
+QString preferredKey(const QString &host, int port)
+{
+    return host.toLower() + ":" + QString::number(port);
+}
+
+}
+
+/**
+ * @brief Returns the cached addresses of the host, or an empty list if the
+ * host is unknown or its TTL has run out.
+ */
+QList<QHostAddress> SmtpAddressCache::lookup(const QString &host)
+{
+    QMutexLocker locker(&addressMutex);
+
+    QHash<QString, AddressEntry>::iterator it = addressEntries.find(host.toLower());
+    if (it == addressEntries.end())
+        return QList<QHostAddress>();
+
+    if (it->expires < QDateTime::currentDateTimeUtc()) {
+        addressEntries.erase(it);
+        return QList<QHostAddress>();
+    }
+
+    return it->addresses;
+}
+
+/**
+ * @brief Caches the addresses for ttl seconds. Nothing is cached when ttl
+ * is not positive.
+ */
+void SmtpAddressCache::insert(const QString &host, const QList<QHostAddress> &addresses, int ttl)
+{
+    if (ttl <= 0 || addresses.isEmpty())
+        return;
+
+    QMutexLocker locker(&addressMutex);
+
+    AddressEntry entry;
+    entry.addresses = addresses;
+    entry.expires = QDateTime::currentDateTimeUtc().addSecs(ttl);
+    addressEntries.insert(host.toLower(), entry);
+}
+
+void SmtpAddressCache::remove(const QString &host)
+{
+    QMutexLocker locker(&addressMutex);
+    addressEntries.remove(host.toLower());
+}
+
+void SmtpAddressCache::clear()
+{
+    QMutexLocker locker(&addressMutex);
+    addressEntries.clear();
+    preferredAddresses.clear();
+}
+
+/**
+ * @brief Returns the address the host was reached on last time, or a null
+ * address.
+ */
+QHostAddress SmtpAddressCache::getPreferred(const QString &host, int port)
+{
+    QMutexLocker locker(&addressMutex);
+    return preferredAddresses.value(preferredKey(host, port));
+}
+
+void SmtpAddressCache::setPreferred(const QString &host, int port, const QHostAddress &address)
+{
+    QMutexLocker locker(&addressMutex);
+    preferredAddresses.insert(preferredKey(host, port), address);
+}
+
+/* [6] --- */
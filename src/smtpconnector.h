@@ -0,0 +1,128 @@
+#ifndef SMTPCONNECTOR_H
+#define SMTPCONNECTOR_H
+
+#include <QObject>
+#include <QList>
+#include <QTimer>
+#include <QtNetwork/QHostAddress>
+#include <QtNetwork/QAbstractSocket>
+#include "smtpmime_global.h"
+
+class QTcpSocket;
+class SmtpResolver;
+class SmtpDnsResolver;
+
+/**
+ * @brief Opens TCP connections with Happy Eyeballs (RFC 8305).
+ *
+ * The addresses of the host are taken from SmtpAddressCache or resolved,
+ * sorted so that IPv6 and IPv4 alternate, and tried one after another with
+ * a short delay between the starts, without waiting for slower attempts to
+ * fail. The first socket that connects is handed over with connected(), the
+ * others are aborted. The address that won is tried first next time.
+ */
+class SMTP_MIME_EXPORT SmtpConnector : public QObject
+{
+    Q_OBJECT
+public:
+
+    /* [1] Constructors and Destructors */
+
+    SmtpConnector(QObject *parent = 0);
+    ~SmtpConnector();
+
+    /* [1] --- */
+
+
+    /* [2] Getters and Setters */
+
+    void setResolver(SmtpResolver *resolver);
+    SmtpResolver *getResolver() const;
+
+    void setAttemptDelay(int msec);
+    int getAttemptDelay() const;
+
+    void setSslEnabled(bool enabled);
+    bool isSslEnabled() const;
+
+    bool isConnecting() const;
+
+    /* [2] --- */
+
+
+    /* [3] Public methods */
+
+    void connectToHost(const QString &host, int port);
+    void abort();
+
+    static QList<QHostAddress> sortAddresses(const QList<QHostAddress> &addresses,
+                                             const QHostAddress &preferred = QHostAddress());
+
+    /* [3] --- */
+
+signals:
+    void connected(QTcpSocket *socket);
+    void failed(const QString &errorText);
+
+protected slots:
+
+    /* [4] Protected slots */
+
+    void hostFound(const QString &host, const QList<QHostAddress> &addresses, int ttl);
+    void startNextAttempt();
+    void attemptConnected();
+    void attemptFailed(QAbstractSocket::SocketError error);
+
+    /* [4] --- */
+
+protected:
+
+    /* [5] Protected members */
+
+    SmtpResolver *resolver;
+    SmtpDnsResolver *dnsResolver;
+    int attemptDelay;
+    bool sslEnabled;
+    bool running;
+    bool resolving;
+
+    QString host;
+    int port;
+    QList<QHostAddress> addresses;
+    QList<QTcpSocket*> attempts;
+    QTimer attemptTimer;
+    QString lastError;
+
+    /* [5] --- */
+
+
+    /* [6] Protected methods */
+
+    void startAttempts(const QList<QHostAddress> &addresses);
+    void fail(const QString &errorText);
+
+    /* [6] --- */
+};
+
+
+/**
+ * @brief Process-wide cache of resolved addresses, kept for their TTL, and
+ * of the address each host and port was last reached on.
+ */
+class SMTP_MIME_EXPORT SmtpAddressCache
+{
+public:
+
+    static QList<QHostAddress> lookup(const QString &host);
+    static void insert(const QString &host, const QList<QHostAddress> &addresses, int ttl);
+    static void remove(const QString &host);
+    static void clear();
+
+    static QHostAddress getPreferred(const QString &host, int port);
+    static void setPreferred(const QString &host, int port, const QHostAddress &address);
+
+private:
+    SmtpAddressCache();
+};
+
+#endif // SMTPCONNECTOR_H
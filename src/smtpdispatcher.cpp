@@ -0,0 +1,542 @@
+#include "smtpdispatcher.h"
+#include "smtpconnectionpool.h"
+
+#include <QMetaType>
+#include <QDateTime>
+#include <QTimer>
+
+/* [1] Constructors and Destructors */
+
+SmtpDispatcher::SmtpDispatcher(int threadCount, QObject *parent) :
+    QObject(parent)
+{
+    qRegisterMetaType<SmtpClient::SmtpError>("SmtpClient::SmtpError");
+
+    settings.id = 0;
+    settings.message = 0;
+    settings.delivered = false;
+    settings.host = "localhost";
+    settings.port = 25;
+    settings.connectionType = SmtpClient::TcpConnection;
+    settings.authMethod = SmtpClient::AuthLogin;
+    settings.timeout = 30000;
+    settings.attempts = 0;
+    settings.firstAttempt = 0;
+    settings.notBefore = 0;
+
+    if (threadCount <= 0)
+        threadCount = qMax(1, QThread::idealThreadCount());
+
+    concurrency.setMaxLimit(threadCount);
+
+    for (int i = 0; i < threadCount; ++i) {
+        Lane *lane = new Lane;
+        lane->idle.store(1);
+        lane->worker = new SmtpDispatcherWorker(this, i);
+        lane->worker->moveToThread(&lane->thread);
+
+        connect(lane->worker, SIGNAL(mailSent(quint64)),
+                this, SIGNAL(mailSent(quint64)));
+        connect(lane->worker, SIGNAL(mailDeferred(quint64,int,QString)),
+                this, SIGNAL(mailDeferred(quint64,int,QString)));
+        connect(lane->worker, SIGNAL(mailFailed(quint64,SmtpClient::SmtpError,QString)),
+                this, SIGNAL(mailFailed(quint64,SmtpClient::SmtpError,QString)));
+
+        // The worker (and its pool) is deleted in its own thread
+        connect(&lane->thread, SIGNAL(finished()),
+                lane->worker, SLOT(deleteLater()));
+
+        lanes.append(lane);
+    }
+
+    foreach (Lane *lane, lanes)
+        lane->thread.start();
+}
+
+/**
+ * @brief Stops the workers. Messages that were not sent yet are dropped
+ * without being reported.
+ */
+SmtpDispatcher::~SmtpDispatcher()
+{
+    stopping.store(1);
+
+    foreach (Lane *lane, lanes)
+        lane->thread.quit();
+
+    foreach (Lane *lane, lanes)
+        lane->thread.wait();
+
+    foreach (Lane *lane, lanes) {
+        Job *job;
+        while (lane->inbox.dequeue(job))
+            lane->jobs.append(job);
+        foreach (job, lane->jobs) {
+            delete job->message;
+            delete job;
+        }
+        delete lane;
+    }
+}
+
+/* [1] --- */
+
+
+/* [2] Getters and Setters */
+
+/**
+ * @brief Sets the server the messages are sent to. Affects the messages
+ * submitted afterwards.
+ */
+void SmtpDispatcher::setServer(const QString &host, int port, SmtpClient::ConnectionType ct)
+{
+    QMutexLocker locker(&settingsMutex);
+    settings.host = host;
+    settings.port = port;
+    settings.connectionType = ct;
+}
+
+void SmtpDispatcher::setCredentials(const QString &user, const QString &password,
+                                    SmtpClient::AuthMethod method)
+{
+    QMutexLocker locker(&settingsMutex);
+    settings.user = user;
+    settings.password = password;
+    settings.authMethod = method;
+}
+
+int SmtpDispatcher::getTimeout() const
+{
+    return settings.timeout;
+}
+
+/**
+ * @brief Sets the timeout (in milliseconds) of each step of a send.
+ */
+void SmtpDispatcher::setTimeout(int msec)
+{
+    QMutexLocker locker(&settingsMutex);
+    settings.timeout = msec;
+}
+
+/**
+ * @brief Returns the scheduler deciding how failed sends are retried. It is
+ * shared by all workers and can be configured at any time.
+ */
+SmtpRetryScheduler *SmtpDispatcher::getRetryScheduler()
+{
+    return &retryScheduler;
+}
+
+/**
+ * @brief Returns the limiter pacing the sends of all workers. No rate is
+ * limited until one is set.
+ */
+SmtpRateLimiter *SmtpDispatcher::getRateLimiter()
+{
+    return &rateLimiter;
+}
+
+/**
+ * @brief Returns the controller adapting how many workers send to the same
+ * server at once. Its maximum is the number of threads.
+ */
+SmtpConcurrencyController *SmtpDispatcher::getConcurrencyController()
+{
+    return &concurrency;
+}
+
+int SmtpDispatcher::getThreadCount() const
+{
+    return lanes.size();
+}
+
+/**
+ * @brief Returns the number of submitted messages without a result yet,
+ * including the ones waiting for a retry.
+ */
+int SmtpDispatcher::getPendingCount() const
+{
+    return pending.load();
+}
+
+/* [2] --- */
+
+
+/* [3] Public methods */
+
+/**
+ * @brief Queues the message for sending and returns its id. The dispatcher
+ * takes ownership of the message (and so of its parts); it must not be
+ * touched by the caller anymore. Can be called from any thread.
+ */
+quint64 SmtpDispatcher::submit(MimeMessage *message)
+{
+    Job *job;
+    {
+        QMutexLocker locker(&settingsMutex);
+        job = new Job(settings);
+    }
+    job->id = quint64(nextId.fetchAndAddOrdered(1)) + 1;
+    job->message = message;
+    job->envelope = SmtpEnvelope::fromMessage(*message);
+
+    pending.fetchAndAddOrdered(1);
+
+    QString destination = destinationOf(job);
+    concurrency.addQueued(destination, 1);
+
+    Lane *lane = lanes.at(uint(nextLane.fetchAndAddOrdered(1)) % lanes.size());
+    lane->inbox.enqueue(job);
+
+    if (lane->idle.load()) {
+        wake(lane);
+    } else {
+        // Let an idle worker steal it instead of waiting for the busy one
+        foreach (Lane *other, lanes) {
+            if (other->idle.load()) {
+                wake(other);
+                break;
+            }
+        }
+    }
+
+    prewarm(destination);
+
+    return job->id;
+}
+
+/* [3] --- */
+
+
+/* [4] Protected methods */
+
+/**
+ * @brief Returns the next job for the worker of the lane: its own oldest
+ * job, or else the newest job of another lane. Jobs waiting for a retry
+ * are skipped, nextDue is set to when the first one of the lane is due.
+ */
+SmtpDispatcher::Job *SmtpDispatcher::takeJob(int lane, qint64 &nextDue)
+{
+    nextDue = 0;
+    Job *job = takeFrom(lanes.at(lane), true, nextDue);
+    if (job)
+        return job;
+
+    qint64 stolenDue;
+    for (int i = 1; i < lanes.size(); ++i) {
+        job = takeFrom(lanes.at((lane + i) % lanes.size()), false, stolenDue);
+        if (job)
+            return job;
+    }
+
+    return 0;
+}
+
+SmtpDispatcher::Job *SmtpDispatcher::takeFrom(Lane *lane, bool front, qint64 &nextDue)
+{
+    // The mutex makes whoever holds it the single consumer of the inbox
+    QMutexLocker locker(&lane->mutex);
+
+    Job *job;
+    while (lane->inbox.dequeue(job))
+        lane->jobs.append(job);
+
+    nextDue = 0;
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+
+    for (int n = 0; n < lane->jobs.size(); ++n) {
+        int i = front ? n : lane->jobs.size() - 1 - n;
+        job = lane->jobs.at(i);
+
+        // A backed off destination holds back every message to it
+        QString destination = destinationOf(job);
+        qint64 due = job->notBefore;
+        int wait = retryScheduler.getWaitTime(destination);
+        if (wait > 0)
+            due = qMax(due, now + wait);
+
+        if (due > now) {
+            if (nextDue == 0 || due < nextDue)
+                nextDue = due;
+            continue;
+        }
+
+        // Left for the worker that frees a slot of the destination
+        if (!concurrency.tryAcquire(destination))
+            continue;
+
+        concurrency.addQueued(destination, -1);
+        return lane->jobs.takeAt(i);
+    }
+
+    return 0;
+}
+
+/**
+ * @brief Puts a job back in the lane until its retry is due.
+ */
+void SmtpDispatcher::deferJob(int lane, Job *job)
+{
+    concurrency.addQueued(destinationOf(job), 1);
+
+    Lane *self = lanes.at(lane);
+    QMutexLocker locker(&self->mutex);
+    self->jobs.append(job);
+}
+
+void SmtpDispatcher::wake(Lane *lane)
+{
+    if (lane->idle.testAndSetOrdered(1, 0))
+        QMetaObject::invokeMethod(lane->worker, "process", Qt::QueuedConnection);
+}
+
+/**
+ * @brief Lets idle workers open a session to the destination when its
+ * predicted demand is higher than the sessions in use. The workers are
+ * warmed in order, so the same ones keep their sessions.
+ */
+void SmtpDispatcher::prewarm(const QString &destination)
+{
+    int demand = qMin(concurrency.getPredictedDemand(destination), lanes.size());
+
+    for (int i = concurrency.getActive(destination); i < demand; ++i) {
+        Lane *lane = lanes.at(i);
+        if (lane->idle.load() && lane->warming.testAndSetOrdered(0, 1))
+            QMetaObject::invokeMethod(lane->worker, "prewarm", Qt::QueuedConnection);
+    }
+}
+
+void SmtpDispatcher::finishJob(Job *job)
+{
+    delete job->message;
+    delete job;
+    pending.fetchAndAddOrdered(-1);
+}
+
+QString SmtpDispatcher::destinationOf(const Job *job)
+{
+    return job->host + ":" + QString::number(job->port);
+}
+
+/* [4] --- */
+
+
+/* [5] Worker */
+
+SmtpDispatcherWorker::SmtpDispatcherWorker(SmtpDispatcher *dispatcher, int lane) :
+    dispatcher(dispatcher),
+    lane(lane),
+    running(false),
+    pool(0),
+    failed(false),
+    lastError(SmtpClient::SocketError)
+{
+    // Moved to the worker's thread together with the worker
+    retryTimer = new QTimer(this);
+    retryTimer->setSingleShot(true);
+    connect(retryTimer, SIGNAL(timeout()), this, SLOT(retryTimeout()));
+}
+
+void SmtpDispatcherWorker::process()
+{
+    // Called again from the nested event loop of a send
+    if (running)
+        return;
+
+    running = true;
+
+    SmtpDispatcher::Lane *self = dispatcher->lanes.at(lane);
+    qint64 nextDue = 0;
+
+    while (!dispatcher->stopping.load()) {
+        SmtpDispatcher::Job *job = dispatcher->takeJob(lane, nextDue);
+
+        if (!job) {
+            self->idle.store(1);
+
+            // A job submitted before the flag was set did not wake us up
+            job = dispatcher->takeJob(lane, nextDue);
+            if (!job)
+                break;
+
+            self->idle.testAndSetOrdered(1, 0);
+        }
+
+        if (send(job))
+            dispatcher->finishJob(job);
+    }
+
+    running = false;
+
+    // Deferred jobs wake the worker up when they are due
+    if (nextDue > 0 && !dispatcher->stopping.load())
+        retryTimer->start(int(qMax<qint64>(0, nextDue - QDateTime::currentMSecsSinceEpoch())));
+}
+
+void SmtpDispatcherWorker::prewarm()
+{
+    SmtpDispatcher::Lane *self = dispatcher->lanes.at(lane);
+
+    if (!running && !dispatcher->stopping.load()) {
+        SmtpDispatcher::Job settings;
+        {
+            QMutexLocker locker(&dispatcher->settingsMutex);
+            settings = dispatcher->settings;
+        }
+
+        getPool(settings.timeout)->prewarm(settings.host, settings.port, settings.connectionType,
+                                           settings.user, settings.password, settings.authMethod);
+    }
+
+    self->warming.store(0);
+}
+
+void SmtpDispatcherWorker::clientError(SmtpClient::SmtpError e, const QString &errorText)
+{
+    failed = true;
+    lastError = e;
+    lastErrorText = errorText;
+}
+
+void SmtpDispatcherWorker::retryTimeout()
+{
+    SmtpDispatcher::Lane *self = dispatcher->lanes.at(lane);
+    if (self->idle.testAndSetOrdered(1, 0))
+        process();
+}
+
+/**
+ * Returns the connection pool of the worker, created on first use with the
+ * timeout of the first job and the shared rate limiter.
+ */
+SmtpConnectionPool *SmtpDispatcherWorker::getPool(int timeout)
+{
+    if (!pool) {
+        pool = new SmtpConnectionPool(this);
+        pool->setTimeout(timeout);
+        pool->setRateLimiter(&dispatcher->rateLimiter);
+    }
+    return pool;
+}
+
+/**
+ * Sends the job and returns true if it is finished, false if it was
+ * deferred for a retry. The job holds a concurrency slot of its
+ * destination, which is given back here.
+ */
+bool SmtpDispatcherWorker::send(SmtpDispatcher::Job *job)
+{
+    QString destination = SmtpDispatcher::destinationOf(job);
+    getPool(job->timeout);
+
+    if (job->attempts++ == 0)
+        job->firstAttempt = QDateTime::currentMSecsSinceEpoch();
+
+    SmtpClient *client = pool->acquire(job->host, job->port, job->connectionType,
+                                       job->user, job->password, job->authMethod);
+    if (!client) {
+        dispatcher->concurrency.release(destination, 0, 0);
+        return retry(job, SmtpRetryScheduler::TransientFailure,
+                     SmtpClient::ConnectionTimeoutError, "Cannot open an SMTP session");
+    }
+
+    failed = false;
+    connect(client, SIGNAL(error(SmtpClient::SmtpError,QString)),
+            this, SLOT(clientError(SmtpClient::SmtpError,QString)));
+
+    bool sent = client->sendMail(*job->message, job->envelope) && client->waitForMailSent(job->timeout) && !failed;
+    SmtpReply reply = client->getLastReply();
+    QList<SmtpRecipientStatus> recipients = client->getRecipientStatuses();
+    qint64 latency = client->getReplyLatency();
+
+    disconnect(client, 0, this, 0);
+    pool->release(client);
+
+    // Timeouts count as lost connections. Only the server's answer to the
+    // commit tells how loaded it is, pacing and the upload do not.
+    dispatcher->concurrency.release(destination, (sent || failed) ? reply.getCode() : 0,
+                                    qMax<qint64>(0, latency));
+
+    if (sent)
+        dispatcher->retryScheduler.recordSuccess(destination);
+
+    // Accepted recipients got the message and rejected ones never will, only
+    // the others are tried again
+    SmtpEnvelope remaining(job->envelope.getSender());
+    SmtpRecipientStatus deferred;
+    foreach (const SmtpRecipientStatus &recipient, recipients) {
+        switch (recipient.getStatus())
+        {
+        case SmtpRecipientStatus::Accepted:
+            job->delivered = true;
+            break;
+        case SmtpRecipientStatus::Rejected:
+            break;
+        case SmtpRecipientStatus::Deferred:
+            if (deferred.getStatus() == SmtpRecipientStatus::Pending)
+                deferred = recipient;
+            // fall through
+        case SmtpRecipientStatus::Pending:
+            remaining.addRecipient(recipient.getAddress(), recipient.getType());
+            break;
+        }
+    }
+
+    // The send did not get as far as the recipients
+    if (recipients.isEmpty())
+        remaining = job->envelope;
+
+    if (remaining.getRecipientCount() == 0) {
+        if (job->delivered)
+            emit mailSent(job->id);
+        else
+            emit mailFailed(job->id, lastError, lastErrorText);
+        return true;
+    }
+
+    job->envelope = remaining;
+
+    if (sent)
+        return retry(job, SmtpRetryScheduler::classify(deferred.getResponseCode(), deferred.getEnhancedCode(),
+                                                       deferred.getResponseText()),
+                     SmtpClient::ServerError, deferred.getResponseText());
+
+    if (!failed)
+        return retry(job, SmtpRetryScheduler::TransientFailure,
+                     SmtpClient::ResponseTimeoutError, "Mail send timeout");
+
+    SmtpRetryScheduler::Failure failure;
+    if (reply.getCode() >= 400)
+        failure = SmtpRetryScheduler::classify(reply);
+    else if (lastError == SmtpClient::MailSendingError)
+        // Refused by the client itself, e.g. over the size limit
+        failure = SmtpRetryScheduler::PermanentFailure;
+    else
+        failure = SmtpRetryScheduler::TransientFailure;
+
+    return retry(job, failure, lastError, lastErrorText);
+}
+
+/**
+ * Reports the failure and defers the job if the scheduler retries it.
+ * Returns true if the job was given up.
+ */
+bool SmtpDispatcherWorker::retry(SmtpDispatcher::Job *job, SmtpRetryScheduler::Failure failure,
+                                 SmtpClient::SmtpError e, const QString &errorText)
+{
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    int delay = dispatcher->retryScheduler.nextDelay(SmtpDispatcher::destinationOf(job),
+                                                     failure, job->attempts, now - job->firstAttempt);
+    if (delay < 0) {
+        emit mailFailed(job->id, e, errorText);
+        return true;
+    }
+
+    job->notBefore = now + delay;
+    dispatcher->deferJob(lane, job);
+    emit mailDeferred(job->id, delay, errorText);
+    return false;
+}
+
+/* [5] --- */
@@ -0,0 +1,191 @@
+#ifndef SMTPDISPATCHER_H
+#define SMTPDISPATCHER_H
+
+#include <QObject>
+#include <QList>
+#include <QMutex>
+#include <QAtomicInt>
+#include <QThread>
+#include "smtpmime_global.h"
+#include "smtpclient.h"
+#include "smtpenvelope.h"
+#include "smtpmpscqueue.h"
+#include "smtpretryscheduler.h"
+#include "smtpratelimiter.h"
+#include "smtpconcurrencycontroller.h"
+
+class SmtpConnectionPool;
+class SmtpDispatcherWorker;
+class QTimer;
+
+/**
+ * @brief Sends messages in parallel on a set of worker threads.
+ *
+ * Every worker runs its own event loop and keeps its own SmtpConnectionPool.
+ * submit() may be called from any thread; it puts the message in the
+ * lock-free inbox of one worker, and workers that run out of work steal
+ * queued messages from the busy ones. The result of each message is
+ * reported with mailSent() or mailFailed() in the dispatcher's thread.
+ *
+ * Failed sends are classified by getRetryScheduler(). Transient failures
+ * are queued again after a backoff and reported with mailDeferred(),
+ * permanent ones (and messages retried for too long) with mailFailed().
+ * Only the recipients without a final answer are retried: accepted ones
+ * are not sent the message again and rejected ones are given up.
+ *
+ * How many workers send to the same server at once is adapted by
+ * getConcurrencyController(). When the queue of a server is expected to
+ * grow, idle workers open their session ahead of time.
+ */
+class SMTP_MIME_EXPORT SmtpDispatcher : public QObject
+{
+    Q_OBJECT
+public:
+
+    /* [1] Constructors and Destructors */
+
+    SmtpDispatcher(int threadCount = 0, QObject *parent = 0);
+    ~SmtpDispatcher();
+
+    /* [1] --- */
+
+
+    /* [2] Getters and Setters */
+
+    void setServer(const QString &host, int port = 25,
+                   SmtpClient::ConnectionType ct = SmtpClient::TcpConnection);
+    void setCredentials(const QString &user, const QString &password,
+                        SmtpClient::AuthMethod method = SmtpClient::AuthLogin);
+
+    int getTimeout() const;
+    void setTimeout(int msec);
+
+    SmtpRetryScheduler *getRetryScheduler();
+    SmtpRateLimiter *getRateLimiter();
+    SmtpConcurrencyController *getConcurrencyController();
+
+    int getThreadCount() const;
+    int getPendingCount() const;
+
+    /* [2] --- */
+
+
+    /* [3] Public methods */
+
+    quint64 submit(MimeMessage *message);
+
+    /* [3] --- */
+
+signals:
+    void mailSent(quint64 id);
+    void mailDeferred(quint64 id, int delay, const QString &errorText);
+    void mailFailed(quint64 id, SmtpClient::SmtpError e, const QString &errorText);
+
+protected:
+
+    struct Job
+    {
+        quint64 id;
+        MimeMessage *message;
+        SmtpEnvelope envelope;
+        bool delivered;
+
+        QString host;
+        int port;
+        SmtpClient::ConnectionType connectionType;
+        QString user;
+        QString password;
+        SmtpClient::AuthMethod authMethod;
+        int timeout;
+
+        int attempts;
+        qint64 firstAttempt;
+        qint64 notBefore;
+    };
+
+    struct Lane
+    {
+        SmtpMpscQueue<Job*> inbox;
+        QList<Job*> jobs;
+        QMutex mutex;
+        QAtomicInt idle;
+        QAtomicInt warming;
+        QThread thread;
+        SmtpDispatcherWorker *worker;
+    };
+
+    /* [4] Protected members */
+
+    QList<Lane*> lanes;
+    QAtomicInt nextLane;
+    QAtomicInt nextId;
+    QAtomicInt pending;
+    QAtomicInt stopping;
+
+    QMutex settingsMutex;
+    Job settings;
+
+    SmtpRetryScheduler retryScheduler;
+    SmtpRateLimiter rateLimiter;
+    SmtpConcurrencyController concurrency;
+
+    /* [4] --- */
+
+
+    /* [5] Protected methods */
+
+    Job *takeJob(int lane, qint64 &nextDue);
+    Job *takeFrom(Lane *lane, bool front, qint64 &nextDue);
+    void deferJob(int lane, Job *job);
+    void wake(Lane *lane);
+    void prewarm(const QString &destination);
+    void finishJob(Job *job);
+
+    static QString destinationOf(const Job *job);
+
+    /* [5] --- */
+
+    friend class SmtpDispatcherWorker;
+};
+
+
+/**
+ * @brief Worker of SmtpDispatcher, lives in one of its threads.
+ */
+class SmtpDispatcherWorker : public QObject
+{
+    Q_OBJECT
+public:
+    SmtpDispatcherWorker(SmtpDispatcher *dispatcher, int lane);
+
+public slots:
+    void process();
+    void prewarm();
+
+signals:
+    void mailSent(quint64 id);
+    void mailDeferred(quint64 id, int delay, const QString &errorText);
+    void mailFailed(quint64 id, SmtpClient::SmtpError e, const QString &errorText);
+
+protected slots:
+    void clientError(SmtpClient::SmtpError e, const QString &errorText);
+    void retryTimeout();
+
+protected:
+    SmtpConnectionPool *getPool(int timeout);
+    bool send(SmtpDispatcher::Job *job);
+    bool retry(SmtpDispatcher::Job *job, SmtpRetryScheduler::Failure failure,
+               SmtpClient::SmtpError e, const QString &errorText);
+
+    SmtpDispatcher *dispatcher;
+    int lane;
+    bool running;
+    SmtpConnectionPool *pool;
+    QTimer *retryTimer;
+
+    bool failed;
+    SmtpClient::SmtpError lastError;
+    QString lastErrorText;
+};
+
+#endif // SMTPDISPATCHER_H
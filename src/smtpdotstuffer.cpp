@@ -0,0 +1,114 @@
+#include "smtpdotstuffer.h"
+
+#include <string.h>
+#include <QtAlgorithms>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * Returns the index of the first '.' at or after from that follows a CRLF,
+ * or len if there is none. from has to be at least 2.
+ */
+static qint64 findLineStartDot(const char *data, qint64 from, qint64 len)
+{
+    qint64 i = from;
+
+#ifdef __SSE2__
+    // Compare 16 positions at once against "\r\n." shifted by 0, 1 and 2
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i dot = _mm_set1_epi8('.');
+
+    for (; i + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i - 2));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i - 1));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i match = _mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(a, cr), _mm_cmpeq_epi8(b, lf)),
+                                      _mm_cmpeq_epi8(c, dot));
+        int mask = _mm_movemask_epi8(match);
+        if (mask)
+            return i + qCountTrailingZeroBits(quint32(mask));
+    }
+#endif
+
+    // memchr() is vectorized by the C library as well
+    while (i < len) {
+        const char *p = static_cast<const char*>(memchr(data + i, '.', len - i));
+        if (!p)
+            return len;
+        i = p - data;
+        if (data[i - 1] == '\n' && data[i - 2] == '\r')
+            return i;
+        ++i;
+    }
+    return len;
+}
+
+SmtpDotStuffer::SmtpDotStuffer(QIODevice *out, QObject *parent) :
+    QIODevice(parent),
+    output(out)
+{
+    reset();
+    QIODevice::open(WriteOnly);
+}
+
+/**
+ * @brief Returns true if the data written so far ends with CRLF (or nothing
+ * was written), so the end-of-data marker only needs ".\r\n".
+ */
+bool SmtpDotStuffer::isAtLineStart() const
+{
+    return tail[0] == '\r' && tail[1] == '\n';
+}
+
+/**
+ * @brief Starts a new body, the first byte is at the start of a line.
+ */
+void SmtpDotStuffer::reset()
+{
+    tail[0] = '\r';
+    tail[1] = '\n';
+}
+
+qint64 SmtpDotStuffer::readData(char*, qint64) {
+    return -1;
+}
+
+qint64 SmtpDotStuffer::writeData(const char *data, qint64 len) {
+    if (len <= 0)
+        return 0;
+
+    qint64 written = 0;
+
+    // The first two bytes may complete a line break of the previous write
+    for (qint64 i = 0; i < len && i < 2; ++i) {
+        char before2 = (i == 0) ? tail[0] : tail[1];
+        char before1 = (i == 0) ? tail[1] : data[0];
+        if (data[i] == '.' && before1 == '\n' && before2 == '\r') {
+            output->write(data + written, i - written);
+            output->write(".", 1);
+            written = i;
+        }
+    }
+
+    qint64 i = 2;
+    while ((i = findLineStartDot(data, i, len)) < len) {
+        output->write(data + written, i - written);
+        output->write(".", 1);
+        written = i;
+        ++i;
+    }
+    output->write(data + written, len - written);
+
+    if (len >= 2) {
+        tail[0] = data[len - 2];
+        tail[1] = data[len - 1];
+    } else {
+        tail[0] = tail[1];
+        tail[1] = data[0];
+    }
+
+    return len;
+}
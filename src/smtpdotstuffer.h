@@ -0,0 +1,32 @@
+#ifndef SMTPDOTSTUFFER_H
+#define SMTPDOTSTUFFER_H
+
+#include <QIODevice>
+#include "smtpmime_global.h"
+
+/**
+ * @brief Write-only filter that dot-stuffs a message body (RFC 5321,
+ * section 4.5.2) while streaming it to the output device.
+ *
+ * Every line starting with '.' gets an additional leading dot. Line starts
+ * are searched with SSE2 where available, and line breaks split between two
+ * writes are handled, so the body never has to be buffered.
+ */
+class SMTP_MIME_EXPORT SmtpDotStuffer : public QIODevice
+{
+    Q_OBJECT
+public:
+    SmtpDotStuffer(QIODevice *output, QObject *parent = 0);
+
+    bool isAtLineStart() const;
+    void reset();
+
+protected:
+    qint64 readData(char *data, qint64 maxlen);
+    qint64 writeData(const char *data, qint64 len);
+
+    QIODevice *output;
+    char tail[2];
+};
+
+#endif // SMTPDOTSTUFFER_H
@@ -0,0 +1,83 @@
+#include "smtpenvelope.h"
+
+/* [1] Constructors and Destructors */
+
+SmtpEnvelope::SmtpEnvelope()
+{
+}
+
+SmtpEnvelope::SmtpEnvelope(const EmailAddress &sender, const QList<EmailAddress> &recipients) :
+    sender(sender)
+{
+    foreach (const EmailAddress &rcpt, recipients)
+        addRecipient(rcpt);
+}
+
+SmtpEnvelope::~SmtpEnvelope()
+{
+}
+
+/**
+ * @brief Returns the envelope of the message: its sender and every To, Cc
+ * and Bcc recipient.
+ */
+SmtpEnvelope SmtpEnvelope::fromMessage(const MimeMessage &message)
+{
+    SmtpEnvelope envelope;
+    envelope.setSender(message.getSender());
+
+    const MimeMessage::RecipientType types[] = { MimeMessage::To, MimeMessage::Cc, MimeMessage::Bcc };
+    for (int i = 0; i < 3; ++i) {
+        foreach (const EmailAddress &rcpt, message.getRecipients(types[i]))
+            envelope.addRecipient(rcpt, types[i]);
+    }
+    return envelope;
+}
+
+/* [1] --- */
+
+
+/* [2] Getters and Setters */
+
+void SmtpEnvelope::setSender(const EmailAddress &sender)
+{
+    this->sender = sender;
+}
+
+EmailAddress SmtpEnvelope::getSender() const
+{
+    return sender;
+}
+
+/**
+ * @brief Adds a recipient. The type is only kept to report per-recipient
+ * results, the server does not see it.
+ */
+void SmtpEnvelope::addRecipient(const EmailAddress &rcpt, MimeMessage::RecipientType type)
+{
+    recipients << rcpt;
+    types << type;
+}
+
+void SmtpEnvelope::clearRecipients()
+{
+    recipients.clear();
+    types.clear();
+}
+
+const QList<EmailAddress> &SmtpEnvelope::getRecipients() const
+{
+    return recipients;
+}
+
+MimeMessage::RecipientType SmtpEnvelope::getRecipientType(int index) const
+{
+    return types.value(index, MimeMessage::To);
+}
+
+int SmtpEnvelope::getRecipientCount() const
+{
+    return recipients.size();
+}
+
+/* [2] --- */
@@ -0,0 +1,56 @@
+#ifndef SMTPENVELOPE_H
+#define SMTPENVELOPE_H
+
+#include <QList>
+#include "smtpmime_global.h"
+#include "emailaddress.h"
+#include "mimemessage.h"
+
+/**
+ * @brief The SMTP envelope of a message: the reverse path of MAIL FROM and
+ * the recipients of RCPT TO.
+ *
+ * The envelope is what the server delivers to, independently of the From,
+ * To and Cc headers. It is taken from a MimeMessage, or given together with
+ * an already serialized message to SmtpClient::sendMail().
+ */
+class SMTP_MIME_EXPORT SmtpEnvelope
+{
+public:
+
+    /* [1] Constructors and Destructors */
+
+    SmtpEnvelope();
+    SmtpEnvelope(const EmailAddress &sender, const QList<EmailAddress> &recipients = QList<EmailAddress>());
+    ~SmtpEnvelope();
+
+    static SmtpEnvelope fromMessage(const MimeMessage &message);
+
+    /* [1] --- */
+
+
+    /* [2] Getters and Setters */
+
+    void setSender(const EmailAddress &sender);
+    EmailAddress getSender() const;
+
+    void addRecipient(const EmailAddress &rcpt, MimeMessage::RecipientType type = MimeMessage::To);
+    void clearRecipients();
+    const QList<EmailAddress> &getRecipients() const;
+    MimeMessage::RecipientType getRecipientType(int index) const;
+    int getRecipientCount() const;
+
+    /* [2] --- */
+
+private:
+
+    /* [3] Private members */
+
+    EmailAddress sender;
+    QList<EmailAddress> recipients;
+    QList<MimeMessage::RecipientType> types;
+
+    /* [3] --- */
+};
+
+#endif // SMTPENVELOPE_H
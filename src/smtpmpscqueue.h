@@ -0,0 +1,99 @@
+#ifndef SMTPMPSCQUEUE_H
+#define SMTPMPSCQUEUE_H
+
+#include <QAtomicPointer>
+
+/**
+ * @brief Unbounded lock-free multi-producer, single-consumer queue
+ * (intrusive MPSC queue by D. Vyukov).
+ *
+ * enqueue() may be called from any thread. dequeue() must not be called
+ * concurrently, the consumers have to serialize it (e.g. with a mutex that
+ * producers never take).
+ */
+template <typename T>
+class SmtpMpscQueue
+{
+public:
+    SmtpMpscQueue() :
+        head(&stub),
+        tail(&stub)
+    {
+    }
+
+    ~SmtpMpscQueue()
+    {
+        T value;
+        while (dequeue(value))
+            ;
+    }
+
+    void enqueue(const T &value)
+    {
+        push(new Node(value));
+    }
+
+    bool dequeue(T &value)
+    {
+        Node *last = tail;
+        Node *next = last->next.loadAcquire();
+
+        // Skip the stub node
+        if (last == &stub) {
+            if (!next)
+                return false;
+            tail = next;
+            last = next;
+            next = next->next.loadAcquire();
+        }
+
+        if (next) {
+            tail = next;
+            value = last->value;
+            delete last;
+            return true;
+        }
+
+        // A producer is between exchanging the head and linking its node
+        if (last != head.loadAcquire())
+            return false;
+
+        // last is the only node, put the stub behind it so it can be taken
+        stub.next.storeRelease(0);
+        push(&stub);
+
+        next = last->next.loadAcquire();
+        if (next) {
+            tail = next;
+            value = last->value;
+            delete last;
+            return true;
+        }
+
+        return false;
+    }
+
+private:
+    struct Node
+    {
+        Node(const T &v = T()) : next(0), value(v) {}
+
+        QAtomicPointer<Node> next;
+        T value;
+    };
+
+    void push(Node *node)
+    {
+        node->next.storeRelease(0);
+        Node *prev = head.fetchAndStoreOrdered(node);
+        prev->next.storeRelease(node);
+    }
+
+    QAtomicPointer<Node> head;
+    Node *tail;
+    Node stub;
+
+    Q_DISABLE_COPY(SmtpMpscQueue)
+};
+
+#endif // SMTPMPSCQUEUE_H
@@ -0,0 +1,400 @@
+#include "smtpmxdelivery.h"
+
+#include <QBuffer>
+#include <QDateTime>
+#include <QEventLoop>
+#include <QTimer>
+#include "smtpresolver.h"
+#include "smtpconnector.h"
+#include "smtpreplyparser.h"
+
+/* [1] Constructors and Destructors */
+
+SmtpMxDelivery::SmtpMxDelivery(QObject *parent) :
+    QObject(parent),
+    resolver(0),
+    dnsResolver(0),
+    name("localhost"),
+    port(25),
+    connectionType(SmtpClient::TcpConnection),
+    timeout(30000),
+    remaining(0)
+{
+}
+
+SmtpMxDelivery::~SmtpMxDelivery()
+{
+    // The futures of the groups are not waited for
+    foreach (SmtpClient *client, connections)
+        delete client;
+}
+
+/* [1] --- */
+
+
+/* [2] Getters and Setters */
+
+SmtpResolver *SmtpMxDelivery::getResolver() const
+{
+    return resolver;
+}
+
+/**
+ * @brief Sets the resolver of the MX records and of the mail exchangers'
+ * addresses. The resolver is not owned; null selects an SmtpDnsResolver.
+ */
+void SmtpMxDelivery::setResolver(SmtpResolver *resolver)
+{
+    if (this->resolver)
+        disconnect(this->resolver, 0, this, 0);
+
+    this->resolver = resolver;
+
+    if (resolver) {
+        connect(resolver, SIGNAL(mxFound(QString,QStringList,int)),
+                this, SLOT(mxFound(QString,QStringList,int)));
+        connect(resolver, SIGNAL(mxFailed(QString,QString)),
+                this, SLOT(mxFailed(QString,QString)));
+    }
+}
+
+QString SmtpMxDelivery::getName() const
+{
+    return name;
+}
+
+/**
+ * @brief Sets the name sent with EHLO. Mail exchangers often check that it
+ * resolves to the sending address.
+ */
+void SmtpMxDelivery::setName(const QString &name)
+{
+    this->name = name;
+}
+
+int SmtpMxDelivery::getPort() const
+{
+    return port;
+}
+
+void SmtpMxDelivery::setPort(int port)
+{
+    this->port = port;
+}
+
+SmtpClient::ConnectionType SmtpMxDelivery::getConnectionType() const
+{
+    return connectionType;
+}
+
+void SmtpMxDelivery::setConnectionType(SmtpClient::ConnectionType ct)
+{
+    this->connectionType = ct;
+}
+
+int SmtpMxDelivery::getTimeout() const
+{
+    return timeout;
+}
+
+/**
+ * @brief Sets the timeout (in milliseconds) of connecting to and sending
+ * to one mail exchanger.
+ */
+void SmtpMxDelivery::setTimeout(int msec)
+{
+    this->timeout = msec;
+}
+
+bool SmtpMxDelivery::isFinished() const
+{
+    return remaining == 0;
+}
+
+/**
+ * @brief Returns the answer to every recipient of the last delivery,
+ * grouped by domain. Recipients of a domain that could not be reached are
+ * Pending.
+ */
+const QList<SmtpRecipientStatus> &SmtpMxDelivery::getRecipientStatuses() const
+{
+    return recipientStatuses;
+}
+
+/* [2] --- */
+
+
+/* [3] Public methods */
+
+/**
+ * @brief Serializes the message once and delivers it to all of its
+ * recipients. The message may be deleted as soon as this returns.
+ */
+bool SmtpMxDelivery::deliver(MimeMessage &message)
+{
+    QBuffer buffer;
+    buffer.open(QIODevice::WriteOnly);
+    message.writeToDevice(buffer);
+
+    return deliver(SmtpEnvelope::fromMessage(message), buffer.data());
+}
+
+/**
+ * @brief Delivers an already serialized message to the recipients of the
+ * envelope. Returns false if a delivery is still running.
+ */
+bool SmtpMxDelivery::deliver(const SmtpEnvelope &envelope, const QByteArray &data)
+{
+    if (remaining > 0)
+        return false;
+
+    if (!resolver) {
+        if (!dnsResolver)
+            dnsResolver = new SmtpDnsResolver(this);
+        setResolver(dnsResolver);
+    }
+
+    this->data = data;
+    recipientStatuses.clear();
+
+    foreach (const Group &group, groups)
+        delete group.watcher;
+    groups.clear();
+
+    QHash<QString, int> byDomain;
+    for (int i = 0; i < envelope.getRecipientCount(); ++i) {
+        const EmailAddress &rcpt = envelope.getRecipients().at(i);
+        QString domain = domainOf(rcpt);
+
+        if (!byDomain.contains(domain)) {
+            Group group;
+            group.domain = domain;
+            group.envelope.setSender(envelope.getSender());
+            group.host = -1;
+            group.done = false;
+            group.watcher = 0;
+            byDomain.insert(domain, groups.size());
+            groups << group;
+        }
+        groups[byDomain.value(domain)].envelope.addRecipient(rcpt, envelope.getRecipientType(i));
+    }
+
+    remaining = groups.size();
+    if (remaining == 0) {
+        emit finished();
+        return true;
+    }
+
+    qint64 now = QDateTime::currentMSecsSinceEpoch();
+    for (int i = 0; i < groups.size(); ++i) {
+        QString domain = groups.at(i).domain;
+        QHash<QString, MxEntry>::const_iterator it = mxCache.constFind(domain);
+
+        if (it != mxCache.constEnd() && it.value().expires > now)
+            mxFound(domain, it.value().hosts, 0);
+        else if (groups.at(i).host < 0 && !groups.at(i).done)
+            resolver->lookupMx(domain);
+    }
+
+    return true;
+}
+
+bool SmtpMxDelivery::waitForFinished(int msec)
+{
+    if (remaining == 0)
+        return true;
+
+    QEventLoop loop;
+    connect(this, SIGNAL(finished()), &loop, SLOT(quit()));
+
+    QTimer timer;
+    timer.setSingleShot(true);
+    connect(&timer, SIGNAL(timeout()), &loop, SLOT(quit()));
+    timer.start(msec);
+
+    loop.exec();
+    return remaining == 0;
+}
+
+/**
+ * @brief Closes the connections kept for the domains.
+ */
+void SmtpMxDelivery::closeConnections()
+{
+    foreach (const QString &domain, connections.keys())
+        dropConnection(domain);
+}
+
+QString SmtpMxDelivery::domainOf(const EmailAddress &address)
+{
+    QString mailbox = address.getAddress();
+    return mailbox.mid(mailbox.lastIndexOf('@') + 1).toLower();
+}
+
+/* [3] --- */
+
+
+/* [4] Protected slots */
+
+void SmtpMxDelivery::mxFound(const QString &domain, const QStringList &hosts, int ttl)
+{
+    if (ttl > 0) {
+        MxEntry entry;
+        entry.hosts = hosts;
+        entry.expires = QDateTime::currentMSecsSinceEpoch() + qint64(ttl) * 1000;
+        mxCache.insert(domain, entry);
+    }
+
+    for (int i = 0; i < groups.size(); ++i) {
+        Group &group = groups[i];
+        if (group.domain != domain || group.host >= 0 || group.done)
+            continue;
+
+        // Null MX or NXDOMAIN: the recipients are rejected for good, with
+        // the reply RFC 7505 suggests
+        if (hosts.isEmpty()) {
+            QByteArray text = "556 5.1.10 Domain " + domain.toUtf8() + " does not accept mail\r\n";
+            SmtpReplyParser parser;
+            SmtpReply reply;
+            parser.append(text.constData(), text.size());
+            parser.next(reply);
+
+            QList<SmtpRecipientStatus> recipients;
+            for (int j = 0; j < group.envelope.getRecipientCount(); ++j) {
+                recipients << SmtpRecipientStatus(group.envelope.getRecipients().at(j),
+                                                  group.envelope.getRecipientType(j));
+                recipients.last().setReply(reply);
+            }
+
+            SmtpResult result(false, reply.getCode(), reply.getText(), SmtpClient::ClientError,
+                              "No mail exchanger for " + domain);
+            result.setRecipients(recipients);
+            finishGroup(i, result);
+            continue;
+        }
+
+        group.hosts = hosts;
+        group.host = 0;
+        startGroup(i);
+    }
+}
+
+/**
+ * The lookup failed for now (SERVFAIL, timeout): the recipients stay
+ * Pending and can be retried later.
+ */
+void SmtpMxDelivery::mxFailed(const QString &domain, const QString &errorText)
+{
+    for (int i = 0; i < groups.size(); ++i) {
+        const Group &group = groups.at(i);
+        if (group.domain != domain || group.host >= 0 || group.done)
+            continue;
+
+        finishGroup(i, SmtpResult(false, 0, "", SmtpClient::ConnectionTimeoutError,
+                                  "MX lookup for " + domain + " failed: " + errorText));
+    }
+}
+
+void SmtpMxDelivery::groupFinished()
+{
+    QFutureWatcher<SmtpResult> *watcher = static_cast<QFutureWatcher<SmtpResult>*>(sender());
+
+    for (int i = 0; i < groups.size(); ++i) {
+        Group &group = groups[i];
+        if (group.watcher != watcher || group.done)
+            continue;
+
+        SmtpResult result = watcher->result();
+
+        bool answered = false;
+        foreach (const SmtpRecipientStatus &recipient, result.getRecipients())
+            answered |= (recipient.getStatus() != SmtpRecipientStatus::Pending);
+
+        // Another mail exchanger may take the message if this one could not
+        // be reached or deferred the whole transaction (RFC 5321, 5.1)
+        if (!result.isSuccess() && !answered && result.getResponseCode() / 100 != 5
+                && group.host + 1 < group.hosts.size()) {
+            dropConnection(group.domain);
+            group.host++;
+            startGroup(i);
+            return;
+        }
+
+        finishGroup(i, result);
+        return;
+    }
+}
+
+/* [4] --- */
+
+
+/* [5] Protected methods */
+
+void SmtpMxDelivery::startGroup(int index)
+{
+    Group &group = groups[index];
+    QString host = group.hosts.at(group.host);
+
+    // A kept connection is reused if it is still ready and goes to the
+    // same mail exchanger
+    SmtpClient *client = connections.value(group.domain);
+    if (client && (client->getHost() != host || client->getState() != SmtpClient::ReadyState
+                   || client->getSocket()->state() != QAbstractSocket::ConnectedState)) {
+        dropConnection(group.domain);
+        client = 0;
+    }
+
+    if (!client) {
+        client = new SmtpClient(host, port, connectionType);
+        client->setParent(this);
+        client->setName(name);
+        client->getConnector()->setResolver(resolver);
+        connections.insert(group.domain, client);
+        client->connectToHostAsync(timeout);
+    }
+
+    if (!group.watcher) {
+        group.watcher = new QFutureWatcher<SmtpResult>(this);
+        connect(group.watcher, SIGNAL(finished()), this, SLOT(groupFinished()));
+    }
+    group.watcher->setFuture(client->sendMailAsync(group.envelope, data, timeout));
+}
+
+void SmtpMxDelivery::finishGroup(int index, const SmtpResult &result)
+{
+    Group &group = groups[index];
+    group.done = true;
+    group.result = result;
+    remaining--;
+
+    emit domainFinished(group.domain, result);
+
+    if (remaining > 0)
+        return;
+
+    foreach (const Group &finished, groups) {
+        if (!finished.result.getRecipients().isEmpty()) {
+            recipientStatuses << finished.result.getRecipients();
+            continue;
+        }
+        for (int i = 0; i < finished.envelope.getRecipientCount(); ++i)
+            recipientStatuses << SmtpRecipientStatus(finished.envelope.getRecipients().at(i),
+                                                     finished.envelope.getRecipientType(i));
+    }
+
+    data.clear();
+    emit finished();
+}
+
+void SmtpMxDelivery::dropConnection(const QString &domain)
+{
+    SmtpClient *client = connections.take(domain);
+    if (!client)
+        return;
+
+    if (client->getState() == SmtpClient::ReadyState)
+        client->quit();
+    client->deleteLater();
+}
+
+/* [5] --- */
@@ -0,0 +1,143 @@
+#ifndef SMTPMXDELIVERY_H
+#define SMTPMXDELIVERY_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QStringList>
+#include <QFutureWatcher>
+#include "smtpmime_global.h"
+#include "smtpclient.h"
+#include "smtpenvelope.h"
+
+class SmtpResolver;
+class SmtpDnsResolver;
+
+/**
+ * @brief Delivers a message straight to the mail exchangers of its
+ * recipients' domains, without a relay.
+ *
+ * The recipients are grouped by domain and the MX records of every domain
+ * are looked up (and cached for their TTL). The groups are then sent in
+ * parallel, each on its own connection, which is kept per domain for the
+ * next message. The message is serialized once and the same bytes are
+ * sent to every domain. If a mail exchanger cannot be reached, or refuses
+ * the transaction with a 4xx reply before any recipient was answered, the
+ * next one is tried. Recipients of a domain without mail exchangers (null
+ * MX, NXDOMAIN) are rejected with 556 5.1.10, those of a domain whose
+ * lookup failed stay Pending.
+ *
+ * domainFinished() reports the result of each domain, finished() the end
+ * of the delivery; getRecipientStatuses() then holds the answer to every
+ * recipient.
+ */
+class SMTP_MIME_EXPORT SmtpMxDelivery : public QObject
+{
+    Q_OBJECT
+public:
+
+    /* [1] Constructors and Destructors */
+
+    SmtpMxDelivery(QObject *parent = 0);
+    ~SmtpMxDelivery();
+
+    /* [1] --- */
+
+
+    /* [2] Getters and Setters */
+
+    SmtpResolver *getResolver() const;
+    void setResolver(SmtpResolver *resolver);
+
+    QString getName() const;
+    void setName(const QString &name);
+
+    int getPort() const;
+    void setPort(int port);
+
+    SmtpClient::ConnectionType getConnectionType() const;
+    void setConnectionType(SmtpClient::ConnectionType ct);
+
+    int getTimeout() const;
+    void setTimeout(int msec);
+
+    bool isFinished() const;
+    const QList<SmtpRecipientStatus> &getRecipientStatuses() const;
+
+    /* [2] --- */
+
+
+    /* [3] Public methods */
+
+    bool deliver(MimeMessage &message);
+    bool deliver(const SmtpEnvelope &envelope, const QByteArray &data);
+    bool waitForFinished(int msec = 30000);
+    void closeConnections();
+
+    static QString domainOf(const EmailAddress &address);
+
+    /* [3] --- */
+
+signals:
+    void domainFinished(const QString &domain, const SmtpResult &result);
+    void finished();
+
+protected slots:
+
+    /* [4] Protected slots */
+
+    void mxFound(const QString &domain, const QStringList &hosts, int ttl);
+    void mxFailed(const QString &domain, const QString &errorText);
+    void groupFinished();
+
+    /* [4] --- */
+
+protected:
+
+    struct Group
+    {
+        QString domain;
+        SmtpEnvelope envelope;
+        QStringList hosts;
+        int host;
+        bool done;
+        SmtpResult result;
+        QFutureWatcher<SmtpResult> *watcher;
+    };
+
+    struct MxEntry
+    {
+        QStringList hosts;
+        qint64 expires;
+    };
+
+    /* [5] Protected members */
+
+    SmtpResolver *resolver;
+    SmtpDnsResolver *dnsResolver;
+    QString name;
+    int port;
+    SmtpClient::ConnectionType connectionType;
+    int timeout;
+
+    QByteArray data;
+    QList<Group> groups;
+    int remaining;
+    QList<SmtpRecipientStatus> recipientStatuses;
+
+    QHash<QString, SmtpClient*> connections;
+    QHash<QString, MxEntry> mxCache;
+
+    /* [5] --- */
+
+
+    /* [6] Protected methods */
+
+    void startGroup(int index);
+    void finishGroup(int index, const SmtpResult &result);
+    void dropConnection(const QString &domain);
+
+    /* [6] --- */
+};
+
+#endif // SMTPMXDELIVERY_H
@@ -0,0 +1,146 @@
+#include "smtpratelimiter.h"
+
+#include <QMutexLocker>
+#include <qmath.h>
+
+/* [1] Constructors and Destructors */
+
+SmtpRateLimiter::SmtpRateLimiter()
+{
+    for (int i = 0; i <= Connections; ++i) {
+        rates[i] = 0;
+        bursts[i] = 1;
+    }
+    clock.start();
+}
+
+SmtpRateLimiter::~SmtpRateLimiter()
+{
+}
+
+/* [1] --- */
+
+
+/* [2] Getters and Setters */
+
+double SmtpRateLimiter::getMessageRate() const
+{
+    QMutexLocker locker(&mutex);
+    return rates[Messages];
+}
+
+/**
+ * @brief Sets how many messages per second may be sent to a relay by a
+ * user, and how many may go out at once after a pause.
+ */
+void SmtpRateLimiter::setMessageRate(double perSecond, int burst)
+{
+    setRate(Messages, perSecond, burst);
+}
+
+double SmtpRateLimiter::getRecipientRate() const
+{
+    QMutexLocker locker(&mutex);
+    return rates[Recipients];
+}
+
+/**
+ * @brief Sets how many recipients per second may be sent to a relay by a
+ * user. A message takes one token per recipient of its envelope.
+ */
+void SmtpRateLimiter::setRecipientRate(double perSecond, int burst)
+{
+    setRate(Recipients, perSecond, burst);
+}
+
+/**
+ * @brief Returns the connection rate, in connections per minute.
+ */
+double SmtpRateLimiter::getConnectionRate() const
+{
+    QMutexLocker locker(&mutex);
+    return rates[Connections] * 60;
+}
+
+/**
+ * @brief Sets how many new connections per minute may be opened to a relay
+ * for a user.
+ */
+void SmtpRateLimiter::setConnectionRate(double perMinute, int burst)
+{
+    setRate(Connections, perMinute / 60, burst);
+}
+
+int SmtpRateLimiter::getBurst(Resource resource) const
+{
+    QMutexLocker locker(&mutex);
+    return bursts[resource];
+}
+
+/* [2] --- */
+
+
+/* [3] Public methods */
+
+/**
+ * @brief Takes count tokens from the bucket of the key and returns how long
+ * (in milliseconds) to wait before using them, 0 if they may be used now.
+ */
+int SmtpRateLimiter::reserve(const QString &key, Resource resource, int count)
+{
+    QMutexLocker locker(&mutex);
+
+    double rate = rates[resource];
+    if (rate <= 0)
+        return 0;
+
+    qint64 now = clock.elapsed();
+
+    QHash<QString, Bucket>::iterator it = buckets[resource].find(key);
+    if (it == buckets[resource].end()) {
+        Bucket bucket;
+        bucket.tokens = bursts[resource];
+        bucket.updated = now;
+        it = buckets[resource].insert(key, bucket);
+    }
+
+    Bucket &bucket = it.value();
+    bucket.tokens = qMin<double>(bursts[resource], bucket.tokens + (now - bucket.updated) * rate / 1000);
+    bucket.updated = now;
+    bucket.tokens -= count;
+
+    if (bucket.tokens >= 0)
+        return 0;
+
+    return int(qCeil(-bucket.tokens * 1000 / rate));
+}
+
+/**
+ * @brief Forgets every bucket, they start full again.
+ */
+void SmtpRateLimiter::clear()
+{
+    QMutexLocker locker(&mutex);
+    for (int i = 0; i <= Connections; ++i)
+        buckets[i].clear();
+}
+
+QString SmtpRateLimiter::makeKey(const QString &host, const QString &user)
+{
+    return host.toLower() + "/" + user;
+}
+
+/* [3] --- */
+
+
+/* [4] Protected methods */
+
+void SmtpRateLimiter::setRate(Resource resource, double perSecond, int burst)
+{
+    QMutexLocker locker(&mutex);
+    rates[resource] = qMax(0.0, perSecond);
+    bursts[resource] = qMax(1, burst);
+    buckets[resource].clear();
+}
+
+/* [4] --- */
@@ -0,0 +1,94 @@
+#ifndef SMTPRATELIMITER_H
+#define SMTPRATELIMITER_H
+
+#include <QString>
+#include <QHash>
+#include <QMutex>
+#include <QElapsedTimer>
+#include "smtpmime_global.h"
+
+/**
+ * @brief Token buckets pacing messages, recipients and new connections.
+ *
+ * Every relay host and authenticated user has its own buckets. A bucket
+ * holds up to its burst of tokens and refills at its rate; reserve() takes
+ * tokens and returns how long the caller has to wait until they are
+ * covered. Tokens may be taken ahead (the bucket goes into debt), so
+ * concurrent senders queue up behind each other instead of all waking up
+ * at the same time.
+ *
+ * SmtpClient delays connecting and sending on its own when it is given a
+ * limiter with SmtpClient::setRateLimiter(). A rate of 0 does not limit.
+ * The limiter can be shared between threads.
+ */
+class SMTP_MIME_EXPORT SmtpRateLimiter
+{
+public:
+
+    enum Resource
+    {
+        Messages,
+        Recipients,
+        Connections
+    };
+
+    /* [1] Constructors and Destructors */
+
+    SmtpRateLimiter();
+    ~SmtpRateLimiter();
+
+    /* [1] --- */
+
+
+    /* [2] Getters and Setters */
+
+    double getMessageRate() const;
+    void setMessageRate(double perSecond, int burst = 1);
+
+    double getRecipientRate() const;
+    void setRecipientRate(double perSecond, int burst = 1);
+
+    double getConnectionRate() const;
+    void setConnectionRate(double perMinute, int burst = 1);
+
+    int getBurst(Resource resource) const;
+
+    /* [2] --- */
+
+
+    /* [3] Public methods */
+
+    int reserve(const QString &key, Resource resource, int count = 1);
+    void clear();
+
+    static QString makeKey(const QString &host, const QString &user = "");
+
+    /* [3] --- */
+
+protected:
+
+    struct Bucket
+    {
+        double tokens;
+        qint64 updated;
+    };
+
+    /* [4] Protected members */
+
+    mutable QMutex mutex;
+    QElapsedTimer clock;
+    QHash<QString, Bucket> buckets[Connections + 1];
+    double rates[Connections + 1];
+    int bursts[Connections + 1];
+
+    /* [4] --- */
+
+
+    /* [5] Protected methods */
+
+    void setRate(Resource resource, double perSecond, int burst);
+
+    /* [5] --- */
+};
+
+#endif // SMTPRATELIMITER_H
@@ -0,0 +1,103 @@
+#include "smtprecipientstatus.h"
+#include "smtpreplyparser.h"
+
+/* [1] Constructors and Destructors */
+
+SmtpRecipientStatus::SmtpRecipientStatus() :
+    type(MimeMessage::To),
+    status(Pending),
+    responseCode(0)
+{
+}
+
+SmtpRecipientStatus::SmtpRecipientStatus(const EmailAddress &address, MimeMessage::RecipientType type) :
+    address(address),
+    type(type),
+    status(Pending),
+    responseCode(0)
+{
+}
+
+SmtpRecipientStatus::~SmtpRecipientStatus()
+{
+}
+
+/* [1] --- */
+
+
+/* [2] Getters and Setters */
+
+EmailAddress SmtpRecipientStatus::getAddress() const
+{
+    return address;
+}
+
+MimeMessage::RecipientType SmtpRecipientStatus::getType() const
+{
+    return type;
+}
+
+SmtpRecipientStatus::Status SmtpRecipientStatus::getStatus() const
+{
+    return status;
+}
+
+bool SmtpRecipientStatus::isAccepted() const
+{
+    return status == Accepted;
+}
+
+int SmtpRecipientStatus::getResponseCode() const
+{
+    return responseCode;
+}
+
+/**
+ * @brief Returns the enhanced status code (RFC 3463) of the reply, e.g.
+ * "5.1.1", or an empty string if the server did not send one.
+ */
+QString SmtpRecipientStatus::getEnhancedCode() const
+{
+    return enhancedCode;
+}
+
+QString SmtpRecipientStatus::getResponseText() const
+{
+    return responseText;
+}
+
+/**
+ * @brief Sets the status from the server's reply to RCPT TO.
+ */
+void SmtpRecipientStatus::setReply(const SmtpReply &reply)
+{
+    responseCode = reply.getCode();
+    enhancedCode = reply.getEnhancedCode();
+    responseText = reply.getText();
+
+    switch (responseCode / 100)
+    {
+    case 2:
+        status = Accepted;
+        break;
+    case 4:
+        status = Deferred;
+        break;
+    default:
+        status = Rejected;
+    }
+}
+
+/**
+ * @brief Makes the recipient Pending again, e.g. when the transaction that
+ * accepted it did not commit.
+ */
+void SmtpRecipientStatus::reset()
+{
+    status = Pending;
+    responseCode = 0;
+    enhancedCode.clear();
+    responseText.clear();
+}
+
+/* [2] --- */
@@ -0,0 +1,69 @@
+#ifndef SMTPRECIPIENTSTATUS_H
+#define SMTPRECIPIENTSTATUS_H
+
+#include <QString>
+#include "smtpmime_global.h"
+#include "emailaddress.h"
+#include "mimemessage.h"
+
+class SmtpReply;
+
+/**
+ * @brief The server's answer to the RCPT TO command of one recipient.
+ *
+ * A 2xx reply accepts the recipient, 4xx defers it (it may be retried
+ * later) and 5xx rejects it. Recipients not answered yet are Pending.
+ */
+class SMTP_MIME_EXPORT SmtpRecipientStatus
+{
+public:
+
+    enum Status
+    {
+        Pending,
+        Accepted,
+        Deferred,
+        Rejected
+    };
+
+    /* [1] Constructors and Destructors */
+
+    SmtpRecipientStatus();
+    SmtpRecipientStatus(const EmailAddress &address, MimeMessage::RecipientType type);
+    ~SmtpRecipientStatus();
+
+    /* [1] --- */
+
+
+    /* [2] Getters and Setters */
+
+    EmailAddress getAddress() const;
+    MimeMessage::RecipientType getType() const;
+
+    Status getStatus() const;
+    bool isAccepted() const;
+
+    int getResponseCode() const;
+    QString getEnhancedCode() const;
+    QString getResponseText() const;
+
+    void setReply(const SmtpReply &reply);
+    void reset();
+
+    /* [2] --- */
+
+private:
+
+    /* [3] Private members */
+
+    EmailAddress address;
+    MimeMessage::RecipientType type;
+    Status status;
+    int responseCode;
+    QString enhancedCode;
+    QString responseText;
+
+    /* [3] --- */
+};
+
+#endif // SMTPRECIPIENTSTATUS_H
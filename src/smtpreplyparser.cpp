@@ -0,0 +1,264 @@
+#include "smtpreplyparser.h"
+
+#include <string.h>
+#include <QIODevice>
+
+static const int MIN_BUFFER_SIZE = 4096;
+
+/**
+ * Parses an enhanced status code ("class.subject.detail", RFC 3463) at the
+ * start of the text of a reply line.
+ */
+static bool parseEnhancedCode(const char *p, const char *end, int values[3])
+{
+    for (int i = 0; i < 3; ++i) {
+        int digits = 0;
+        int value = 0;
+
+        while (p < end && *p >= '0' && *p <= '9' && digits < 3) {
+            value = value * 10 + (*p - '0');
+            ++p;
+            ++digits;
+        }
+
+        if (digits == 0)
+            return false;
+        values[i] = value;
+
+        if (i < 2) {
+            if (p >= end || *p != '.')
+                return false;
+            ++p;
+        }
+    }
+
+    if (p < end && *p != ' ')
+        return false;
+
+    return values[0] == 2 || values[0] == 4 || values[0] == 5;
+}
+
+/* [1] Reply */
+
+SmtpReply::SmtpReply() :
+    size(0),
+    lines(0),
+    code(0),
+    enhancedClass(0),
+    enhancedSubject(0),
+    enhancedDetail(0)
+{
+}
+
+SmtpReply::~SmtpReply()
+{
+}
+
+bool SmtpReply::isValid() const
+{
+    return lines > 0;
+}
+
+/**
+ * @brief Returns the three digit reply code, or 0 if the reply was
+ * malformed.
+ */
+int SmtpReply::getCode() const
+{
+    return code;
+}
+
+int SmtpReply::getLineCount() const
+{
+    return lines;
+}
+
+bool SmtpReply::hasEnhancedCode() const
+{
+    return enhancedClass != 0;
+}
+
+int SmtpReply::getEnhancedClass() const
+{
+    return enhancedClass;
+}
+
+int SmtpReply::getEnhancedSubject() const
+{
+    return enhancedSubject;
+}
+
+int SmtpReply::getEnhancedDetail() const
+{
+    return enhancedDetail;
+}
+
+/**
+ * @brief Returns the enhanced status code as text (e.g. "5.1.1"), or an
+ * empty string if the reply has none.
+ */
+QString SmtpReply::getEnhancedCode() const
+{
+    if (!hasEnhancedCode())
+        return QString();
+
+    return QString("%1.%2.%3").arg(enhancedClass).arg(enhancedSubject).arg(enhancedDetail);
+}
+
+/**
+ * @brief Returns the raw bytes of the reply, with every line including its
+ * reply code and CRLF.
+ */
+const char *SmtpReply::getData() const
+{
+    return buffer.constData();
+}
+
+int SmtpReply::getSize() const
+{
+    return size;
+}
+
+QByteArray SmtpReply::toByteArray() const
+{
+    return QByteArray(getData(), size);
+}
+
+/**
+ * @brief Returns the complete reply as text.
+ */
+QString SmtpReply::getText() const
+{
+    return QString::fromUtf8(getData(), size);
+}
+
+/* [1] --- */
+
+
+/* [2] Parser */
+
+SmtpReplyParser::SmtpReplyParser() :
+    start(0),
+    lineStart(0),
+    end(0),
+    lines(0)
+{
+}
+
+SmtpReplyParser::~SmtpReplyParser()
+{
+}
+
+/**
+ * @brief Reads every available byte of the device into the buffer.
+ */
+qint64 SmtpReplyParser::readFrom(QIODevice *device)
+{
+    qint64 available = device->bytesAvailable();
+    if (available <= 0)
+        return 0;
+
+    qint64 n = device->read(reserve(int(available)), available);
+    if (n > 0)
+        end += int(n);
+
+    return n;
+}
+
+void SmtpReplyParser::append(const char *data, int len)
+{
+    if (len <= 0)
+        return;
+
+    memcpy(reserve(len), data, len);
+    end += len;
+}
+
+/**
+ * @brief Takes the next complete reply from the buffer. Returns false if
+ * more data is needed.
+ */
+bool SmtpReplyParser::next(SmtpReply &reply)
+{
+    while (lineStart < end) {
+        const char *base = buffer.constData();
+        const char *newline = static_cast<const char*>(memchr(base + lineStart, '\n', end - lineStart));
+        if (!newline)
+            return false;
+
+        const char *line = base + lineStart;
+        int length = newline - line;
+        if (length > 0 && line[length - 1] == '\r')
+            --length;
+
+        lines++;
+        int nextLine = newline - base + 1;
+
+        // "250-" continues the reply, "250 " (or a bare "250") ends it
+        if (length > 3 && line[3] == '-') {
+            lineStart = nextLine;
+            continue;
+        }
+
+        // Replies are short, copying one is cheaper than sharing the read
+        // buffer, which would have to be replaced on the next read. Copies
+        // of the reply kept by the client share the small copy instead.
+        reply.size = nextLine - start;
+        reply.buffer.resize(reply.size);
+        memcpy(reply.buffer.data(), base + start, reply.size);
+        reply.lines = lines;
+
+        reply.code = 0;
+        if (length >= 3 && line[0] >= '0' && line[0] <= '9'
+                && line[1] >= '0' && line[1] <= '9' && line[2] >= '0' && line[2] <= '9')
+            reply.code = (line[0] - '0') * 100 + (line[1] - '0') * 10 + (line[2] - '0');
+
+        int enhanced[3];
+        if (length > 4 && parseEnhancedCode(line + 4, line + length, enhanced)) {
+            reply.enhancedClass = enhanced[0];
+            reply.enhancedSubject = enhanced[1];
+            reply.enhancedDetail = enhanced[2];
+        } else {
+            reply.enhancedClass = reply.enhancedSubject = reply.enhancedDetail = 0;
+        }
+
+        start = lineStart = nextLine;
+        lines = 0;
+        return true;
+    }
+
+    return false;
+}
+
+void SmtpReplyParser::clear()
+{
+    start = lineStart = end = 0;
+    lines = 0;
+}
+
+/* [2] --- */
+
+
+/* [3] Private methods */
+
+char *SmtpReplyParser::reserve(int len)
+{
+    int pending = end - start;
+
+    if (buffer.size() - end < len) {
+        // Drop the consumed replies before growing the buffer
+        if (start > 0)
+            memmove(buffer.data(), buffer.constData() + start, pending);
+        if (buffer.size() - pending < len)
+            buffer.resize(qMax(qMax(pending + len, buffer.size() * 2), MIN_BUFFER_SIZE));
+    } else {
+        return buffer.data() + end;
+    }
+
+    lineStart -= start;
+    end = pending;
+    start = 0;
+    return buffer.data() + end;
+}
+
+/* [3] --- */
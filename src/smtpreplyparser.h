@@ -0,0 +1,116 @@
+#ifndef SMTPREPLYPARSER_H
+#define SMTPREPLYPARSER_H
+
+#include <QByteArray>
+#include <QString>
+#include "smtpmime_global.h"
+
+class QIODevice;
+
+/**
+ * @brief A complete (possibly multi-line) server reply.
+ *
+ * The reply keeps a copy of its raw lines, so the parser can reuse its
+ * read buffer. The text is only decoded when getText() or toByteArray() is
+ * called.
+ */
+class SMTP_MIME_EXPORT SmtpReply
+{
+public:
+
+    /* [1] Constructors and Destructors */
+
+    SmtpReply();
+    ~SmtpReply();
+
+    /* [1] --- */
+
+
+    /* [2] Getters */
+
+    bool isValid() const;
+    int getCode() const;
+    int getLineCount() const;
+
+    bool hasEnhancedCode() const;
+    int getEnhancedClass() const;
+    int getEnhancedSubject() const;
+    int getEnhancedDetail() const;
+    QString getEnhancedCode() const;
+
+    const char *getData() const;
+    int getSize() const;
+
+    QByteArray toByteArray() const;
+    QString getText() const;
+
+    /* [2] --- */
+
+private:
+
+    /* [3] Private members */
+
+    QByteArray buffer;
+    int size;
+    int lines;
+    int code;
+    int enhancedClass;
+    int enhancedSubject;
+    int enhancedDetail;
+
+    /* [3] --- */
+
+    friend class SmtpReplyParser;
+};
+
+
+/**
+ * @brief Incremental parser of SMTP replies (RFC 5321, section 4.2).
+ *
+ * Bytes are read straight into one growing buffer, and complete replies
+ * are taken from it with next(). Partial lines and multi-line replies may
+ * be spread over any number of reads. Reply codes and enhanced status codes
+ * (RFC 3463) are parsed in place, without allocations.
+ */
+class SMTP_MIME_EXPORT SmtpReplyParser
+{
+public:
+
+    /* [1] Constructors and Destructors */
+
+    SmtpReplyParser();
+    ~SmtpReplyParser();
+
+    /* [1] --- */
+
+
+    /* [2] Public methods */
+
+    qint64 readFrom(QIODevice *device);
+    void append(const char *data, int len);
+    bool next(SmtpReply &reply);
+    void clear();
+
+    /* [2] --- */
+
+private:
+
+    /* [3] Private members */
+
+    QByteArray buffer;
+    int start;
+    int lineStart;
+    int end;
+    int lines;
+
+    /* [3] --- */
+
+
+    /* [4] Private methods */
+
+    char *reserve(int len);
+
+    /* [4] --- */
+};
+
+#endif // SMTPREPLYPARSER_H
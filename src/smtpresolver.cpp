@@ -0,0 +1,183 @@
+#include "smtpresolver.h"
+
+#include <QtNetwork/QDnsLookup>
+#include <QtNetwork/QHostInfo>
+
+/* [1] SmtpResolver */
+
+SmtpResolver::SmtpResolver(QObject *parent) :
+    QObject(parent)
+{
+}
+
+SmtpResolver::~SmtpResolver()
+{
+}
+
+void SmtpResolver::lookupMx(const QString &domain)
+{
+    emit mxFound(domain, QStringList() << domain, 0);
+}
+
+/* [1] --- */
+
+
+/* [2] Constructors and Destructors */
+
+SmtpDnsResolver::SmtpDnsResolver(QObject *parent) :
+    SmtpResolver(parent),
+    defaultTtl(60)
+{
+}
+
+SmtpDnsResolver::~SmtpDnsResolver()
+{
+    foreach (int id, hostInfoLookups.keys())
+        QHostInfo::abortHostLookup(id);
+}
+
+/* [2] --- */
+
+
+/* [3] Getters and Setters */
+
+/**
+ * @brief Sets how long (in seconds) addresses without a TTL are cached.
+ */
+void SmtpDnsResolver::setDefaultTtl(int secs)
+{
+    this->defaultTtl = secs;
+}
+
+int SmtpDnsResolver::getDefaultTtl() const
+{
+    return defaultTtl;
+}
+
+/* [3] --- */
+
+
+/* [4] Public methods */
+
+void SmtpDnsResolver::lookupHost(const QString &host)
+{
+    // One query answers every connector waiting for the host
+    if (pending.contains(host))
+        return;
+
+    PendingLookup lookup;
+    lookup.remaining = 2;
+    lookup.ttl = -1;
+    pending.insert(host, lookup);
+
+    const QDnsLookup::Type types[] = { QDnsLookup::AAAA, QDnsLookup::A };
+    for (int i = 0; i < 2; ++i) {
+        QDnsLookup *dns = new QDnsLookup(types[i], host, this);
+        connect(dns, SIGNAL(finished()), this, SLOT(dnsFinished()));
+        dns->lookup();
+    }
+}
+
+void SmtpDnsResolver::lookupMx(const QString &domain)
+{
+    if (pendingMx.contains(domain))
+        return;
+    pendingMx.insert(domain);
+
+    QDnsLookup *dns = new QDnsLookup(QDnsLookup::MX, domain, this);
+    connect(dns, SIGNAL(finished()), this, SLOT(mxLookupFinished()));
+    dns->lookup();
+}
+
+/* [4] --- */
+
+
+/* [5] Protected slots */
+
+void SmtpDnsResolver::dnsFinished()
+{
+    QDnsLookup *dns = qobject_cast<QDnsLookup*>(sender());
+    if (!dns)
+        return;
+    dns->deleteLater();
+
+    QString host = dns->name();
+    QHash<QString, PendingLookup>::iterator it = pending.find(host);
+    if (it == pending.end())
+        return;
+
+    if (dns->error() == QDnsLookup::NoError) {
+        foreach (const QDnsHostAddressRecord &record, dns->hostAddressRecords()) {
+            it->addresses << record.value();
+            if (it->ttl < 0 || int(record.timeToLive()) < it->ttl)
+                it->ttl = record.timeToLive();
+        }
+    }
+
+    if (--it->remaining > 0)
+        return;
+
+    if (it->addresses.isEmpty()) {
+        int id = QHostInfo::lookupHost(host, this, SLOT(hostInfoFound(QHostInfo)));
+        hostInfoLookups.insert(id, host);
+        return;
+    }
+
+    PendingLookup lookup = *it;
+    pending.erase(it);
+    emit hostFound(host, lookup.addresses, lookup.ttl);
+}
+
+void SmtpDnsResolver::mxLookupFinished()
+{
+    QDnsLookup *dns = qobject_cast<QDnsLookup*>(sender());
+    if (!dns)
+        return;
+    dns->deleteLater();
+
+    QString domain = dns->name();
+    pendingMx.remove(domain);
+
+    QStringList hosts;
+    int ttl = -1;
+
+    // QDnsLookup sorts the records by preference (RFC 5321, 5.1)
+    foreach (const QDnsMailExchangeRecord &record, dns->mailExchangeRecords()) {
+        if (record.exchange().isEmpty() || record.exchange() == ".")
+            continue;
+        hosts << record.exchange();
+        if (ttl < 0 || int(record.timeToLive()) < ttl)
+            ttl = record.timeToLive();
+    }
+
+    // A null MX says the domain takes no mail at all
+    bool nullMx = hosts.isEmpty() && !dns->mailExchangeRecords().isEmpty();
+
+    // NXDOMAIN is final as well, unlike a server that failed to answer
+    if (!nullMx && dns->error() == QDnsLookup::NotFoundError) {
+        emit mxFound(domain, QStringList(), 0);
+        return;
+    }
+
+    if (!nullMx && dns->error() != QDnsLookup::NoError) {
+        emit mxFailed(domain, dns->errorString());
+        return;
+    }
+
+    if (hosts.isEmpty() && !nullMx) {
+        hosts << domain;
+        ttl = defaultTtl;
+    }
+
+    emit mxFound(domain, hosts, qMax(0, ttl));
+}
+
+void SmtpDnsResolver::hostInfoFound(const QHostInfo &info)
+{
+    QString host = hostInfoLookups.take(info.lookupId());
+    pending.remove(host);
+
+    emit hostFound(host, info.addresses(), defaultTtl);
+}
+
+/* [5] --- */
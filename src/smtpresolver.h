@@ -0,0 +1,108 @@
+#ifndef SMTPRESOLVER_H
+#define SMTPRESOLVER_H
+
+#include <QObject>
+#include <QHash>
+#include <QList>
+#include <QSet>
+#include <QStringList>
+#include <QtNetwork/QHostAddress>
+#include "smtpmime_global.h"
+
+class QDnsLookup;
+class QHostInfo;
+
+/**
+ * @brief Name resolution used by SmtpConnector.
+ *
+ * lookupHost() answers with hostFound(), carrying the IPv6 and IPv4
+ * addresses of the host and how long (in seconds) they may be cached. An
+ * empty list means the host could not be resolved. Tests can provide their
+ * own resolver instead of querying DNS.
+ *
+ * lookupMx() answers with mxFound(), carrying the mail exchangers of a
+ * domain in the order they should be tried. An empty list means the domain
+ * takes no mail. A lookup that may succeed later answers with mxFailed().
+ * The default implementation returns the domain itself, its implicit MX
+ * (RFC 5321, 5.1).
+ */
+class SMTP_MIME_EXPORT SmtpResolver : public QObject
+{
+    Q_OBJECT
+public:
+    SmtpResolver(QObject *parent = 0);
+    virtual ~SmtpResolver();
+
+    virtual void lookupHost(const QString &host) = 0;
+    virtual void lookupMx(const QString &domain);
+
+signals:
+    void hostFound(const QString &host, const QList<QHostAddress> &addresses, int ttl);
+    void mxFound(const QString &domain, const QStringList &hosts, int ttl);
+    void mxFailed(const QString &domain, const QString &errorText);
+};
+
+
+/**
+ * @brief Default resolver: queries the AAAA and A records with QDnsLookup to
+ * learn their TTL. Names DNS does not know (e.g. from the hosts file) are
+ * resolved with QHostInfo and cached for getDefaultTtl() seconds.
+ *
+ * MX records are ordered by preference, equal preferences in random order.
+ * A domain without MX records is its own mail exchanger; a null MX
+ * (RFC 7505) or a domain that does not exist gives an empty list. Other
+ * errors (SERVFAIL, timeouts) are reported with mxFailed().
+ */
+class SMTP_MIME_EXPORT SmtpDnsResolver : public SmtpResolver
+{
+    Q_OBJECT
+public:
+
+    /* [1] Constructors and Destructors */
+
+    SmtpDnsResolver(QObject *parent = 0);
+    ~SmtpDnsResolver();
+
+    /* [1] --- */
+
+
+    /* [2] Getters and Setters */
+
+    void setDefaultTtl(int secs);
+    int getDefaultTtl() const;
+
+    /* [2] --- */
+
+
+    /* [3] Public methods */
+
+    void lookupHost(const QString &host);
+    void lookupMx(const QString &domain);
+
+    /* [3] --- */
+
+protected slots:
+    void dnsFinished();
+    void mxLookupFinished();
+    void hostInfoFound(const QHostInfo &info);
+
+protected:
+
+    struct PendingLookup
+    {
+        int remaining;
+        QList<QHostAddress> addresses;
+        int ttl;
+    };
+
+    /* [4] Protected members */
+
+    QHash<QString, PendingLookup> pending;
+    QHash<int, QString> hostInfoLookups;
+    QSet<QString> pendingMx;
+    int defaultTtl;
+
+    /* [4] --- */
+};
+
+#endif // SMTPRESOLVER_H
@@ -0,0 +1,116 @@
+#include "smtpresult.h"
+
+/* [1] Constructors and Destructors */
+
+SmtpResult::SmtpResult() :
+    success(false),
+    responseCode(0),
+    error(-1),
+    waitTime(0),
+    elapsed(0)
+{
+}
+
+SmtpResult::SmtpResult(bool success, int responseCode, const QString &responseText,
+                       int error, const QString &errorText) :
+    success(success),
+    responseCode(responseCode),
+    responseText(responseText),
+    error(error),
+    errorText(errorText),
+    waitTime(0),
+    elapsed(0)
+{
+}
+
+SmtpResult::~SmtpResult()
+{
+}
+
+/* [1] --- */
+
+
+/* [2] Getters and Setters */
+
+bool SmtpResult::isSuccess() const
+{
+    return success;
+}
+
+/**
+ * @brief Returns the code of the last reply received for the operation.
+ */
+int SmtpResult::getResponseCode() const
+{
+    return responseCode;
+}
+
+QString SmtpResult::getResponseText() const
+{
+    return responseText;
+}
+
+/**
+ * @brief Returns the SmtpClient::SmtpError of a failed operation, or -1.
+ */
+int SmtpResult::getError() const
+{
+    return error;
+}
+
+QString SmtpResult::getErrorText() const
+{
+    return errorText;
+}
+
+/**
+ * @brief Returns how long (in milliseconds) the operation was queued behind
+ * the previous operations of the client.
+ */
+qint64 SmtpResult::getWaitTime() const
+{
+    return waitTime;
+}
+
+void SmtpResult::setWaitTime(qint64 msec)
+{
+    this->waitTime = msec;
+}
+
+/**
+ * @brief Returns how long (in milliseconds) the operation ran.
+ */
+qint64 SmtpResult::getElapsed() const
+{
+    return elapsed;
+}
+
+void SmtpResult::setElapsed(qint64 msec)
+{
+    this->elapsed = msec;
+}
+
+const QList<SmtpRecipientStatus> &SmtpResult::getRecipients() const
+{
+    return recipients;
+}
+
+void SmtpResult::setRecipients(const QList<SmtpRecipientStatus> &recipients)
+{
+    this->recipients = recipients;
+}
+
+/**
+ * @brief Returns the recipients that were deferred or rejected.
+ */
+QList<SmtpRecipientStatus> SmtpResult::getFailedRecipients() const
+{
+    QList<SmtpRecipientStatus> failed;
+    foreach (const SmtpRecipientStatus &recipient, recipients) {
+        if (!recipient.isAccepted())
+            failed << recipient;
+    }
+    return failed;
+}
+
+/* [2] --- */
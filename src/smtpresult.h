@@ -0,0 +1,72 @@
+#ifndef SMTPRESULT_H
+#define SMTPRESULT_H
+
+#include <QString>
+#include <QList>
+#include <QMetaType>
+#include "smtpmime_global.h"
+#include "smtprecipientstatus.h"
+
+/**
+ * @brief Outcome of an asynchronous SmtpClient operation: the success flag,
+ * the last server reply and how long the operation waited and ran.
+ *
+ * Results of sending a message also list the status of every recipient. A
+ * message is sent when at least one recipient was accepted, the failed ones
+ * can be retried on their own.
+ */
+class SMTP_MIME_EXPORT SmtpResult
+{
+public:
+
+    /* [1] Constructors and Destructors */
+
+    SmtpResult();
+    SmtpResult(bool success, int responseCode, const QString &responseText,
+               int error = -1, const QString &errorText = "");
+    ~SmtpResult();
+
+    /* [1] --- */
+
+
+    /* [2] Getters and Setters */
+
+    bool isSuccess() const;
+
+    int getResponseCode() const;
+    QString getResponseText() const;
+
+    int getError() const;
+    QString getErrorText() const;
+
+    qint64 getWaitTime() const;
+    void setWaitTime(qint64 msec);
+
+    qint64 getElapsed() const;
+    void setElapsed(qint64 msec);
+
+    const QList<SmtpRecipientStatus> &getRecipients() const;
+    void setRecipients(const QList<SmtpRecipientStatus> &recipients);
+    QList<SmtpRecipientStatus> getFailedRecipients() const;
+
+    /* [2] --- */
+
+private:
+
+    /* [3] Private members */
+
+    bool success;
+    int responseCode;
+    QString responseText;
+    int error;
+    QString errorText;
+    qint64 waitTime;
+    qint64 elapsed;
+    QList<SmtpRecipientStatus> recipients;
+
+    /* [3] --- */
+};
+
+Q_DECLARE_METATYPE(SmtpResult)
+
+#endif // SMTPRESULT_H
@@ -0,0 +1,251 @@
+#include "smtpretryscheduler.h"
+
+#include <QDateTime>
+#include <QMutexLocker>
+#include <QRandomGenerator>
+#include <QStringList>
+#include "smtpreplyparser.h"
+
+/* [1] Constructors and Destructors */
+
+SmtpRetryScheduler::SmtpRetryScheduler() :
+    maxDelay(4 * 60 * 60 * 1000),
+    maxRetryTime(qint64(4) * 24 * 60 * 60 * 1000),
+    jitter(0.5)
+{
+    baseDelays[NoFailure] = 0;
+    baseDelays[Greylisted] = 5 * 60 * 1000;
+    baseDelays[MailboxFull] = 30 * 60 * 1000;
+    baseDelays[RateLimited] = 60 * 1000;
+    baseDelays[TransientFailure] = 60 * 1000;
+    baseDelays[PermanentFailure] = 0;
+}
+
+SmtpRetryScheduler::~SmtpRetryScheduler()
+{
+}
+
+/* [1] --- */
+
+
+/* [2] Getters and Setters */
+
+int SmtpRetryScheduler::getBaseDelay(Failure failure) const
+{
+    QMutexLocker locker(&mutex);
+    return baseDelays[failure];
+}
+
+/**
+ * @brief Sets the delay (in milliseconds) before the first retry of the
+ * failure. Every further retry waits twice as long.
+ */
+void SmtpRetryScheduler::setBaseDelay(Failure failure, int msec)
+{
+    QMutexLocker locker(&mutex);
+    this->baseDelays[failure] = msec;
+}
+
+int SmtpRetryScheduler::getMaxDelay() const
+{
+    QMutexLocker locker(&mutex);
+    return maxDelay;
+}
+
+/**
+ * @brief Sets the longest delay (in milliseconds) between two attempts.
+ */
+void SmtpRetryScheduler::setMaxDelay(int msec)
+{
+    QMutexLocker locker(&mutex);
+    this->maxDelay = msec;
+}
+
+qint64 SmtpRetryScheduler::getMaxRetryTime() const
+{
+    QMutexLocker locker(&mutex);
+    return maxRetryTime;
+}
+
+/**
+ * @brief Sets how long (in milliseconds) after its first attempt a message
+ * is given up. The default of 4 days follows RFC 5321. 0 retries forever.
+ */
+void SmtpRetryScheduler::setMaxRetryTime(qint64 msec)
+{
+    QMutexLocker locker(&mutex);
+    this->maxRetryTime = msec;
+}
+
+double SmtpRetryScheduler::getJitter() const
+{
+    QMutexLocker locker(&mutex);
+    return jitter;
+}
+
+/**
+ * @brief Sets the random part of the delays, as a fraction of the backoff
+ * step: with 0.5 a delay of 60 s becomes 60 to 90 s.
+ */
+void SmtpRetryScheduler::setJitter(double jitter)
+{
+    QMutexLocker locker(&mutex);
+    this->jitter = qBound(0.0, jitter, 1.0);
+}
+
+/**
+ * @brief Returns how long (in milliseconds) the destination is still backed
+ * off, 0 if it may be tried now.
+ */
+int SmtpRetryScheduler::getWaitTime(const QString &destination) const
+{
+    QMutexLocker locker(&mutex);
+
+    QHash<QString, Destination>::const_iterator it = destinations.constFind(destination);
+    if (it == destinations.constEnd())
+        return 0;
+
+    qint64 wait = it.value().blockedUntil - QDateTime::currentMSecsSinceEpoch();
+    return wait > 0 ? int(wait) : 0;
+}
+
+int SmtpRetryScheduler::getFailureCount(const QString &destination) const
+{
+    QMutexLocker locker(&mutex);
+    return destinations.value(destination).failures;
+}
+
+/* [2] --- */
+
+
+/* [3] Public methods */
+
+SmtpRetryScheduler::Failure SmtpRetryScheduler::classify(const SmtpReply &reply)
+{
+    if (!reply.isValid())
+        return TransientFailure;
+
+    return classify(reply.getCode(), reply.getEnhancedSubject(), reply.getEnhancedDetail(), reply.getText());
+}
+
+/**
+ * @brief Classifies a reply given by its code, its enhanced status code
+ * ("4.2.2") and its text. A code of 0 (no reply at all, e.g. a lost
+ * connection) is a transient failure.
+ */
+SmtpRetryScheduler::Failure SmtpRetryScheduler::classify(int responseCode, const QString &enhancedCode,
+                                                         const QString &text)
+{
+    QStringList fields = enhancedCode.split('.');
+    int subject = -1, detail = -1;
+    if (fields.size() == 3) {
+        subject = fields.at(1).toInt();
+        detail = fields.at(2).toInt();
+    }
+
+    return classify(responseCode, subject, detail, text);
+}
+
+bool SmtpRetryScheduler::isTransient(Failure failure)
+{
+    return failure != NoFailure && failure != PermanentFailure;
+}
+
+/**
+ * @brief Returns true for failures that concern every message sent to the
+ * destination, not only the one that got the reply.
+ */
+bool SmtpRetryScheduler::isDestinationWide(Failure failure)
+{
+    return failure == RateLimited || failure == TransientFailure;
+}
+
+/**
+ * @brief Returns the delay (in milliseconds) before the message is tried
+ * again, or -1 if it has to be given up. attempts is the number of failed
+ * attempts of the message so far, age the time since its first attempt.
+ */
+int SmtpRetryScheduler::nextDelay(const QString &destination, Failure failure, int attempts, qint64 age)
+{
+    if (!isTransient(failure))
+        return -1;
+
+    QMutexLocker locker(&mutex);
+
+    if (maxRetryTime > 0 && age >= maxRetryTime)
+        return -1;
+
+    int step = qMax(1, attempts);
+    Destination *target = 0;
+    if (isDestinationWide(failure)) {
+        target = &destinations[destination];
+        target->failures++;
+        step = qMax(step, target->failures);
+    }
+
+    qint64 delay = qint64(baseDelays[failure]) << qMin(step - 1, 20);
+    delay = qMin<qint64>(delay, maxDelay);
+    delay += qint64(delay * jitter * QRandomGenerator::global()->generateDouble());
+
+    if (target)
+        target->blockedUntil = qMax(target->blockedUntil, QDateTime::currentMSecsSinceEpoch() + delay);
+
+    return int(qMin<qint64>(delay, 0x7fffffff));
+}
+
+/**
+ * @brief Ends the backoff of the destination after a successful send.
+ */
+void SmtpRetryScheduler::recordSuccess(const QString &destination)
+{
+    QMutexLocker locker(&mutex);
+    destinations.remove(destination);
+}
+
+void SmtpRetryScheduler::clear()
+{
+    QMutexLocker locker(&mutex);
+    destinations.clear();
+}
+
+/* [3] --- */
+
+
+/* [4] Protected methods */
+
+SmtpRetryScheduler::Failure SmtpRetryScheduler::classify(int responseCode, int subject, int detail,
+                                                         const QString &text)
+{
+    if (responseCode <= 0)
+        return TransientFailure;
+    if (responseCode < 400)
+        return NoFailure;
+    if (responseCode >= 500)
+        return PermanentFailure;
+
+    // Servers use 4.7.x for policy delays of any kind, only the text tells
+    // greylisting from rate limiting
+    QString lower = text.toLower();
+    if (lower.contains("greylist") || lower.contains("graylist")
+            || lower.contains("grey-list") || lower.contains("gray-list"))
+        return Greylisted;
+
+    if (subject == 2 && detail == 2)
+        return MailboxFull;
+    if (lower.contains("quota") || lower.contains("mailbox full") || lower.contains("mailbox is full"))
+        return MailboxFull;
+
+    if (subject == 7 && detail == 28)
+        return RateLimited;
+    if (lower.contains("rate limit") || lower.contains("too many") || lower.contains("throttl")
+            || lower.contains("slow down"))
+        return RateLimited;
+
+    // A policy delay of a single message without a reason is greylisting
+    if (subject == 7 && (responseCode == 450 || responseCode == 451))
+        return Greylisted;
+
+    return TransientFailure;
+}
+
+/* [4] --- */
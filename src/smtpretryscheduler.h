@@ -0,0 +1,110 @@
+#ifndef SMTPRETRYSCHEDULER_H
+#define SMTPRETRYSCHEDULER_H
+
+#include <QString>
+#include <QHash>
+#include <QMutex>
+#include "smtpmime_global.h"
+
+class SmtpReply;
+
+/**
+ * @brief Classifies failed sends and decides when (or if) they are retried.
+ *
+ * Replies are classified by their basic and enhanced status code (RFC 3463)
+ * and, for the ambiguous 4.7.x codes, by their text. Permanent failures are
+ * given up at once. Transient ones are retried after an exponential backoff
+ * with random jitter, so retries of many messages do not hit the server at
+ * the same time.
+ *
+ * Rate limits and connection failures concern the whole destination: every
+ * message to it waits until getWaitTime() has passed. Greylisting and full
+ * mailboxes only delay the message that got the reply.
+ *
+ * The scheduler can be shared between threads.
+ */
+class SMTP_MIME_EXPORT SmtpRetryScheduler
+{
+public:
+
+    enum Failure
+    {
+        NoFailure,
+        Greylisted,
+        MailboxFull,
+        RateLimited,
+        TransientFailure,
+        PermanentFailure
+    };
+
+    /* [1] Constructors and Destructors */
+
+    SmtpRetryScheduler();
+    ~SmtpRetryScheduler();
+
+    /* [1] --- */
+
+
+    /* [2] Getters and Setters */
+
+    int getBaseDelay(Failure failure) const;
+    void setBaseDelay(Failure failure, int msec);
+
+    int getMaxDelay() const;
+    void setMaxDelay(int msec);
+
+    qint64 getMaxRetryTime() const;
+    void setMaxRetryTime(qint64 msec);
+
+    double getJitter() const;
+    void setJitter(double jitter);
+
+    int getWaitTime(const QString &destination) const;
+    int getFailureCount(const QString &destination) const;
+
+    /* [2] --- */
+
+
+    /* [3] Public methods */
+
+    static Failure classify(const SmtpReply &reply);
+    static Failure classify(int responseCode, const QString &enhancedCode = "", const QString &text = "");
+    static bool isTransient(Failure failure);
+    static bool isDestinationWide(Failure failure);
+
+    int nextDelay(const QString &destination, Failure failure, int attempts, qint64 age);
+    void recordSuccess(const QString &destination);
+    void clear();
+
+    /* [3] --- */
+
+protected:
+
+    struct Destination
+    {
+        Destination() : failures(0), blockedUntil(0) {}
+
+        int failures;
+        qint64 blockedUntil;
+    };
+
+    /* [4] Protected members */
+
+    mutable QMutex mutex;
+    QHash<QString, Destination> destinations;
+    int baseDelays[PermanentFailure + 1];
+    int maxDelay;
+    qint64 maxRetryTime;
+    double jitter;
+
+    /* [4] --- */
+
+
+    /* [5] Protected methods */
+
+    static Failure classify(int responseCode, int subject, int detail, const QString &text);
+
+    /* [5] --- */
+};
+
+#endif // SMTPRETRYSCHEDULER_H
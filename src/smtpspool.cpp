@@ -0,0 +1,742 @@
+#include "smtpspool.h"
+
+#include <QBuffer>
+#include <QDataStream>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QDebug>
+#include "smtpclient.h"
+
+#ifdef Q_OS_WIN
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static const quint32 SegmentMagic = 0x53504f4c;
+static const quint32 IndexMagic = 0x53504958;
+
+// magic, id, state, segment, offset, length
+static const int IndexRecordSize = 4 + 8 + 1 + 4 + 8 + 8;
+
+static void writeEnvelope(QDataStream &out, const SmtpEnvelope &envelope)
+{
+    out << envelope.getSender().getAddress() << envelope.getSender().getName();
+    out << quint32(envelope.getRecipientCount());
+    for (int i = 0; i < envelope.getRecipientCount(); ++i) {
+        const EmailAddress &rcpt = envelope.getRecipients().at(i);
+        out << rcpt.getAddress() << rcpt.getName() << quint8(envelope.getRecipientType(i));
+    }
+}
+
+static SmtpEnvelope readEnvelope(QDataStream &in)
+{
+    QString address, name;
+    quint32 count;
+    in >> address >> name >> count;
+
+    SmtpEnvelope envelope;
+    envelope.setSender(EmailAddress(address, name));
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        quint8 type;
+        in >> address >> name >> type;
+        envelope.addRecipient(EmailAddress(address, name), MimeMessage::RecipientType(type));
+    }
+    return envelope;
+}
+
+/* [1] Constructors and Destructors */
+
+SmtpSpool::SmtpSpool(const QString &path, QObject *parent) :
+    QObject(parent),
+    path(path),
+    segmentSize(64 * 1024 * 1024),
+    syncBatchSize(32),
+    syncInterval(100),
+    index(0),
+    writeSegment(0),
+    writeSegmentNumber(0),
+    nextId(1),
+    committingId(0)
+{
+    syncTimer.setSingleShot(true);
+    connect(&syncTimer, SIGNAL(timeout()), this, SLOT(syncTimeout()));
+}
+
+SmtpSpool::~SmtpSpool()
+{
+    close();
+}
+
+/* [1] --- */
+
+
+/* [2] Getters and Setters */
+
+QString SmtpSpool::getPath() const
+{
+    return path;
+}
+
+qint64 SmtpSpool::getSegmentSize() const
+{
+    return segmentSize;
+}
+
+/**
+ * @brief Sets the size after which a new segment file is started. A message
+ * is never split, so segments may grow larger by one message.
+ */
+void SmtpSpool::setSegmentSize(qint64 size)
+{
+    this->segmentSize = size;
+}
+
+int SmtpSpool::getSyncBatchSize() const
+{
+    return syncBatchSize;
+}
+
+/**
+ * @brief Sets how many changes are collected before they are synced to
+ * disk. 1 syncs every change.
+ */
+void SmtpSpool::setSyncBatchSize(int count)
+{
+    this->syncBatchSize = qMax(1, count);
+}
+
+int SmtpSpool::getSyncInterval() const
+{
+    return syncInterval;
+}
+
+/**
+ * @brief Sets how long (in milliseconds) a change may wait for the batch to
+ * fill before it is synced anyway.
+ */
+void SmtpSpool::setSyncInterval(int msec)
+{
+    this->syncInterval = msec;
+}
+
+bool SmtpSpool::isOpen() const
+{
+    return index != 0;
+}
+
+/**
+ * @brief Returns the state of the message. Delivered and removed messages
+ * are forgotten once synced, they are reported as Removed.
+ */
+SmtpSpool::State SmtpSpool::getState(quint64 id) const
+{
+    QMap<quint64, Record>::const_iterator it = records.constFind(id);
+    return (it != records.constEnd()) ? it.value().state : Removed;
+}
+
+QList<quint64> SmtpSpool::getIds(State state) const
+{
+    QList<quint64> ids;
+    for (QMap<quint64, Record>::const_iterator it = records.constBegin(); it != records.constEnd(); ++it) {
+        if (it.value().state == state)
+            ids << it.key();
+    }
+    return ids;
+}
+
+int SmtpSpool::count(State state) const
+{
+    int n = 0;
+    foreach (const Record &record, records) {
+        if (record.state == state)
+            n++;
+    }
+    return n;
+}
+
+/* [2] --- */
+
+
+/* [3] Public methods */
+
+/**
+ * @brief Opens the spool directory (creating it if needed) and recovers the
+ * messages left by the previous run.
+ */
+bool SmtpSpool::open()
+{
+    if (isOpen())
+        return true;
+
+    QDir dir(path);
+    if (!dir.mkpath(".")) {
+        qWarning() << "[SmtpSpool] Cannot create" << path;
+        return false;
+    }
+
+    records.clear();
+    segmentUse.clear();
+    nextId = 1;
+
+    // Replay the index log, the last record of a message wins. A torn
+    // record at the end is what a crash in the middle of a write leaves.
+    QFile log(dir.filePath("index.log"));
+    if (log.open(QIODevice::ReadOnly)) {
+        QDataStream in(&log);
+        qint64 count = log.size() / IndexRecordSize;
+        for (qint64 i = 0; i < count; ++i) {
+            quint32 magic;
+            quint64 id;
+            quint8 state;
+            qint32 segment;
+            qint64 offset, length;
+            in >> magic >> id >> state >> segment >> offset >> length;
+            if (magic != IndexMagic || state > Removed)
+                break;
+
+            Record &record = records[id];
+            record.state = State(state);
+            record.segment = segment;
+            record.offset = offset;
+            record.length = length;
+            record.mapped = 0;
+            nextId = qMax(nextId, id + 1);
+        }
+        log.close();
+    }
+
+    int lastSegment = 0;
+    foreach (const QString &name, dir.entryList(QStringList("segment-*.dat"), QDir::Files))
+        lastSegment = qMax(lastSegment, name.mid(8, 6).toInt());
+    writeSegmentNumber = lastSegment + 1;
+
+    QMap<quint64, Record>::iterator it = records.begin();
+    while (it != records.end()) {
+        Record &record = it.value();
+
+        if (isDropped(record.state)) {
+            it = records.erase(it);
+            continue;
+        }
+
+        if (!readRecord(it.key(), record)) {
+            qWarning() << "[SmtpSpool] Dropping torn message" << it.key();
+            it = records.erase(it);
+            continue;
+        }
+
+        // The final dot may have reached the server, sending again could
+        // deliver the message twice
+        if (record.state == Sending)
+            record.state = Queued;
+        else if (record.state == Committing)
+            record.state = Uncertain;
+
+        segmentUse[record.segment]++;
+        ++it;
+    }
+
+    // Segments without live messages are not needed anymore
+    foreach (const QString &name, dir.entryList(QStringList("segment-*.dat"), QDir::Files)) {
+        int segment = name.mid(8, 6).toInt();
+        if (!segmentUse.contains(segment)) {
+            delete segments.take(segment);
+            dir.remove(name);
+        }
+    }
+
+    if (!writeIndex() || !startSegment(writeSegmentNumber)) {
+        close();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Syncs the pending changes and closes every file. Data of entries
+ * taken from the spool is no longer valid.
+ */
+void SmtpSpool::close()
+{
+    if (isOpen())
+        sync();
+
+    for (QMap<quint64, Record>::iterator it = records.begin(); it != records.end(); ++it)
+        unmap(it.value());
+
+    qDeleteAll(segments);
+    segments.clear();
+    segmentUse.clear();
+    writeSegment = 0;
+
+    delete index;
+    index = 0;
+
+    records.clear();
+    pendingIndex.clear();
+    syncTimer.stop();
+}
+
+/**
+ * @brief Appends a serialized message (CRLF line endings, not dot-stuffed)
+ * to the spool and returns its id, or 0 on failure. The message is durable
+ * after the next sync.
+ */
+quint64 SmtpSpool::enqueue(const SmtpEnvelope &envelope, const QByteArray &data)
+{
+    if (!isOpen())
+        return 0;
+
+    qint64 offset = writeSegment->size();
+    if (offset > 0 && offset >= segmentSize) {
+        if (!sync() || !startSegment(writeSegmentNumber + 1))
+            return 0;
+        offset = 0;
+    }
+
+    quint64 id = nextId++;
+
+    QByteArray header;
+    QDataStream out(&header, QIODevice::WriteOnly);
+    out << SegmentMagic << id;
+    writeEnvelope(out, envelope);
+    out << qint64(data.size());
+
+    if (writeSegment->write(header) != header.size() || writeSegment->write(data) != data.size()) {
+        qWarning() << "[SmtpSpool] Cannot write" << writeSegment->fileName() << writeSegment->errorString();
+        writeSegment->resize(offset);
+        return 0;
+    }
+
+    Record record;
+    record.state = Queued;
+    record.segment = writeSegmentNumber;
+    record.offset = offset;
+    record.length = header.size() + data.size();
+    record.dataOffset = offset + header.size();
+    record.dataLength = data.size();
+    record.envelope = envelope;
+    record.mapped = 0;
+
+    records.insert(id, record);
+    segmentUse[record.segment]++;
+    pendingIndex << id;
+    scheduleSync(false);
+
+    return id;
+}
+
+/**
+ * @brief Serializes the message with its current encodings and appends it
+ * to the spool.
+ */
+quint64 SmtpSpool::enqueue(MimeMessage &message)
+{
+    QBuffer buffer;
+    buffer.open(QIODevice::WriteOnly);
+    message.writeToDevice(buffer);
+    return enqueue(SmtpEnvelope::fromMessage(message), buffer.data());
+}
+
+/**
+ * @brief Takes the oldest queued message and marks it as Sending. The data
+ * of the entry is mapped from the segment file, not read into memory.
+ */
+bool SmtpSpool::takeNext(Entry &entry)
+{
+    for (QMap<quint64, Record>::iterator it = records.begin(); it != records.end(); ++it) {
+        Record &record = it.value();
+        if (record.state != Queued)
+            continue;
+
+        if (record.dataLength > 0 && !record.mapped) {
+            QFile *file = segmentFile(record.segment);
+            if (file == writeSegment)
+                file->flush();
+            record.mapped = file ? file->map(record.dataOffset, record.dataLength) : 0;
+            if (!record.mapped) {
+                qWarning() << "[SmtpSpool] Cannot map message" << it.key();
+                continue;
+            }
+        }
+
+        entry.id = it.key();
+        entry.state = Sending;
+        entry.envelope = record.envelope;
+        entry.data = record.mapped
+                ? QByteArray::fromRawData((const char*) record.mapped, record.dataLength)
+                : QByteArray();
+
+        setState(entry.id, Sending);
+        return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Records the delivery state of the message. The Committing state
+ * is synced before this returns, false means it may not be on disk.
+ */
+bool SmtpSpool::setState(quint64 id, State state)
+{
+    QMap<quint64, Record>::iterator it = records.find(id);
+    if (it == records.end() || !isOpen())
+        return false;
+
+    Record &record = it.value();
+    if (record.state == state)
+        return true;
+
+    record.state = state;
+    if (state != Sending && state != Committing)
+        unmap(record);
+
+    pendingIndex << id;
+
+    if (state == Committing)
+        return sync();
+
+    scheduleSync(false);
+    return true;
+}
+
+/**
+ * @brief Drops the message, e.g. a failed or uncertain one that was handled
+ * by hand. Its segment is deleted once no other message uses it.
+ */
+bool SmtpSpool::remove(quint64 id)
+{
+    return setState(id, Removed);
+}
+
+/**
+ * @brief Sends the entry on a ready client and records the outcome:
+ * Delivered, Queued if it may be sent again, Failed if the server refused
+ * it for good, or Uncertain if the connection was lost after the message
+ * was committed.
+ *
+ * When only some recipients can still get the message (the others were
+ * accepted or rejected), they are queued as a new message whose id is
+ * set in the retryId of the entry, and the entry itself is finished.
+ *
+ * If the send fails, the connection of the client is aborted before the
+ * state is recorded, the client has to connect again.
+ */
+bool SmtpSpool::deliver(SmtpClient *client, Entry &entry, int msec)
+{
+    entry.retryId = 0;
+
+    if (!client || getState(entry.id) != Sending)
+        return false;
+
+    committingId = entry.id;
+    connect(client, SIGNAL(mailCommitting()), this, SLOT(clientCommitting()));
+
+    bool started = client->sendMail(entry.envelope, entry.data);
+    bool sent = started && client->waitForMailSent(msec);
+
+    // A timed out client would go on uploading the unmapped data below, and
+    // could still commit a message recorded as Queued
+    if (started && !sent && client->getSocket())
+        client->getSocket()->abort();
+
+    disconnect(client, SIGNAL(mailCommitting()), this, SLOT(clientCommitting()));
+    committingId = 0;
+
+    State state;
+    if (sent)
+        state = Delivered;
+    else if (getState(entry.id) == Committing)
+        state = Uncertain;
+    else if (!started)
+        // A ready client only refuses a message over the size limit
+        state = (client->getState() == SmtpClient::ReadyState) ? Failed : Queued;
+    else if (client->getResponseCode() / 100 == 5)
+        state = Failed;
+    else
+        state = Queued;
+
+    // Recipients without a final answer; all of them if the send did not
+    // get as far as the recipients
+    const QList<SmtpRecipientStatus> &recipients = client->getRecipientStatuses();
+    SmtpEnvelope remaining(entry.envelope.getSender());
+    foreach (const SmtpRecipientStatus &recipient, recipients) {
+        if (recipient.getStatus() == SmtpRecipientStatus::Deferred
+                || recipient.getStatus() == SmtpRecipientStatus::Pending)
+            remaining.addRecipient(recipient.getAddress(), recipient.getType());
+    }
+
+    bool partial = !recipients.isEmpty() && remaining.getRecipientCount() < entry.envelope.getRecipientCount();
+
+    if (state == Queued && !recipients.isEmpty() && remaining.getRecipientCount() == 0)
+        state = Failed;
+    else if (partial && remaining.getRecipientCount() > 0 && (state == Delivered || state == Queued)) {
+        // The rest goes on disk before this message is finished, a crash in
+        // between leaves this one Committing (Uncertain) or Sending (Queued)
+        entry.retryId = enqueue(remaining, entry.data);
+        if (entry.retryId == 0 || !sync()) {
+            qWarning() << "[SmtpSpool] Cannot queue the remaining recipients of" << entry.id;
+            if (state == Delivered)
+                state = Uncertain;
+        } else if (state == Queued)
+            state = Removed;
+    }
+
+    setState(entry.id, state);
+    entry.state = state;
+    entry.data = QByteArray();
+
+    return sent;
+}
+
+/**
+ * @brief Writes the pending changes to disk: the segment data first, then
+ * the index records pointing to it.
+ */
+bool SmtpSpool::sync()
+{
+    if (!isOpen())
+        return false;
+
+    syncTimer.stop();
+    if (pendingIndex.isEmpty())
+        return true;
+
+    if (!syncFile(writeSegment)) {
+        qWarning() << "[SmtpSpool] Cannot sync" << writeSegment->fileName();
+        return false;
+    }
+
+    // Only the current state of each message has to be written
+    QList<quint64> ids;
+    QByteArray buffer;
+    QDataStream out(&buffer, QIODevice::WriteOnly);
+    foreach (quint64 id, pendingIndex) {
+        if (ids.contains(id) || !records.contains(id))
+            continue;
+        ids << id;
+        writeIndexRecord(out, id, records.value(id));
+    }
+
+    if (index->write(buffer) != buffer.size() || !syncFile(index)) {
+        qWarning() << "[SmtpSpool] Cannot sync" << index->fileName();
+        return false;
+    }
+    pendingIndex.clear();
+
+    foreach (quint64 id, ids) {
+        const Record &record = records.value(id);
+        if (isDropped(record.state)) {
+            int segment = record.segment;
+            records.remove(id);
+            segmentUse[segment]--;
+            releaseSegment(segment);
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Rewrites the index log with one record per message, dropping the
+ * history of state changes.
+ */
+bool SmtpSpool::compact()
+{
+    return isOpen() && sync() && writeIndex();
+}
+
+/* [3] --- */
+
+
+/* [4] Protected slots */
+
+void SmtpSpool::syncTimeout()
+{
+    sync();
+}
+
+void SmtpSpool::clientCommitting()
+{
+    // The final dot must not leave before the state is on disk
+    if (!setState(committingId, Committing)) {
+        SmtpClient *client = qobject_cast<SmtpClient*>(sender());
+        if (client)
+            client->getSocket()->abort();
+    }
+}
+
+/* [4] --- */
+
+
+/* [5] Protected methods */
+
+QString SmtpSpool::segmentFileName(int segment) const
+{
+    return QDir(path).filePath(QString("segment-%1.dat").arg(segment, 6, 10, QChar('0')));
+}
+
+QFile *SmtpSpool::segmentFile(int segment)
+{
+    QFile *file = segments.value(segment);
+    if (file)
+        return file;
+
+    file = new QFile(segmentFileName(segment));
+    if (!file->open(QIODevice::ReadOnly)) {
+        delete file;
+        return 0;
+    }
+    segments.insert(segment, file);
+    return file;
+}
+
+bool SmtpSpool::startSegment(int segment)
+{
+    QFile *file = new QFile(segmentFileName(segment));
+    if (!file->open(QIODevice::ReadWrite | QIODevice::Append)) {
+        qWarning() << "[SmtpSpool] Cannot open" << file->fileName() << file->errorString();
+        delete file;
+        return false;
+    }
+
+    int previous = writeSegment ? writeSegmentNumber : -1;
+
+    segments.insert(segment, file);
+    writeSegment = file;
+    writeSegmentNumber = segment;
+
+    if (previous >= 0)
+        releaseSegment(previous);
+    return true;
+}
+
+/**
+ * Reads the envelope of a message back from its segment and checks that
+ * the record is complete.
+ */
+bool SmtpSpool::readRecord(quint64 id, Record &record)
+{
+    QFile *file = segmentFile(record.segment);
+    if (!file || record.offset < 0 || file->size() < record.offset + record.length)
+        return false;
+
+    if (!file->seek(record.offset))
+        return false;
+
+    QDataStream in(file);
+    quint32 magic;
+    quint64 recordId;
+    in >> magic >> recordId;
+    if (magic != SegmentMagic || recordId != id)
+        return false;
+
+    record.envelope = readEnvelope(in);
+    in >> record.dataLength;
+    record.dataOffset = file->pos();
+    record.mapped = 0;
+
+    return in.status() == QDataStream::Ok
+            && record.dataOffset + record.dataLength == record.offset + record.length;
+}
+
+/**
+ * Replaces the index log with the current state of every message. The new
+ * log is synced and renamed over the old one, a crash leaves either of them.
+ */
+bool SmtpSpool::writeIndex()
+{
+    QString fileName = QDir(path).filePath("index.log");
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    QDataStream out(&file);
+
+    // Keeps ids growing when the newest message is already gone
+    if (nextId > 1 && !records.contains(nextId - 1)) {
+        Record marker;
+        marker.state = Removed;
+        marker.segment = -1;
+        marker.offset = 0;
+        marker.length = 0;
+        writeIndexRecord(out, nextId - 1, marker);
+    }
+
+    for (QMap<quint64, Record>::const_iterator it = records.constBegin(); it != records.constEnd(); ++it)
+        writeIndexRecord(out, it.key(), it.value());
+
+    if (!file.commit()) {
+        qWarning() << "[SmtpSpool] Cannot write" << fileName << file.errorString();
+        return false;
+    }
+
+    delete index;
+    index = new QFile(fileName);
+    if (!index->open(QIODevice::WriteOnly | QIODevice::Append)) {
+        delete index;
+        index = 0;
+        return false;
+    }
+    return true;
+}
+
+void SmtpSpool::writeIndexRecord(QDataStream &out, quint64 id, const Record &record) const
+{
+    out << IndexMagic << id << quint8(record.state) << qint32(record.segment)
+        << record.offset << record.length;
+}
+
+void SmtpSpool::unmap(Record &record)
+{
+    if (!record.mapped)
+        return;
+
+    QFile *file = segments.value(record.segment);
+    if (file)
+        file->unmap(record.mapped);
+    record.mapped = 0;
+}
+
+/**
+ * Deletes the segment once none of its messages is needed anymore. The
+ * segment being written is kept.
+ */
+void SmtpSpool::releaseSegment(int segment)
+{
+    if (segmentUse.value(segment) > 0 || segment == writeSegmentNumber)
+        return;
+
+    segmentUse.remove(segment);
+    delete segments.take(segment);
+    QFile::remove(segmentFileName(segment));
+}
+
+void SmtpSpool::scheduleSync(bool immediate)
+{
+    if (immediate || pendingIndex.size() >= syncBatchSize)
+        sync();
+    else if (!syncTimer.isActive())
+        syncTimer.start(syncInterval);
+}
+
+bool SmtpSpool::isDropped(State state)
+{
+    return state == Delivered || state == Removed;
+}
+
+bool SmtpSpool::syncFile(QFile *file)
+{
+    if (!file->flush())
+        return false;
+
+#ifdef Q_OS_WIN
+    return _commit(file->handle()) == 0;
+#else
+    return ::fsync(file->handle()) == 0;
+#endif
+}
+
+/* [5] --- */
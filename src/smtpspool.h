@@ -0,0 +1,183 @@
+#ifndef SMTPSPOOL_H
+#define SMTPSPOOL_H
+
+#include <QObject>
+#include <QMap>
+#include <QHash>
+#include <QList>
+#include <QTimer>
+#include "smtpmime_global.h"
+#include "smtpenvelope.h"
+
+class QFile;
+class QDataStream;
+class SmtpClient;
+
+/**
+ * @brief Crash-safe on-disk queue of outbound messages.
+ *
+ * Messages are stored serialized, together with their envelope, in
+ * append-only segment files. The delivery state of every message is kept in
+ * an append-only index log of fixed-size records; the last record of a
+ * message wins. Segment data is synced before the index records that point
+ * to it, so the index never refers to bytes that did not reach the disk.
+ *
+ * Records are synced in batches, after setSyncBatchSize() changes or
+ * setSyncInterval() milliseconds, or when sync() is called. The Committing
+ * state, written right before the final dot of DATA (or BDAT LAST), is
+ * synced at once.
+ *
+ * On open() the spool is recovered: messages that were being sent go back
+ * to Queued, messages that were committing become Uncertain (the server may
+ * have accepted them, so they are never sent again automatically), torn
+ * records are dropped and the index is compacted. Segments whose messages
+ * were all delivered or removed are deleted.
+ *
+ * Messages are read back by mapping their range of the segment file, the
+ * data of an Entry is only valid until its message leaves the Sending or
+ * Committing state.
+ *
+ * deliver() keeps only the recipients that may still get the message:
+ * the ones the server deferred (or never answered) are queued again as a
+ * new message with the same data, rejected ones are dropped.
+ */
+class SMTP_MIME_EXPORT SmtpSpool : public QObject
+{
+    Q_OBJECT
+public:
+
+    enum State
+    {
+        Queued,
+        Sending,
+        Committing,
+        Delivered,
+        Failed,
+        Uncertain,
+        Removed
+    };
+
+    struct Entry
+    {
+        Entry() : id(0), state(Queued), retryId(0) {}
+
+        quint64 id;
+        State state;
+        SmtpEnvelope envelope;
+        QByteArray data;
+        quint64 retryId;
+    };
+
+    /* [1] Constructors and Destructors */
+
+    SmtpSpool(const QString &path, QObject *parent = 0);
+    ~SmtpSpool();
+
+    /* [1] --- */
+
+
+    /* [2] Getters and Setters */
+
+    QString getPath() const;
+
+    qint64 getSegmentSize() const;
+    void setSegmentSize(qint64 size);
+
+    int getSyncBatchSize() const;
+    void setSyncBatchSize(int count);
+
+    int getSyncInterval() const;
+    void setSyncInterval(int msec);
+
+    bool isOpen() const;
+
+    State getState(quint64 id) const;
+    QList<quint64> getIds(State state) const;
+    int count(State state) const;
+
+    /* [2] --- */
+
+
+    /* [3] Public methods */
+
+    bool open();
+    void close();
+
+    quint64 enqueue(const SmtpEnvelope &envelope, const QByteArray &data);
+    quint64 enqueue(MimeMessage &message);
+
+    bool takeNext(Entry &entry);
+    bool setState(quint64 id, State state);
+    bool remove(quint64 id);
+
+    bool deliver(SmtpClient *client, Entry &entry, int msec = 30000);
+
+    bool sync();
+    bool compact();
+
+    /* [3] --- */
+
+protected slots:
+
+    /* [4] Protected slots */
+
+    void syncTimeout();
+    void clientCommitting();
+
+    /* [4] --- */
+
+protected:
+
+    struct Record
+    {
+        State state;
+        int segment;
+        qint64 offset;
+        qint64 length;
+        qint64 dataOffset;
+        qint64 dataLength;
+        SmtpEnvelope envelope;
+        uchar *mapped;
+    };
+
+    /* [5] Protected members */
+
+    QString path;
+    qint64 segmentSize;
+    int syncBatchSize;
+    int syncInterval;
+
+    QFile *index;
+    QFile *writeSegment;
+    int writeSegmentNumber;
+    QHash<int, QFile*> segments;
+    QHash<int, int> segmentUse;
+
+    QMap<quint64, Record> records;
+    QList<quint64> pendingIndex;
+    quint64 nextId;
+    quint64 committingId;
+    QTimer syncTimer;
+
+    /* [5] --- */
+
+
+    /* [6] Protected methods */
+
+    QString segmentFileName(int segment) const;
+    QFile *segmentFile(int segment);
+    bool startSegment(int segment);
+    bool readRecord(quint64 id, Record &record);
+    bool writeIndex();
+    void writeIndexRecord(QDataStream &out, quint64 id, const Record &record) const;
+    void unmap(Record &record);
+    void releaseSegment(int segment);
+    void scheduleSync(bool immediate);
+
+    static bool isDropped(State state);
+    static bool syncFile(QFile *file);
+
+    /* [6] --- */
+};
+
+#endif // SMTPSPOOL_H
@@ -0,0 +1,204 @@
+#include "smtptlsprofile.h"
+
+#include <QMutexLocker>
+#include <QCryptographicHash>
+#include <QRegExp>
+
+/* [1] Constructors and Destructors */
+
+SmtpTlsProfile::SmtpTlsProfile() :
+    built(false),
+    systemCaCertificates(true),
+    protocol(QSsl::TlsV1_2OrLater)
+{
+}
+
+SmtpTlsProfile::~SmtpTlsProfile()
+{
+}
+
+/**
+ * @brief Returns the profile used by clients that were not given one. It
+ * trusts the system CA certificates and accepts TLS 1.2 or later.
+ */
+SmtpTlsProfile *SmtpTlsProfile::defaultProfile()
+{
+    static SmtpTlsProfile profile;
+    return &profile;
+}
+
+/* [1] --- */
+
+
+/* [2] Getters and Setters */
+
+/**
+ * @brief Replaces the trusted CA certificates, the system ones are no longer
+ * used.
+ */
+void SmtpTlsProfile::setCaCertificates(const QList<QSslCertificate> &certificates)
+{
+    QMutexLocker locker(&mutex);
+    this->caCertificates = certificates;
+    this->systemCaCertificates = false;
+    built = false;
+}
+
+/**
+ * @brief Trusts the certificates found at path (a file or a wildcard
+ * pattern) in addition to the current ones. Returns false if none was found.
+ */
+bool SmtpTlsProfile::addCaCertificates(const QString &path, QSsl::EncodingFormat format)
+{
+    QList<QSslCertificate> certificates = QSslCertificate::fromPath(path, format, QRegExp::Wildcard);
+    if (certificates.isEmpty())
+        return false;
+
+    QMutexLocker locker(&mutex);
+    this->caCertificates << certificates;
+    built = false;
+    return true;
+}
+
+QList<QSslCertificate> SmtpTlsProfile::getCaCertificates() const
+{
+    return getConfiguration().caCertificates();
+}
+
+void SmtpTlsProfile::setCiphers(const QList<QSslCipher> &ciphers)
+{
+    QMutexLocker locker(&mutex);
+    this->ciphers = ciphers;
+    built = false;
+}
+
+/**
+ * @brief Sets the ciphers from an OpenSSL style list separated by ':'.
+ * Unknown names are skipped.
+ */
+void SmtpTlsProfile::setCiphers(const QString &names)
+{
+    QList<QSslCipher> list;
+    foreach (const QString &name, names.split(':', QString::SkipEmptyParts)) {
+        QSslCipher cipher(name);
+        if (!cipher.isNull())
+            list << cipher;
+    }
+    setCiphers(list);
+}
+
+QList<QSslCipher> SmtpTlsProfile::getCiphers() const
+{
+    return getConfiguration().ciphers();
+}
+
+/**
+ * @brief Sets the protocols accepted, e.g. QSsl::TlsV1_2OrLater to refuse
+ * anything older than TLS 1.2.
+ */
+void SmtpTlsProfile::setProtocol(QSsl::SslProtocol protocol)
+{
+    QMutexLocker locker(&mutex);
+    this->protocol = protocol;
+    built = false;
+}
+
+QSsl::SslProtocol SmtpTlsProfile::getProtocol() const
+{
+    QMutexLocker locker(&mutex);
+    return protocol;
+}
+
+/**
+ * @brief Sets the SHA-256 digests of the certificates the server has to
+ * present. An empty list disables pinning.
+ */
+void SmtpTlsProfile::setPinnedCertificates(const QList<QByteArray> &digests)
+{
+    QMutexLocker locker(&mutex);
+    this->pinnedCertificates = digests;
+}
+
+/**
+ * @brief Adds the SHA-256 digest (raw or hex encoded) of a certificate the
+ * server may present.
+ */
+void SmtpTlsProfile::addPinnedCertificate(const QByteArray &digest)
+{
+    QMutexLocker locker(&mutex);
+    this->pinnedCertificates << (digest.size() == 64 ? QByteArray::fromHex(digest) : digest);
+}
+
+QList<QByteArray> SmtpTlsProfile::getPinnedCertificates() const
+{
+    QMutexLocker locker(&mutex);
+    return pinnedCertificates;
+}
+
+/**
+ * @brief Returns the configuration for new sockets, building it on the
+ * first call.
+ */
+QSslConfiguration SmtpTlsProfile::getConfiguration() const
+{
+    QMutexLocker locker(&mutex);
+    if (!built)
+        build();
+    return configuration;
+}
+
+/* [2] --- */
+
+
+/* [3] Public methods */
+
+/**
+ * @brief Builds the configuration (and loads the system CA certificates)
+ * now, e.g. at startup, instead of on the first connection.
+ */
+void SmtpTlsProfile::preload()
+{
+    getConfiguration();
+}
+
+/**
+ * @brief Returns true if no certificate is pinned, or if one of the
+ * certificates in the chain is.
+ */
+bool SmtpTlsProfile::isPinned(const QList<QSslCertificate> &chain) const
+{
+    QMutexLocker locker(&mutex);
+    if (pinnedCertificates.isEmpty())
+        return true;
+
+    foreach (const QSslCertificate &certificate, chain) {
+        if (pinnedCertificates.contains(certificate.digest(QCryptographicHash::Sha256)))
+            return true;
+    }
+    return false;
+}
+
+/* [3] --- */
+
+
+/* [4] Protected methods */
+
+void SmtpTlsProfile::build() const
+{
+    QSslConfiguration config = QSslConfiguration::defaultConfiguration();
+
+    QList<QSslCertificate> certificates = caCertificates;
+    if (systemCaCertificates)
+        certificates = QSslConfiguration::systemCaCertificates() + certificates;
+    config.setCaCertificates(certificates);
+
+    if (!ciphers.isEmpty())
+        config.setCiphers(ciphers);
+
+    config.setProtocol(protocol);
+
+    configuration = config;
+    built = true;
+}
+
+/* [4] --- */
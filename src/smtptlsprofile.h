@@ -0,0 +1,91 @@
+#ifndef SMTPTLSPROFILE_H
+#define SMTPTLSPROFILE_H
+
+#include <QList>
+#include <QMutex>
+#include <QtNetwork/QSslCertificate>
+#include <QtNetwork/QSslCipher>
+#include <QtNetwork/QSslConfiguration>
+#include "smtpmime_global.h"
+
+/**
+ * @brief TLS settings shared by SmtpClient instances: CA certificates,
+ * ciphers, the lowest accepted protocol and optionally pinned certificates.
+ *
+ * The QSslConfiguration is built once (on preload() or the first connection)
+ * and then handed to every socket as an implicitly shared copy, so the CA
+ * store is not loaded again for each client. Clients and pools use
+ * defaultProfile() unless they are given another one. A profile may be used
+ * from several threads.
+ */
+class SMTP_MIME_EXPORT SmtpTlsProfile
+{
+public:
+
+    /* [1] Constructors and Destructors */
+
+    SmtpTlsProfile();
+    ~SmtpTlsProfile();
+
+    static SmtpTlsProfile *defaultProfile();
+
+    /* [1] --- */
+
+
+    /* [2] Getters and Setters */
+
+    void setCaCertificates(const QList<QSslCertificate> &certificates);
+    bool addCaCertificates(const QString &path, QSsl::EncodingFormat format = QSsl::Pem);
+    QList<QSslCertificate> getCaCertificates() const;
+
+    void setCiphers(const QList<QSslCipher> &ciphers);
+    void setCiphers(const QString &names);
+    QList<QSslCipher> getCiphers() const;
+
+    void setProtocol(QSsl::SslProtocol protocol);
+    QSsl::SslProtocol getProtocol() const;
+
+    void setPinnedCertificates(const QList<QByteArray> &digests);
+    void addPinnedCertificate(const QByteArray &digest);
+    QList<QByteArray> getPinnedCertificates() const;
+
+    QSslConfiguration getConfiguration() const;
+
+    /* [2] --- */
+
+
+    /* [3] Public methods */
+
+    void preload();
+    bool isPinned(const QList<QSslCertificate> &chain) const;
+
+    /* [3] --- */
+
+protected:
+
+    /* [4] Protected members */
+
+    mutable QMutex mutex;
+    mutable QSslConfiguration configuration;
+    mutable bool built;
+
+    QList<QSslCertificate> caCertificates;
+    bool systemCaCertificates;
+    QList<QSslCipher> ciphers;
+    QSsl::SslProtocol protocol;
+    QList<QByteArray> pinnedCertificates;
+
+    /* [4] --- */
+
+
+    /* [5] Protected methods */
+
+    void build() const;
+
+    /* [5] --- */
+
+private:
+    Q_DISABLE_COPY(SmtpTlsProfile)
+};
+
+#endif // SMTPTLSPROFILE_H
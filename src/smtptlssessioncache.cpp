@@ -0,0 +1,221 @@
+#include "smtptlssessioncache.h"
+
+#include <QDateTime>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QtNetwork/QSslSocket>
+#include <QtNetwork/QSslConfiguration>
+
+namespace {
+
+struct SessionEntry
+{
+    QByteArray session;
+    QDateTime expires;
+};
+
+QMutex sessionMutex;
+QHash<QString, SessionEntry> sessionEntries;
+bool sessionCacheEnabled = true;
+int sessionMaxAge = 2 * 60 * 60;
+int handshakes = 0;
+int offered = 0;
+
+const char *OfferedProperty = "smtpTlsSessionOffered";
+
+QString sessionKey(const QString &host, int port)
+{
+    return host.toLower() + ":" + QString::number(port);
+}
+
+}
+
+/* [1] Cache */
+
+/**
+ * @brief Returns the session stored for the server, or an empty array if
+ * there is none or it has expired.
+ */
+QByteArray SmtpTlsSessionCache::lookup(const QString &host, int port)
+{
+    QMutexLocker locker(&sessionMutex);
+
+    if (!sessionCacheEnabled)
+        return QByteArray();
+
+    QHash<QString, SessionEntry>::iterator it = sessionEntries.find(sessionKey(host, port));
+    if (it == sessionEntries.end())
+        return QByteArray();
+
+    if (it->expires < QDateTime::currentDateTimeUtc()) {
+        sessionEntries.erase(it);
+        return QByteArray();
+    }
+
+    return it->session;
+}
+
+/**
+ * @brief Stores the session of the server. lifetimeHint (in seconds, as
+ * announced with the ticket) shortens the maximum age when it is set.
+ */
+void SmtpTlsSessionCache::insert(const QString &host, int port, const QByteArray &session, int lifetimeHint)
+{
+    if (session.isEmpty())
+        return;
+
+    QMutexLocker locker(&sessionMutex);
+
+    if (!sessionCacheEnabled)
+        return;
+
+    int age = sessionMaxAge;
+    if (lifetimeHint > 0 && lifetimeHint < age)
+        age = lifetimeHint;
+
+    SessionEntry entry;
+    entry.session = session;
+    entry.expires = QDateTime::currentDateTimeUtc().addSecs(age);
+    sessionEntries.insert(sessionKey(host, port), entry);
+}
+
+void SmtpTlsSessionCache::remove(const QString &host, int port)
+{
+    QMutexLocker locker(&sessionMutex);
+    sessionEntries.remove(sessionKey(host, port));
+}
+
+void SmtpTlsSessionCache::clear()
+{
+    QMutexLocker locker(&sessionMutex);
+    sessionEntries.clear();
+}
+
+/**
+ * @brief Turns session reuse on or off for all clients. Disabling it also
+ * drops the stored sessions.
+ */
+void SmtpTlsSessionCache::setEnabled(bool enabled)
+{
+    QMutexLocker locker(&sessionMutex);
+    sessionCacheEnabled = enabled;
+    if (!enabled)
+        sessionEntries.clear();
+}
+
+bool SmtpTlsSessionCache::isEnabled()
+{
+    QMutexLocker locker(&sessionMutex);
+    return sessionCacheEnabled;
+}
+
+/**
+ * @brief Sets how long (in seconds) a session is kept at most.
+ */
+void SmtpTlsSessionCache::setMaxAge(int secs)
+{
+    QMutexLocker locker(&sessionMutex);
+    sessionMaxAge = secs;
+}
+
+int SmtpTlsSessionCache::getMaxAge()
+{
+    QMutexLocker locker(&sessionMutex);
+    return sessionMaxAge;
+}
+
+/* [1] --- */
+
+
+/* [2] Socket helpers */
+
+/**
+ * @brief Configures the socket before its handshake: keeps the session data
+ * available after the handshake and offers the stored session, if any.
+ */
+void SmtpTlsSessionCache::prepare(QSslSocket *socket, const QString &host, int port)
+{
+    if (!isEnabled())
+        return;
+
+    QByteArray session = lookup(host, port);
+
+    QSslConfiguration config = socket->sslConfiguration();
+    config.setSslOption(QSsl::SslOptionDisableSessionPersistence, false);
+    config.setSessionTicket(session);
+    socket->setSslConfiguration(config);
+    socket->setProperty(OfferedProperty, !session.isEmpty());
+}
+
+/**
+ * @brief Counts the handshake of the encrypted socket and stores its
+ * session, if it is already known.
+ */
+void SmtpTlsSessionCache::update(QSslSocket *socket, const QString &host, int port)
+{
+    if (!isEnabled())
+        return;
+
+    {
+        QMutexLocker locker(&sessionMutex);
+        handshakes++;
+        if (socket->property(OfferedProperty).toBool())
+            offered++;
+    }
+
+    store(socket, host, port);
+}
+
+/**
+ * @brief Stores the current session of the socket. Called again for every
+ * ticket the server sends after the handshake.
+ */
+void SmtpTlsSessionCache::store(QSslSocket *socket, const QString &host, int port)
+{
+    QSslConfiguration config = socket->sslConfiguration();
+    insert(host, port, config.sessionTicket(), config.sessionTicketLifeTimeHint());
+}
+
+/* [2] --- */
+
+
+/* [3] Counters */
+
+/**
+ * @brief Returns the number of handshakes seen since the last reset.
+ */
+int SmtpTlsSessionCache::getHandshakes()
+{
+    QMutexLocker locker(&sessionMutex);
+    return handshakes;
+}
+
+/**
+ * @brief Returns the number of handshakes that offered a stored session.
+ * The server may still have done a full handshake.
+ */
+int SmtpTlsSessionCache::getOffered()
+{
+    QMutexLocker locker(&sessionMutex);
+    return offered;
+}
+
+/**
+ * @brief Returns the share of handshakes that offered a stored session,
+ * between 0 and 1.
+ */
+double SmtpTlsSessionCache::getHitRate()
+{
+    QMutexLocker locker(&sessionMutex);
+    return handshakes > 0 ? double(offered) / handshakes : 0.0;
+}
+
+void SmtpTlsSessionCache::resetCounters()
+{
+    QMutexLocker locker(&sessionMutex);
+    handshakes = 0;
+    offered = 0;
+}
+
+/* [3] --- */
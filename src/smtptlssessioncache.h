@@ -0,0 +1,51 @@
+#ifndef SMTPTLSSESSIONCACHE_H
+#define SMTPTLSSESSIONCACHE_H
+
+#include <QString>
+#include <QByteArray>
+#include "smtpmime_global.h"
+
+class QSslSocket;
+
+/**
+ * @brief Process-wide cache of TLS sessions, keyed by host and port.
+ *
+ * The client stores the session data (ticket or session ID) of the
+ * connection and offers it on the next connection to the same server, so
+ * the server can resume the session with an abbreviated handshake. TLS 1.2
+ * sessions are known after the handshake, TLS 1.3 tickets arrive later and
+ * are stored when the socket receives them (Qt 5.15 and later). Sessions
+ * are kept for the lifetime hint given by the server.
+ *
+ * Qt does not tell if the server accepted an offered session, so the
+ * counters only report how often the cache had a session to offer.
+ */
+class SMTP_MIME_EXPORT SmtpTlsSessionCache
+{
+public:
+
+    static QByteArray lookup(const QString &host, int port);
+    static void insert(const QString &host, int port, const QByteArray &session, int lifetimeHint = 0);
+    static void remove(const QString &host, int port);
+    static void clear();
+
+    static void setEnabled(bool enabled);
+    static bool isEnabled();
+
+    static void setMaxAge(int secs);
+    static int getMaxAge();
+
+    static void prepare(QSslSocket *socket, const QString &host, int port);
+    static void update(QSslSocket *socket, const QString &host, int port);
+    static void store(QSslSocket *socket, const QString &host, int port);
+
+    static int getHandshakes();
+    static int getOffered();
+    static double getHitRate();
+    static void resetCounters();
+
+private:
+    SmtpTlsSessionCache();
+};
+
+#endif // SMTPTLSSESSIONCACHE_H
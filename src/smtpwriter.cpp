@@ -0,0 +1,435 @@
+#include "smtpwriter.h"
+
+#include <QFile>
+#include <QSocketNotifier>
+#include <QtNetwork/QSslSocket>
+
+#ifdef Q_OS_LINUX
+#include <sys/sendfile.h>
+#include <errno.h>
+#endif
+
+static const qint64 BLOCK_SIZE = 64 * 1024;
+
+/* [1] Constructors and Destructors */
+
+SmtpWriter::SmtpWriter(QObject *parent) :
+    QObject(parent),
+    socket(0),
+    notifier(0),
+    zeroCopyEnabled(true),
+    processing(false)
+{
+    // Reserved capacity survives resize(0), so the buffer is reused
+    batch.reserve(4096);
+}
+
+SmtpWriter::~SmtpWriter()
+{
+    clear();
+}
+
+/* [1] --- */
+
+
+/* [2] Getters and Setters */
+
+/**
+ * @brief Sets the socket the queue is written to. Anything still queued for
+ * the previous socket is dropped.
+ */
+void SmtpWriter::setSocket(QTcpSocket *socket)
+{
+    clear();
+
+    delete notifier;
+    notifier = 0;
+
+    this->socket = socket;
+    if (socket)
+        connect(socket, SIGNAL(bytesWritten(qint64)), this, SLOT(process()));
+}
+
+QTcpSocket *SmtpWriter::getSocket() const
+{
+    return socket;
+}
+
+/**
+ * @brief Sets if file ranges may be sent with sendfile() when the connection
+ * is not encrypted.
+ */
+void SmtpWriter::setZeroCopyEnabled(bool enabled)
+{
+    this->zeroCopyEnabled = enabled;
+}
+
+bool SmtpWriter::isZeroCopyEnabled() const
+{
+    return zeroCopyEnabled;
+}
+
+/**
+ * @brief Returns true if everything has been handed over to the socket.
+ */
+bool SmtpWriter::isEmpty() const
+{
+    return queue.isEmpty();
+}
+
+/* [2] --- */
+
+
+/* [3] Public methods */
+
+/**
+ * @brief Adds the command and its CRLF to the batch.
+ */
+void SmtpWriter::appendCommand(const QByteArray &command)
+{
+    batch.append(command);
+    batch.append("\r\n", 2);
+}
+
+/**
+ * @brief Adds prefix, the UTF-8 form of argument, suffix and CRLF to the
+ * batch, without building the command as a string first.
+ */
+void SmtpWriter::appendCommand(const char *prefix, const QString &argument, const QByteArray &suffix)
+{
+    batch.append(prefix);
+    appendUtf8(argument);
+    batch.append(suffix);
+    batch.append("\r\n", 2);
+}
+
+/**
+ * @brief Adds raw bytes to the batch. Meant for small pieces of data, large
+ * ones should be given to write().
+ */
+void SmtpWriter::append(const QByteArray &data)
+{
+    batch.append(data);
+}
+
+/**
+ * @brief Hands the batch over to the socket in one write.
+ */
+void SmtpWriter::flush()
+{
+    if (batch.isEmpty())
+        return;
+
+    enqueue(batch);
+    batch.resize(0);
+}
+
+/**
+ * @brief Writes the data after the batch, which is flushed first.
+ */
+void SmtpWriter::write(const QByteArray &data)
+{
+    flush();
+    enqueue(data);
+}
+
+/**
+ * @brief Queues length bytes of the file starting at offset, after the
+ * batch. The device must stay alive until the range has been written.
+ */
+void SmtpWriter::writeFile(QIODevice *file, qint64 offset, qint64 length)
+{
+    flush();
+
+    Operation op;
+    op.isFile = true;
+    op.file = file;
+    op.offset = offset;
+    op.length = length;
+    op.opened = false;
+    op.base64 = false;
+    op.fileSize = 0;
+    queue.append(op);
+
+    process();
+}
+
+/**
+ * @brief Queues a range of the base64 encoding of the file, in the line
+ * layout of MimeBase64Formatter. offset and length count encoded bytes, so
+ * the range may start or end in the middle of a line.
+ */
+void SmtpWriter::writeBase64File(QIODevice *file, qint64 fileSize, qint64 offset, qint64 length)
+{
+    flush();
+
+    Operation op;
+    op.isFile = true;
+    op.file = file;
+    op.offset = offset;
+    op.length = length;
+    op.opened = false;
+    op.base64 = true;
+    op.fileSize = fileSize;
+    queue.append(op);
+
+    process();
+}
+
+void SmtpWriter::clear()
+{
+    batch.resize(0);
+
+    foreach (const Operation &op, queue) {
+        if (op.opened && op.file)
+            op.file->close();
+    }
+    queue.clear();
+
+    if (notifier)
+        notifier->setEnabled(false);
+}
+
+/* [3] --- */
+
+
+/* [4] Protected slots */
+
+void SmtpWriter::process()
+{
+    if (processing || !socket || queue.isEmpty())
+        return;
+
+    processing = true;
+
+    while (!queue.isEmpty()) {
+        Operation &op = queue.first();
+
+        if (!op.isFile) {
+            socket->write(op.data);
+            queue.removeFirst();
+            continue;
+        }
+
+        // Wait for the socket before continuing with the file
+        if (!writeFileRange(op))
+            break;
+
+        if (op.opened)
+            op.file->close();
+        queue.removeFirst();
+    }
+
+    processing = false;
+
+    if (queue.isEmpty())
+        emit drained();
+}
+
+void SmtpWriter::socketWritable()
+{
+    notifier->setEnabled(false);
+    process();
+}
+
+/* [4] --- */
+
+
+/* [5] Protected methods */
+
+void SmtpWriter::enqueue(const QByteArray &data)
+{
+    if (queue.isEmpty()) {
+        socket->write(data);
+        return;
+    }
+
+    Operation op;
+    op.isFile = false;
+    op.data = data;
+    op.offset = 0;
+    op.length = data.size();
+    op.opened = false;
+    op.base64 = false;
+    op.fileSize = 0;
+    queue.append(op);
+}
+
+void SmtpWriter::appendUtf8(const QString &text)
+{
+    // Addresses are mostly ASCII and can be copied byte by byte
+    const QChar *chars = text.constData();
+    for (int i = 0; i < text.size(); ++i) {
+        ushort c = chars[i].unicode();
+        if (c >= 0x80) {
+            batch.append(text.midRef(i).toUtf8());
+            return;
+        }
+        batch.append(char(c));
+    }
+}
+
+bool SmtpWriter::writeFileRange(Operation &op)
+{
+    if (!op.file) {
+        abort("File deleted before it was sent");
+        return false;
+    }
+
+    if (!op.file->isOpen()) {
+        if (!op.file->open(QIODevice::ReadOnly)) {
+            abort("Cannot open file");
+            return false;
+        }
+        op.opened = true;
+    }
+
+    if (op.base64)
+        return writeBase64Range(op);
+
+    bool done;
+    if (sendFileRange(op, done))
+        return done;
+
+    // Copy the file in blocks, without filling the socket's write buffer
+    while (op.length > 0) {
+        if (socket->bytesToWrite() >= BLOCK_SIZE)
+            return false;
+
+        if (!op.file->seek(op.offset)) {
+            abort("Cannot seek in file");
+            return false;
+        }
+
+        QByteArray block = op.file->read(qMin(op.length, BLOCK_SIZE));
+        if (block.isEmpty()) {
+            abort("Unexpected end of file");
+            return false;
+        }
+
+        socket->write(block);
+        op.offset += block.size();
+        op.length -= block.size();
+    }
+
+    return true;
+}
+
+/**
+ * Encodes the range from whole lines of 57 bytes, a line cut by the start
+ * of the range is encoded again and its head dropped.
+ */
+bool SmtpWriter::writeBase64Range(Operation &op)
+{
+    // An empty base64 part is still one (empty) line
+    if (op.fileSize == 0) {
+        socket->write(QByteArray("\r\n").mid(op.offset, op.length));
+        op.length = 0;
+        return true;
+    }
+
+    QByteArray lines;
+    while (op.length > 0) {
+        if (socket->bytesToWrite() >= BLOCK_SIZE)
+            return false;
+
+        qint64 line = op.offset / 78;
+        qint64 skip = op.offset % 78;
+        qint64 size = qMin(op.fileSize - line * 57, BLOCK_SIZE / 78 * 57);
+
+        if (!op.file->seek(line * 57)) {
+            abort("Cannot seek in file");
+            return false;
+        }
+
+        QByteArray block = op.file->read(size);
+        if (block.size() != size) {
+            abort("Unexpected end of file");
+            return false;
+        }
+
+        QByteArray encoded = block.toBase64();
+        lines.resize(0);
+        for (int i = 0; i < encoded.size(); i += 76) {
+            lines.append(encoded.constData() + i, qMin(76, encoded.size() - i));
+            lines.append("\r\n", 2);
+        }
+
+        qint64 n = qMin(op.length, lines.size() - skip);
+        socket->write(lines.constData() + skip, n);
+        op.offset += n;
+        op.length -= n;
+    }
+
+    return true;
+}
+
+/**
+ * @brief Sends the file range with sendfile(). Returns false if the range
+ * cannot be sent this way, otherwise done tells if the whole range was sent
+ * or the writer has to wait for the socket.
+ */
+bool SmtpWriter::sendFileRange(Operation &op, bool &done)
+{
+#ifdef Q_OS_LINUX
+    QFile *file = qobject_cast<QFile*>(op.file.data());
+    if (!zeroCopyEnabled || !file || file->handle() < 0 || qobject_cast<QSslSocket*>(socket))
+        return false;
+
+    // Data still buffered by Qt has to reach the kernel before the file
+    if (socket->bytesToWrite() > 0) {
+        socket->flush();
+        if (socket->bytesToWrite() > 0) {
+            done = false;
+            return true;
+        }
+    }
+
+    int fd = socket->socketDescriptor();
+    while (op.length > 0) {
+        off_t offset = op.offset;
+        ssize_t n = ::sendfile(fd, file->handle(), &offset, qMin<qint64>(op.length, 0x7ffff000));
+
+        if (n > 0) {
+            op.offset += n;
+            op.length -= n;
+            continue;
+        }
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            if (notifier && notifier->socket() != fd) {
+                delete notifier;
+                notifier = 0;
+            }
+            if (!notifier) {
+                notifier = new QSocketNotifier(fd, QSocketNotifier::Write, this);
+                connect(notifier, SIGNAL(activated(int)), this, SLOT(socketWritable()));
+            }
+            notifier->setEnabled(true);
+            done = false;
+            return true;
+        }
+
+        // sendfile() refused the file, the rest is copied
+        return false;
+    }
+
+    done = true;
+    return true;
+#else
+    Q_UNUSED(op);
+    Q_UNUSED(done);
+    return false;
+#endif
+}
+
+void SmtpWriter::abort(const char *reason)
+{
+    clear();
+    emit error(QString(reason));
+}
+
+/* [5] --- */
@@ -0,0 +1,114 @@
+#ifndef SMTPWRITER_H
+#define SMTPWRITER_H
+
+#include <QObject>
+#include <QList>
+#include <QPointer>
+#include <QByteArray>
+#include "smtpmime_global.h"
+
+class QIODevice;
+class QTcpSocket;
+class QSocketNotifier;
+
+/**
+ * @brief Ordered output queue of an SmtpClient connection.
+ *
+ * Commands and message bodies are written through the writer so that they
+ * reach the socket in order, even when a file range has to wait for the
+ * socket to become writable. On Linux, file ranges of plain TCP connections
+ * are sent with sendfile() and never copied into user space. Base64 file
+ * ranges are encoded block by block while they are written.
+ *
+ * Commands are composed as bytes in one reusable batch buffer and handed to
+ * the socket with a single write by flush(), which the client calls only
+ * where it has to wait for a reply.
+ */
+class SMTP_MIME_EXPORT SmtpWriter : public QObject
+{
+    Q_OBJECT
+public:
+
+    /* [1] Constructors and Destructors */
+
+    SmtpWriter(QObject *parent = 0);
+    ~SmtpWriter();
+
+    /* [1] --- */
+
+
+    /* [2] Getters and Setters */
+
+    void setSocket(QTcpSocket *socket);
+    QTcpSocket *getSocket() const;
+
+    void setZeroCopyEnabled(bool enabled);
+    bool isZeroCopyEnabled() const;
+
+    bool isEmpty() const;
+
+    /* [2] --- */
+
+
+    /* [3] Public methods */
+
+    void appendCommand(const QByteArray &command);
+    void appendCommand(const char *prefix, const QString &argument,
+                       const QByteArray &suffix = QByteArray());
+    void append(const QByteArray &data);
+    void flush();
+
+    void write(const QByteArray &data);
+    void writeFile(QIODevice *file, qint64 offset, qint64 length);
+    void writeBase64File(QIODevice *file, qint64 fileSize, qint64 offset, qint64 length);
+    void clear();
+
+    /* [3] --- */
+
+signals:
+    void drained();
+    void error(const QString &text);
+
+protected slots:
+    void process();
+    void socketWritable();
+
+protected:
+
+    struct Operation
+    {
+        bool isFile;
+        QByteArray data;
+        QPointer<QIODevice> file;
+        qint64 offset;
+        qint64 length;
+        bool opened;
+        bool base64;
+        qint64 fileSize;
+    };
+
+    /* [4] Protected members */
+
+    QPointer<QTcpSocket> socket;
+    QSocketNotifier *notifier;
+    QList<Operation> queue;
+    QByteArray batch;
+    bool zeroCopyEnabled;
+    bool processing;
+
+    /* [4] --- */
+
+
+    /* [5] Protected methods */
+
+    void enqueue(const QByteArray &data);
+    void appendUtf8(const QString &text);
+    bool writeFileRange(Operation &op);
+    bool writeBase64Range(Operation &op);
+    bool sendFileRange(Operation &op, bool &done);
+    void abort(const char *reason);
+
+    /* [5] --- */
+};
+
+#endif // SMTPWRITER_H
@@ -0,0 +1,169 @@
+#include "connectortest.h"
+#include <QtTest/QtTest>
+#include <QTcpServer>
+#include <QTcpSocket>
+#include "../src/smtpconnector.h"
+#include "../src/smtpclient.h"
+
+#ifdef Q_OS_LINUX
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
+StubResolver::StubResolver(QObject *parent) :
+    SmtpResolver(parent),
+    lookups(0) {}
+
+void StubResolver::lookupHost(const QString &host) {
+    lookups++;
+    emit hostFound(host, hosts.value(host), 60);
+}
+
+ConnectorTest::ConnectorTest(QObject *parent) :
+    QObject(parent) {}
+
+void ConnectorTest::init() {
+    SmtpAddressCache::clear();
+}
+
+void ConnectorTest::testSortAddresses() {
+    QHostAddress v4a("192.0.2.1"), v4b("192.0.2.2");
+    QHostAddress v6a("2001:db8::1"), v6b("2001:db8::2");
+    QList<QHostAddress> addresses;
+    addresses << v4a << v4b << v6a << v6b;
+
+    QCOMPARE(SmtpConnector::sortAddresses(addresses),
+             QList<QHostAddress>() << v6a << v4a << v6b << v4b);
+    QCOMPARE(SmtpConnector::sortAddresses(addresses, v4b),
+             QList<QHostAddress>() << v4b << v6a << v4a << v6b);
+}
+
+void ConnectorTest::testCachesAddresses() {
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    StubResolver resolver;
+    resolver.hosts.insert("relay.test", QList<QHostAddress>() << QHostAddress::LocalHost);
+
+    SmtpConnector connector;
+    connector.setResolver(&resolver);
+    QSignalSpy spy(&connector, SIGNAL(connected(QTcpSocket*)));
+
+    for (int i = 0; i < 2; ++i) {
+        connector.connectToHost("relay.test", server.serverPort());
+        QTRY_COMPARE(spy.count(), i + 1);
+        delete spy.last().at(0).value<QTcpSocket*>();
+    }
+
+    QCOMPARE(resolver.lookups, 1);
+}
+
+void ConnectorTest::testRacesAddresses() {
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    // Nothing listens on the IPv6 loopback, the IPv4 attempt has to win
+    StubResolver resolver;
+    resolver.hosts.insert("relay.test", QList<QHostAddress>()
+                          << QHostAddress::LocalHost << QHostAddress::LocalHostIPv6);
+
+    SmtpConnector connector;
+    connector.setResolver(&resolver);
+    connector.setAttemptDelay(50);
+    QSignalSpy spy(&connector, SIGNAL(connected(QTcpSocket*)));
+
+    connector.connectToHost("relay.test", server.serverPort());
+    QTRY_COMPARE(spy.count(), 1);
+
+    QTcpSocket *socket = spy.at(0).at(0).value<QTcpSocket*>();
+    QCOMPARE(socket->peerAddress(), QHostAddress(QHostAddress::LocalHost));
+    delete socket;
+
+    QCOMPARE(SmtpAddressCache::getPreferred("relay.test", server.serverPort()),
+             QHostAddress(QHostAddress::LocalHost));
+}
+
+void ConnectorTest::testRacesHangingAddress() {
+#ifdef Q_OS_LINUX
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+    quint16 port = server.serverPort();
+
+    // A listener on 127.0.0.2 whose accept queue is full: Linux drops the
+    // SYN of every further connection, connecting to it hangs
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    QVERIFY(fd >= 0);
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    inet_pton(AF_INET, "127.0.0.2", &address.sin_addr);
+    QVERIFY(::bind(fd, (sockaddr*) &address, sizeof(address)) == 0);
+    QVERIFY(::listen(fd, 0) == 0);
+
+    QTcpSocket fillers[2];
+    for (int i = 0; i < 2; ++i) {
+        fillers[i].connectToHost(QHostAddress("127.0.0.2"), port);
+        fillers[i].waitForConnected(200);
+    }
+
+    StubResolver resolver;
+    resolver.hosts.insert("relay.test", QList<QHostAddress>()
+                          << QHostAddress("127.0.0.2") << QHostAddress::LocalHost);
+
+    SmtpConnector connector;
+    connector.setResolver(&resolver);
+    connector.setAttemptDelay(100);
+    QSignalSpy spy(&connector, SIGNAL(connected(QTcpSocket*)));
+
+    // The second attempt starts after the delay and wins, long before the
+    // first one could time out
+    QElapsedTimer elapsed;
+    elapsed.start();
+    connector.connectToHost("relay.test", port);
+    QTRY_COMPARE_WITH_TIMEOUT(spy.count(), 1, 2000);
+    QVERIFY(elapsed.elapsed() < 1000);
+
+    QTcpSocket *socket = spy.at(0).at(0).value<QTcpSocket*>();
+    QCOMPARE(socket->peerAddress(), QHostAddress(QHostAddress::LocalHost));
+    delete socket;
+
+    // The hanging attempt was aborted
+    QVERIFY(!connector.isConnecting());
+    QTRY_VERIFY(connector.findChildren<QTcpSocket*>().isEmpty());
+
+    ::close(fd);
+#else
+    QSKIP("Needs a second loopback address");
+#endif
+}
+
+void ConnectorTest::testReconnectsAfterRefusal() {
+    // A port nobody listens on anymore
+    QTcpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+    quint16 port = server.serverPort();
+    server.close();
+
+    StubResolver resolver;
+    resolver.hosts.insert("relay.test", QList<QHostAddress>() << QHostAddress::LocalHost);
+
+    SmtpClient client("relay.test", port);
+    client.getConnector()->setResolver(&resolver);
+
+    QVERIFY(client.connectToHost());
+    QTRY_VERIFY(!client.getConnector()->isConnecting());
+    QCOMPARE(client.getState(), SmtpClient::UnconnectedState);
+
+    // The same client connects once the server is up
+    QVERIFY(server.listen(QHostAddress::LocalHost, port));
+    QVERIFY(client.connectToHost());
+    QTRY_VERIFY(server.hasPendingConnections());
+}
+
+void ConnectorTest::cleanup() {
+    SmtpAddressCache::clear();
+}
@@ -0,0 +1,38 @@
+#ifndef CONNECTORTEST_H
+#define CONNECTORTEST_H
+
+#include <QObject>
+#include <QHash>
+#include "../src/smtpresolver.h"
+
+class StubResolver : public SmtpResolver
+{
+    Q_OBJECT
+public:
+    StubResolver(QObject *parent = 0);
+
+    void lookupHost(const QString &host);
+
+    QHash<QString, QList<QHostAddress> > hosts;
+    int lookups;
+};
+
+class ConnectorTest : public QObject
+{
+    Q_OBJECT
+public:
+    ConnectorTest(QObject *parent = 0);
+
+private slots:
+
+    void init();
+    void cleanup();
+
+    void testSortAddresses();
+    void testCachesAddresses();
+    void testRacesAddresses();
+    void testRacesHangingAddress();
+    void testReconnectsAfterRefusal();
+};
+
+#endif // CONNECTORTEST_H
@@ -2,6 +2,10 @@
 #include <QtTest/QTest>
 #include <QDebug>
 #include "connectiontest.h"
+#include "connectortest.h"
+#include "mxdeliverytest.h"
+#include "spooltest.h"
+#include "templatetest.h"
 
 bool success = true;
 
@@ -16,6 +20,10 @@ int main(int argc, char *argv[])
     QCoreApplication a(argc, argv);
 
     runTest(new ConnectionTest(), argc, argv);
+    runTest(new ConnectorTest(), argc, argv);
+    runTest(new MxDeliveryTest(), argc, argv);
+    runTest(new SpoolTest(), argc, argv);
+    runTest(new TemplateTest(), argc, argv);
 
     if (success)
         qDebug() << "SUCCESS";
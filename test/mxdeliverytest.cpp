@@ -0,0 +1,221 @@
+#include "mxdeliverytest.h"
+#include <QtTest/QtTest>
+#include <QTcpSocket>
+#include "../src/smtpmxdelivery.h"
+#include "../src/smtpconnector.h"
+
+StubMxResolver::StubMxResolver(QObject *parent) :
+    StubResolver(parent),
+    mxLookups(0) {}
+
+void StubMxResolver::lookupMx(const QString &domain) {
+    mxLookups++;
+    if (failing.contains(domain))
+        emit mxFailed(domain, "Server failure");
+    else
+        emit mxFound(domain, exchangers.value(domain), 60);
+}
+
+StubSmtpServer::StubSmtpServer(QObject *parent) :
+    QTcpServer(parent),
+    stallData(false),
+    pipelining(false),
+    sessions(0)
+{
+    connect(this, SIGNAL(newConnection()), this, SLOT(newSession()));
+}
+
+void StubSmtpServer::newSession() {
+    while (QTcpSocket *socket = nextPendingConnection()) {
+        sessions++;
+        connect(socket, SIGNAL(readyRead()), this, SLOT(readLines()));
+        connect(socket, SIGNAL(disconnected()), socket, SLOT(deleteLater()));
+        socket->write("220 stub ESMTP\r\n");
+    }
+}
+
+void StubSmtpServer::readLines() {
+    QTcpSocket *socket = static_cast<QTcpSocket*>(sender());
+
+    while (socket->canReadLine()) {
+        QByteArray line = socket->readLine();
+
+        // Collecting the message of DATA
+        if (data.contains(socket)) {
+            if (line != ".\r\n") {
+                data[socket] += line;
+                continue;
+            }
+            messages << data.take(socket);
+            if (!stallData)
+                socket->write("250 OK queued\r\n");
+            continue;
+        }
+
+        QByteArray command = line.left(4).toUpper();
+        if (command == "EHLO" && pipelining) {
+            socket->write("250-stub\r\n250 PIPELINING\r\n");
+        } else if (command == "EHLO" || command == "HELO" || command == "MAIL" || command == "RSET"
+                || command == "NOOP") {
+            socket->write("250 OK\r\n");
+        } else if (command == "RCPT") {
+            QString rcpt(line.mid(line.indexOf('<') + 1, line.indexOf('>') - line.indexOf('<') - 1));
+            if (deferred.contains(rcpt)) {
+                socket->write("450 4.2.0 Greylisted\r\n");
+                continue;
+            }
+            recipients << rcpt;
+            socket->write("250 OK\r\n");
+        } else if (command == "DATA") {
+            data.insert(socket, QByteArray());
+            socket->write("354 Go ahead\r\n");
+        } else if (command == "QUIT") {
+            socket->write("221 Bye\r\n");
+            socket->disconnectFromHost();
+        } else {
+            socket->write("500 Unknown command\r\n");
+        }
+    }
+}
+
+MxDeliveryTest::MxDeliveryTest(QObject *parent) :
+    QObject(parent) {}
+
+void MxDeliveryTest::init() {
+    SmtpAddressCache::clear();
+}
+
+void MxDeliveryTest::testGroupsByDomain() {
+    StubSmtpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    StubMxResolver resolver;
+    resolver.exchangers.insert("a.test", QStringList() << "mx.a.test");
+    resolver.exchangers.insert("b.test", QStringList() << "mx.b.test");
+    resolver.hosts.insert("mx.a.test", QList<QHostAddress>() << QHostAddress::LocalHost);
+    resolver.hosts.insert("mx.b.test", QList<QHostAddress>() << QHostAddress::LocalHost);
+
+    SmtpMxDelivery delivery;
+    delivery.setResolver(&resolver);
+    delivery.setPort(server.serverPort());
+    delivery.setTimeout(5000);
+    QSignalSpy spy(&delivery, SIGNAL(domainFinished(QString,SmtpResult)));
+
+    SmtpEnvelope envelope(EmailAddress("sender@origin.test"), QList<EmailAddress>()
+                          << EmailAddress("one@a.test") << EmailAddress("two@B.test")
+                          << EmailAddress("three@a.test"));
+    QByteArray body("Subject: test\r\n\r\nHello\r\n");
+
+    QVERIFY(delivery.deliver(envelope, body));
+    QVERIFY(delivery.waitForFinished(10000));
+
+    QCOMPARE(spy.count(), 2);
+    QCOMPARE(server.messages.size(), 2);
+    QCOMPARE(server.messages.at(0), body);
+    QCOMPARE(server.messages.at(1), body);
+    QCOMPARE(server.recipients.size(), 3);
+    QCOMPARE(delivery.getRecipientStatuses().size(), 3);
+    foreach (const SmtpRecipientStatus &recipient, delivery.getRecipientStatuses())
+        QCOMPARE(recipient.getStatus(), SmtpRecipientStatus::Accepted);
+
+    // The MX records and the connections of the domains are reused
+    QVERIFY(delivery.deliver(envelope, body));
+    QVERIFY(delivery.waitForFinished(10000));
+
+    QCOMPARE(server.messages.size(), 4);
+    QCOMPARE(server.sessions, 2);
+    QCOMPARE(resolver.mxLookups, 2);
+}
+
+void MxDeliveryTest::testFallsBackToNextExchanger() {
+    StubSmtpServer server;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    // The first exchanger has no address, the second one is reachable
+    StubMxResolver resolver;
+    resolver.exchangers.insert("a.test", QStringList() << "down.a.test" << "mx.a.test");
+    resolver.hosts.insert("mx.a.test", QList<QHostAddress>() << QHostAddress::LocalHost);
+
+    SmtpMxDelivery delivery;
+    delivery.setResolver(&resolver);
+    delivery.setPort(server.serverPort());
+    delivery.setTimeout(5000);
+
+    SmtpEnvelope envelope(EmailAddress("sender@origin.test"),
+                          QList<EmailAddress>() << EmailAddress("one@a.test"));
+
+    QVERIFY(delivery.deliver(envelope, "Subject: test\r\n\r\nHello\r\n"));
+    QVERIFY(delivery.waitForFinished(10000));
+
+    QCOMPARE(server.messages.size(), 1);
+    QCOMPARE(delivery.getRecipientStatuses().at(0).getStatus(), SmtpRecipientStatus::Accepted);
+}
+
+void MxDeliveryTest::testNullMx() {
+    StubMxResolver resolver;
+    resolver.exchangers.insert("null.test", QStringList());
+
+    SmtpMxDelivery delivery;
+    delivery.setResolver(&resolver);
+
+    SmtpEnvelope envelope(EmailAddress("sender@origin.test"),
+                          QList<EmailAddress>() << EmailAddress("one@null.test"));
+
+    QVERIFY(delivery.deliver(envelope, "Subject: test\r\n\r\nHello\r\n"));
+    QVERIFY(delivery.waitForFinished(1000));
+
+    // The domain takes no mail, retrying would not help
+    QCOMPARE(delivery.getRecipientStatuses().size(), 1);
+    QCOMPARE(delivery.getRecipientStatuses().at(0).getStatus(), SmtpRecipientStatus::Rejected);
+    QCOMPARE(delivery.getRecipientStatuses().at(0).getResponseCode(), 556);
+    QCOMPARE(delivery.getRecipientStatuses().at(0).getEnhancedCode(), QString("5.1.10"));
+}
+
+void MxDeliveryTest::testMxLookupFailure() {
+    StubMxResolver resolver;
+    resolver.failing << "broken.test";
+
+    SmtpMxDelivery delivery;
+    delivery.setResolver(&resolver);
+
+    SmtpEnvelope envelope(EmailAddress("sender@origin.test"),
+                          QList<EmailAddress>() << EmailAddress("one@broken.test"));
+
+    QVERIFY(delivery.deliver(envelope, "Subject: test\r\n\r\nHello\r\n"));
+    QVERIFY(delivery.waitForFinished(1000));
+
+    // SERVFAIL or a timeout may pass, the recipient is kept for a retry
+    QCOMPARE(delivery.getRecipientStatuses().size(), 1);
+    QCOMPARE(delivery.getRecipientStatuses().at(0).getStatus(), SmtpRecipientStatus::Pending);
+}
+
+void MxDeliveryTest::testEndsDataWithoutRecipient() {
+    StubSmtpServer server;
+    server.pipelining = true;
+    server.deferred << "one@a.test";
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    StubMxResolver resolver;
+    resolver.exchangers.insert("a.test", QStringList() << "mx.a.test");
+    resolver.hosts.insert("mx.a.test", QList<QHostAddress>() << QHostAddress::LocalHost);
+
+    SmtpMxDelivery delivery;
+    delivery.setResolver(&resolver);
+    delivery.setPort(server.serverPort());
+    delivery.setTimeout(5000);
+
+    SmtpEnvelope envelope(EmailAddress("sender@origin.test"),
+                          QList<EmailAddress>() << EmailAddress("one@a.test"));
+
+    QVERIFY(delivery.deliver(envelope, "Subject: test\r\n\r\nHello\r\n"));
+    QVERIFY(delivery.waitForFinished(10000));
+
+    // The pipelined DATA got 354: the dot has to end it before anything else
+    QCOMPARE(server.messages.size(), 1);
+    QVERIFY(server.messages.at(0).isEmpty());
+    QCOMPARE(delivery.getRecipientStatuses().at(0).getStatus(), SmtpRecipientStatus::Deferred);
+}
+
+void MxDeliveryTest::cleanup() {
+    SmtpAddressCache::clear();
+}
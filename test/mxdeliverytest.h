@@ -0,0 +1,67 @@
+#ifndef MXDELIVERYTEST_H
+#define MXDELIVERYTEST_H
+
+#include <QObject>
+#include <QHash>
+#include <QStringList>
+#include <QTcpServer>
+#include "connectortest.h"
+
+class StubMxResolver : public StubResolver
+{
+    Q_OBJECT
+public:
+    StubMxResolver(QObject *parent = 0);
+
+    void lookupMx(const QString &domain);
+
+    QHash<QString, QStringList> exchangers;
+    QStringList failing;
+    int mxLookups;
+};
+
+/**
+ * @brief Minimal SMTP server, accepts every recipient but the deferred ones
+ * and records the transactions it received. With stallData the final dot
+ * is never answered, with pipelining DATA is taken even without recipient.
+ */
+class StubSmtpServer : public QTcpServer
+{
+    Q_OBJECT
+public:
+    StubSmtpServer(QObject *parent = 0);
+
+    QStringList deferred;
+    bool stallData;
+    bool pipelining;
+    QStringList recipients;
+    QList<QByteArray> messages;
+    int sessions;
+
+protected slots:
+    void newSession();
+    void readLines();
+
+protected:
+    QHash<QObject*, QByteArray> data;
+};
+
+class MxDeliveryTest : public QObject
+{
+    Q_OBJECT
+public:
+    MxDeliveryTest(QObject *parent = 0);
+
+private slots:
+
+    void init();
+    void cleanup();
+
+    void testGroupsByDomain();
+    void testFallsBackToNextExchanger();
+    void testNullMx();
+    void testMxLookupFailure();
+    void testEndsDataWithoutRecipient();
+};
+
+#endif // MXDELIVERYTEST_H
@@ -0,0 +1,209 @@
+#include "spooltest.h"
+#include <QtTest/QtTest>
+#include <QDir>
+#include <QFile>
+#include "mxdeliverytest.h"
+#include "../src/smtpspool.h"
+#include "../src/smtpclient.h"
+#include "../src/smtpconnector.h"
+
+static SmtpEnvelope envelope(const QString &rcpt)
+{
+    return SmtpEnvelope(EmailAddress("sender@origin.test"), QList<EmailAddress>() << EmailAddress(rcpt));
+}
+
+SpoolTest::SpoolTest(QObject *parent) :
+    QObject(parent),
+    dir(0) {}
+
+void SpoolTest::init() {
+    SmtpAddressCache::clear();
+    dir = new QTemporaryDir();
+    QVERIFY(dir->isValid());
+}
+
+void SpoolTest::testRecoversStates() {
+    quint64 queued, sending, committing, delivered;
+    {
+        SmtpSpool spool(dir->path());
+        QVERIFY(spool.open());
+
+        sending = spool.enqueue(envelope("one@a.test"), "Subject: 1\r\n\r\n1\r\n");
+        committing = spool.enqueue(envelope("two@a.test"), "Subject: 2\r\n\r\n2\r\n");
+        delivered = spool.enqueue(envelope("three@a.test"), "Subject: 3\r\n\r\n3\r\n");
+        queued = spool.enqueue(envelope("four@a.test"), "Subject: 4\r\n\r\n4\r\n");
+
+        SmtpSpool::Entry entry;
+        for (int i = 0; i < 3; ++i)
+            QVERIFY(spool.takeNext(entry));
+        QVERIFY(spool.setState(committing, SmtpSpool::Committing));
+        QVERIFY(spool.setState(delivered, SmtpSpool::Delivered));
+        QVERIFY(spool.sync());
+    }
+
+    SmtpSpool spool(dir->path());
+    QVERIFY(spool.open());
+
+    // Sending starts over, Committing may have reached the server
+    QCOMPARE(spool.getState(sending), SmtpSpool::Queued);
+    QCOMPARE(spool.getState(committing), SmtpSpool::Uncertain);
+    QCOMPARE(spool.getState(delivered), SmtpSpool::Removed);
+    QCOMPARE(spool.getState(queued), SmtpSpool::Queued);
+
+    SmtpSpool::Entry entry;
+    QVERIFY(spool.takeNext(entry));
+    QCOMPARE(entry.id, sending);
+    QCOMPARE(entry.envelope.getRecipients().at(0).getAddress(), QString("one@a.test"));
+    QCOMPARE(entry.data, QByteArray("Subject: 1\r\n\r\n1\r\n"));
+
+    // New ids do not reuse the ones of the previous run
+    QVERIFY(spool.enqueue(envelope("five@a.test"), "5") > queued);
+}
+
+void SpoolTest::testDropsTornRecords() {
+    quint64 first, second;
+    {
+        SmtpSpool spool(dir->path());
+        QVERIFY(spool.open());
+        first = spool.enqueue(envelope("one@a.test"), "Subject: 1\r\n\r\n1\r\n");
+        second = spool.enqueue(envelope("two@a.test"), "Subject: 2\r\n\r\n2\r\n");
+        spool.close();
+    }
+
+    QDir spoolDir(dir->path());
+    QStringList segments = spoolDir.entryList(QStringList("segment-*.dat"), QDir::Files, QDir::Name);
+    QVERIFY(!segments.isEmpty());
+
+    // The data of the second message did not fully reach the disk, and a
+    // half written index record follows
+    QFile segment(spoolDir.filePath(segments.first()));
+    QVERIFY(segment.open(QIODevice::ReadWrite));
+    QVERIFY(segment.resize(segment.size() - 3));
+    segment.close();
+
+    QFile index(spoolDir.filePath("index.log"));
+    QVERIFY(index.open(QIODevice::Append));
+    index.write(QByteArray(10, '\x53'));
+    index.close();
+
+    SmtpSpool spool(dir->path());
+    QVERIFY(spool.open());
+
+    QCOMPARE(spool.getState(first), SmtpSpool::Queued);
+    QCOMPARE(spool.getState(second), SmtpSpool::Removed);
+    QCOMPARE(spool.count(SmtpSpool::Queued), 1);
+
+    // The index was rewritten without the torn record
+    spool.close();
+    QVERIFY(spool.open());
+    QCOMPARE(spool.count(SmtpSpool::Queued), 1);
+}
+
+void SpoolTest::testReleasesSegments() {
+    QDir spoolDir(dir->path());
+    quint64 first, second;
+    {
+        SmtpSpool spool(dir->path());
+        spool.setSegmentSize(1);
+        QVERIFY(spool.open());
+
+        // Every message starts a new segment
+        first = spool.enqueue(envelope("one@a.test"), "Subject: 1\r\n\r\n1\r\n");
+        second = spool.enqueue(envelope("two@a.test"), "Subject: 2\r\n\r\n2\r\n");
+        spool.enqueue(envelope("three@a.test"), "Subject: 3\r\n\r\n3\r\n");
+        QVERIFY(spool.sync());
+        int before = spoolDir.entryList(QStringList("segment-*.dat"), QDir::Files).size();
+
+        QVERIFY(spool.remove(first));
+        QVERIFY(spool.sync());
+        QCOMPARE(spoolDir.entryList(QStringList("segment-*.dat"), QDir::Files).size(), before - 1);
+    }
+
+    // A segment nothing points to is deleted on open
+    QFile stray(spoolDir.filePath("segment-000099.dat"));
+    QVERIFY(stray.open(QIODevice::WriteOnly));
+    stray.write("garbage");
+    stray.close();
+
+    SmtpSpool spool(dir->path());
+    QVERIFY(spool.open());
+    QVERIFY(!stray.exists());
+    QCOMPARE(spool.getState(second), SmtpSpool::Queued);
+    QCOMPARE(spool.count(SmtpSpool::Queued), 2);
+}
+
+void SpoolTest::testRequeuesDeferredRecipients() {
+    StubSmtpServer server;
+    server.deferred << "two@a.test";
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    StubMxResolver resolver;
+    resolver.hosts.insert("mx.a.test", QList<QHostAddress>() << QHostAddress::LocalHost);
+
+    SmtpSpool spool(dir->path());
+    QVERIFY(spool.open());
+
+    SmtpEnvelope both(EmailAddress("sender@origin.test"), QList<EmailAddress>()
+                      << EmailAddress("one@a.test") << EmailAddress("two@a.test"));
+    quint64 id = spool.enqueue(both, "Subject: test\r\n\r\nHello\r\n");
+
+    SmtpClient client("mx.a.test", server.serverPort());
+    client.getConnector()->setResolver(&resolver);
+    client.connectToHost();
+    QVERIFY(client.waitForReadyConnected(5000));
+
+    SmtpSpool::Entry entry;
+    QVERIFY(spool.takeNext(entry));
+    QVERIFY(spool.deliver(&client, entry, 5000));
+
+    QCOMPARE(server.recipients, QStringList() << "one@a.test");
+    QCOMPARE(spool.getState(id), SmtpSpool::Removed);
+    QVERIFY(entry.retryId != 0);
+    QCOMPARE(spool.getState(entry.retryId), SmtpSpool::Queued);
+
+    // Only the deferred recipient is sent again, with the same data
+    SmtpSpool::Entry retry;
+    QVERIFY(spool.takeNext(retry));
+    QCOMPARE(retry.id, entry.retryId);
+    QCOMPARE(retry.envelope.getRecipientCount(), 1);
+    QCOMPARE(retry.envelope.getRecipients().at(0).getAddress(), QString("two@a.test"));
+    QCOMPARE(retry.data, QByteArray("Subject: test\r\n\r\nHello\r\n"));
+
+    client.quit();
+}
+
+void SpoolTest::testAbortsStalledSend() {
+    StubSmtpServer server;
+    server.stallData = true;
+    QVERIFY(server.listen(QHostAddress::LocalHost));
+
+    StubMxResolver resolver;
+    resolver.hosts.insert("mx.a.test", QList<QHostAddress>() << QHostAddress::LocalHost);
+
+    SmtpSpool spool(dir->path());
+    QVERIFY(spool.open());
+    quint64 id = spool.enqueue(envelope("one@a.test"), "Subject: test\r\n\r\nHello\r\n");
+
+    SmtpClient client("mx.a.test", server.serverPort());
+    client.getConnector()->setResolver(&resolver);
+    client.connectToHost();
+    QVERIFY(client.waitForReadyConnected(5000));
+
+    SmtpSpool::Entry entry;
+    QVERIFY(spool.takeNext(entry));
+    QVERIFY(!spool.deliver(&client, entry, 1000));
+
+    // The server got the final dot and may still accept it: the message
+    // is not sent again, and the session that could commit it is gone
+    QCOMPARE(server.messages.size(), 1);
+    QCOMPARE(spool.getState(id), SmtpSpool::Uncertain);
+    QVERIFY(spool.getIds(SmtpSpool::Queued).isEmpty());
+    QCOMPARE(client.getSocket()->state(), QAbstractSocket::UnconnectedState);
+    QCOMPARE(client.getState(), SmtpClient::UnconnectedState);
+}
+
+void SpoolTest::cleanup() {
+    delete dir;
+    dir = 0;
+    SmtpAddressCache::clear();
+}
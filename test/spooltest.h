@@ -0,0 +1,28 @@
+#ifndef SPOOLTEST_H
+#define SPOOLTEST_H
+
+#include <QObject>
+#include <QTemporaryDir>
+
+class SpoolTest : public QObject
+{
+    Q_OBJECT
+public:
+    SpoolTest(QObject *parent = 0);
+
+private slots:
+
+    void init();
+    void cleanup();
+
+    void testRecoversStates();
+    void testDropsTornRecords();
+    void testReleasesSegments();
+    void testRequeuesDeferredRecipients();
+    void testAbortsStalledSend();
+
+private:
+    QTemporaryDir *dir;
+};
+
+#endif // SPOOLTEST_H
@@ -0,0 +1,119 @@
+#include "templatetest.h"
+#include <QtTest/QtTest>
+#include <QBuffer>
+#include <QScopedPointer>
+#include "../src/mimetemplate.h"
+#include "../src/mimemultipart.h"
+#include "../src/mimetext.h"
+
+static QByteArray serialize(MimeMessage &message)
+{
+    QByteArray data;
+    QBuffer buffer(&data);
+    buffer.open(QIODevice::WriteOnly);
+    message.writeToDevice(buffer);
+    return data;
+}
+
+TemplateTest::TemplateTest(QObject *parent) :
+    QObject(parent) {}
+
+void TemplateTest::testRenderMatchesMessage() {
+    QScopedPointer<MimeMultiPart> body(new MimeMultiPart());
+
+    // Spliced into the literal spans
+    MimeText *plain = new MimeText("Dear {{name}},\r\nyour order {{order}} has shipped.\r\n");
+
+    // Encoded again for every recipient
+    MimeText *quoted = new MimeText("Grüße, {{ name }}");
+    quoted->setEncoding(MimePart::QuotedPrintable);
+    MimePart *coded = new MimePart();
+    coded->setContentType("text/plain");
+    coded->setContent("Tracking code: {{order}}");
+    coded->setEncoding(MimePart::Base64);
+
+    // Encoded once
+    MimePart *literal = new MimePart();
+    literal->setContentType("application/octet-stream");
+    literal->setContent(QByteArray("\x00\x01\x02 static data", 15));
+    literal->setEncoding(MimePart::Base64);
+
+    body->addPart(plain);
+    body->addPart(quoted);
+    body->addPart(coded);
+    body->addPart(literal);
+
+    MimeMessage message(false);
+    message.setContent(body.data());
+    message.setSender(EmailAddress("shop@example.test", "Shop"));
+    message.addTo(EmailAddress("{{email}}", "{{name}}"));
+    message.setSubject("Your order {{order}}");
+
+    MimeTemplate mailMerge;
+    mailMerge.compile(message);
+    QStringList fields = mailMerge.getFields();
+    fields.sort();
+    QCOMPARE(fields, QStringList() << "email" << "name" << "order");
+
+    QHash<QString, QString> values;
+    values.insert("name", QString::fromUtf8("Zoë"));
+    values.insert("email", "zoe@example.test");
+    values.insert("order", "A-17");
+
+    QByteArray rendered = mailMerge.render(values);
+
+    // The same message with the values filled in by hand
+    plain->setText(mailMerge.substitute(plain->getText(), values));
+    quoted->setText(mailMerge.substitute(quoted->getText(), values));
+    coded->setContent(mailMerge.substitute(QString::fromUtf8(coded->getContent()), values).toUtf8());
+
+    MimeMessage expected(false);
+    expected.setContent(body.data());
+    expected.setSender(EmailAddress("shop@example.test", "Shop"));
+    expected.addTo(EmailAddress("zoe@example.test", QString::fromUtf8("Zoë")));
+    expected.setSubject("Your order A-17");
+
+    QCOMPARE(rendered, serialize(expected));
+}
+
+void TemplateTest::testSplicedValues() {
+    QScopedPointer<MimeMultiPart> body(new MimeMultiPart());
+
+    MimeText *text = new MimeText("Note: {{note}}\r\n");
+    MimePart *ascii = new MimePart();
+    ascii->setContentType("text/plain");
+    ascii->setContent("Hello {{name}}");
+    ascii->setEncoding(MimePart::_7Bit);
+
+    body->addPart(text);
+    body->addPart(ascii);
+
+    MimeMessage message(false);
+    message.setContent(body.data());
+    message.setSender(EmailAddress("shop@example.test"));
+    message.addTo(EmailAddress("zoe@example.test"));
+    message.setSubject("For {{name}}");
+
+    MimeTemplate mailMerge;
+    mailMerge.compile(message);
+
+    // The 7bit part of the message itself is left alone
+    QCOMPARE(ascii->getEncoding(), MimePart::_7Bit);
+
+    QHash<QString, QString> values;
+    values.insert("note", "one\ntwo\rthree\r\nfour");
+    values.insert("name", QString::fromUtf8("Zoë\nBcc: x@example.test"));
+
+    QByteArray rendered = mailMerge.render(values);
+
+    // Line breaks of a value become CRLF in the body
+    QVERIFY(rendered.contains("Note: one\r\ntwo\r\nthree\r\nfour\r\n"));
+
+    // A 8-bit value cannot go into a 7bit part, it goes quoted-printable
+    QVERIFY(!rendered.contains("Content-Transfer-Encoding: 7bit"));
+    QVERIFY(rendered.contains("Content-Transfer-Encoding: quoted-printable"));
+    QVERIFY(rendered.contains("Hello Zo=C3=AB"));
+
+    // No header line can be injected
+    QVERIFY(!rendered.contains("\r\nBcc:"));
+}
@@ -0,0 +1,18 @@
+#ifndef TEMPLATETEST_H
+#define TEMPLATETEST_H
+
+#include <QObject>
+
+class TemplateTest : public QObject
+{
+    Q_OBJECT
+public:
+    TemplateTest(QObject *parent = 0);
+
+private slots:
+
+    void testRenderMatchesMessage();
+    void testSplicedValues();
+};
+
+#endif // TEMPLATETEST_H
@@ -4,7 +4,7 @@
 #
 #-------------------------------------------------
 
-QT       += testlib
+QT       += testlib network
 QT       -= gui
 
 TARGET = test
@@ -15,10 +15,18 @@ TEMPLATE = app
 
 
 SOURCES += main.cpp \
-    connectiontest.cpp
+    connectiontest.cpp \
+    connectortest.cpp \
+    mxdeliverytest.cpp \
+    spooltest.cpp \
+    templatetest.cpp
 
 HEADERS += \
-    connectiontest.h
+    connectiontest.h \
+    connectortest.h \
+    mxdeliverytest.h \
+    spooltest.h \
+    templatetest.h
 
 win32:CONFIG(release, debug|release): LIBS += -L$$PWD/../bin/lib/release/ -lSmtpMime
 else:win32:CONFIG(debug, debug|release): LIBS += -L$$PWD/../bin/lib/debug/ -lSmtpMime